@@ -0,0 +1,209 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <cmath>
+#include "color_lookup_table.h"
+#include "compiled_gmm.h"
+#include "gmm.h"
+#include "parallel.h"
+
+//----------------------------------------------------------------------------
+AC::GMM::ColorLookupTable::ColorLookupTable()
+    : m_resolution(0)
+    , m_minValue(0)
+    , m_nodeSpacing(1)
+{
+    std::fill(&m_nearestOffsets[0][0], &m_nearestOffsets[0][0] + 3 * 256, 0);
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ColorLookupTable::InitializeGrid(int bitsPerChannel, double minValue, double maxValue)
+{
+    _ASSERT(bitsPerChannel >= 1 && bitsPerChannel <= 8 && L"The table must have between 1 and 8 bits per channel");
+    _ASSERT(maxValue > minValue && L"Invalid range of color values");
+    bitsPerChannel = std::min(std::max(bitsPerChannel, 1), 8);
+    m_resolution = 1 << bitsPerChannel;
+    m_minValue = minValue;
+    m_nodeSpacing = (maxValue - minValue) / (m_resolution - 1);
+    m_values.assign((size_t)m_resolution * m_resolution * m_resolution, 0.0f);
+
+    int strides[3] = { m_resolution * m_resolution, m_resolution, 1 };
+    for (int value = 0; value < 256; ++value) {
+        int node = (int)(GridCoordinate(value) + 0.5);
+        for (int c = 0; c < 3; ++c)
+            m_nearestOffsets[c][value] = node * strides[c];
+    }
+}
+
+//----------------------------------------------------------------------------
+double AC::GMM::ColorLookupTable::GridCoordinate(double value) const
+{
+    double coordinate = (value - m_minValue) / m_nodeSpacing;
+    return std::min(std::max(coordinate, 0.0), (double)(m_resolution - 1));
+}
+
+//----------------------------------------------------------------------------
+template <typename Func>
+void AC::GMM::ColorLookupTable::Bake(size_t scratchSize, int numThreads, Func func)
+{
+    // One row of the grid (fixed x and y, all z) per item, so that the z coordinates of a block can be vectorized
+    size_t numRows = (size_t)m_resolution * m_resolution;
+    ParallelFor(numRows, ResolveNumThreads(numThreads), [&](int, size_t begin, size_t end) {
+        std::vector<double> scratch(3 * c_CompiledBlockSize + scratchSize);
+        double* xs = scratch.data();
+        double* ys = xs + c_CompiledBlockSize;
+        double* zs = ys + c_CompiledBlockSize;
+        double* funcScratch = zs + c_CompiledBlockSize;
+        for (size_t row = begin; row < end; ++row) {
+            double x = m_minValue + (double)(row / m_resolution) * m_nodeSpacing;
+            double y = m_minValue + (double)(row % m_resolution) * m_nodeSpacing;
+            float* rowValues = m_values.data() + row * m_resolution;
+            for (int blockBegin = 0; blockBegin < m_resolution; blockBegin += c_CompiledBlockSize) {
+                int numObservations = std::min(c_CompiledBlockSize, m_resolution - blockBegin);
+                for (int i = 0; i < c_CompiledBlockSize; ++i) {
+                    xs[i] = x;
+                    ys[i] = y;
+                    zs[i] = m_minValue + (double)(blockBegin + i) * m_nodeSpacing;
+                }
+                func(xs, ys, zs, numObservations, funcScratch, rowValues + blockBegin);
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ColorLookupTable::BakeLogLikelihood(const CompiledGMM3D& gmm, int bitsPerChannel, double minValue, double maxValue, int numThreads)
+{
+    InitializeGrid(bitsPerChannel, minValue, maxValue);
+    Bake(gmm.BlockScratchSize() + c_CompiledBlockSize, numThreads, [&](const double* xs, const double* ys, const double* zs, int n, double* scratch, float* values) {
+        double* logLikelihoods = scratch + gmm.BlockScratchSize();
+        gmm.LogLikelihoodsBlock(xs, ys, zs, n, scratch, logLikelihoods);
+        for (int i = 0; i < n; ++i)
+            values[i] = (float)std::max(logLikelihoods[i], (double)-std::numeric_limits<float>::max());
+    });
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ColorLookupTable::BakeLogLikelihood(const GMM3D& gmm, int bitsPerChannel, double minValue, double maxValue, int numThreads)
+{
+    BakeLogLikelihood(CompiledGMM3D(gmm), bitsPerChannel, minValue, maxValue, numThreads);
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ColorLookupTable::BakePosterior(const CompiledGMM3D& gmm1, const CompiledGMM3D& gmm2, int bitsPerChannel, double minValue, double maxValue, int numThreads)
+{
+    InitializeGrid(bitsPerChannel, minValue, maxValue);
+    const CompiledGMM3D* models[] = { &gmm1, &gmm2 };
+    size_t logTermsSize = std::max(gmm1.BlockScratchSize(), gmm2.BlockScratchSize());
+    Bake(logTermsSize + 2 * c_CompiledBlockSize, numThreads, [&](const double* xs, const double* ys, const double* zs, int n, double* scratch, float* values) {
+        double* posteriors = scratch + logTermsSize;
+        PosteriorsBlock(models, 2, xs, ys, zs, n, scratch, posteriors);
+        for (int i = 0; i < n; ++i)
+            values[i] = (float)posteriors[i];
+    });
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ColorLookupTable::BakePosterior(const GMM3D& gmm1, const GMM3D& gmm2, int bitsPerChannel, double minValue, double maxValue, int numThreads)
+{
+    BakePosterior(CompiledGMM3D(gmm1), CompiledGMM3D(gmm2), bitsPerChannel, minValue, maxValue, numThreads);
+}
+
+//----------------------------------------------------------------------------
+float AC::GMM::ColorLookupTable::LookupNearest(double x, double y, double z) const
+{
+    int ix = (int)(GridCoordinate(x) + 0.5), iy = (int)(GridCoordinate(y) + 0.5), iz = (int)(GridCoordinate(z) + 0.5);
+    return m_values[((size_t)ix * m_resolution + iy) * m_resolution + iz];
+}
+
+//----------------------------------------------------------------------------
+float AC::GMM::ColorLookupTable::LookupTrilinear(double x, double y, double z) const
+{
+    double fx = GridCoordinate(x), fy = GridCoordinate(y), fz = GridCoordinate(z);
+    // Lower corner of the cell (the last node belongs to the last cell)
+    int ix = std::min((int)fx, m_resolution - 2), iy = std::min((int)fy, m_resolution - 2), iz = std::min((int)fz, m_resolution - 2);
+    double tx = fx - ix, ty = fy - iy, tz = fz - iz;
+
+    size_t strideX = (size_t)m_resolution * m_resolution, strideY = m_resolution;
+    const float* corner = m_values.data() + ix * strideX + iy * strideY + iz;
+    // (1 - t) * a + t * b gives exactly a and b at t = 0 and t = 1 (a + t * (b - a) does not at t = 1, e.g. on the last node of the grid)
+    auto lerp = [](double a, double b, double t) { return (1 - t) * a + t * b; };
+    double c00 = lerp(corner[0], corner[1], tz);
+    double c01 = lerp(corner[strideY], corner[strideY + 1], tz);
+    double c10 = lerp(corner[strideX], corner[strideX + 1], tz);
+    double c11 = lerp(corner[strideX + strideY], corner[strideX + strideY + 1], tz);
+    return (float)lerp(lerp(c00, c01, ty), lerp(c10, c11, ty), tx);
+}
+
+//----------------------------------------------------------------------------
+float AC::GMM::ColorLookupTable::Lookup(const Vec3& observation, Interpolation interpolation) const
+{
+    if (interpolation == Trilinear)
+        return LookupTrilinear(observation[0], observation[1], observation[2]);
+    return LookupNearest(observation[0], observation[1], observation[2]);
+}
+
+//----------------------------------------------------------------------------
+template <typename Channel>
+void AC::GMM::ColorLookupTable::LookupImage(const ImageView& image, const ProbabilityMapView& map, Interpolation interpolation, int numThreads) const
+{
+    ParallelFor(image.height, ResolveNumThreads(numThreads), [&](int, size_t beginRow, size_t endRow) {
+        for (size_t row = beginRow; row < endRow; ++row) {
+            const char* pixel = static_cast<const char*>(image.data) + row * image.rowStride;
+            char* output = static_cast<char*>(map.data) + row * map.rowStride;
+            for (int col = 0; col < image.width; ++col, pixel += image.pixelStride) {
+                Channel x = *reinterpret_cast<const Channel*>(pixel);
+                Channel y = *reinterpret_cast<const Channel*>(pixel + image.channelStride);
+                Channel z = *reinterpret_cast<const Channel*>(pixel + 2 * image.channelStride);
+                float value;
+                if (interpolation == Trilinear)
+                    value = LookupTrilinear(x, y, z);
+                else if (sizeof(Channel) == 1)
+                    value = Lookup((unsigned char)x, (unsigned char)y, (unsigned char)z);
+                else
+                    value = LookupNearest(x, y, z);
+
+                if (map.type == PixelType::UInt8)
+                    reinterpret_cast<unsigned char*>(output)[col] = (unsigned char)std::min(std::max(value * 255.0f + 0.5f, 0.0f), 255.0f);
+                else
+                    reinterpret_cast<float*>(output)[col] = value;
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ColorLookupTable::Lookup(const ImageView& image, const ProbabilityMapView& map, Interpolation interpolation, int numThreads) const
+{
+    _ASSERT(m_resolution > 0 && L"The table has not been baked");
+    _ASSERT(map.width == image.width && map.height == image.height && L"The map must have the size of the image");
+    if (image.type == PixelType::UInt8)
+        LookupImage<unsigned char>(image, map, interpolation, numThreads);
+    else
+        LookupImage<float>(image, map, interpolation, numThreads);
+}
@@ -0,0 +1,120 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __COLOR_LOOKUP_TABLE_H__
+#define __COLOR_LOOKUP_TABLE_H__
+
+#include <vector>
+#include "math_utils.h"
+#include "probability_map.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        /// <summary> Dense 3D lookup table of a function of a color (a log likelihood or a posterior), baked from one or two GMMs on a regular grid
+        ///           of 2^bitsPerChannel nodes per channel spanning [minValue, maxValue]. After baking, the cost of evaluating a pixel does not depend
+        ///           on the number of modes: a nearest-node lookup of an 8-bit color is three loads from 256-entry offset tables plus one load from
+        ///           the grid, and a trilinear lookup reads the 8 surrounding nodes. Values are stored as floats (4 * 2^(3*bitsPerChannel) bytes,
+        ///           e.g. 1MB for 6 bits per channel). </summary>
+        class ColorLookupTable {
+        public:
+            enum Interpolation {
+                Nearest,  // Value of the closest grid node
+                Trilinear // Trilinear interpolation of the 8 surrounding grid nodes
+            };
+
+            ColorLookupTable();
+
+            /// <summary> Bake the log likelihood log P(x) of a GMM, excluding its global weight (see GMM3D::LogLikelihood()). </summary>
+            /// <param name="gmm">            [in] The (compiled) GMM. Its precision and instruction set settings apply. </param>
+            /// <param name="bitsPerChannel"> [optional] Resolution of the table: 2^bitsPerChannel nodes per channel, between 1 and 8. </param>
+            /// <param name="minValue">       [optional] Color value of the first node of each channel. </param>
+            /// <param name="maxValue">       [optional] Color value of the last node of each channel. </param>
+            /// <param name="numThreads">     [optional] Number of threads (0 = one per hardware thread). </param>
+            void BakeLogLikelihood(const CompiledGMM3D& gmm, int bitsPerChannel = 6, double minValue = 0, double maxValue = 255, int numThreads = 1);
+            void BakeLogLikelihood(const GMM3D& gmm, int bitsPerChannel = 6, double minValue = 0, double maxValue = 255, int numThreads = 1);
+
+            /// <summary> Bake the probability of a color to be a sample of gmm1 or gmm2, i.e. GMMLikelihoodRatio() (see PosteriorsBlock()). </summary>
+            /// <param name="gmm1"> [in] The first (e.g., foreground) gmm. </param>
+            /// <param name="gmm2"> [in] The second (e.g., background) gmm. </param>
+            /// <param name="bitsPerChannel"> [optional] Resolution of the table: 2^bitsPerChannel nodes per channel, between 1 and 8. </param>
+            /// <param name="minValue">       [optional] Color value of the first node of each channel. </param>
+            /// <param name="maxValue">       [optional] Color value of the last node of each channel. </param>
+            /// <param name="numThreads">     [optional] Number of threads (0 = one per hardware thread). </param>
+            void BakePosterior(const CompiledGMM3D& gmm1, const CompiledGMM3D& gmm2, int bitsPerChannel = 6, double minValue = 0, double maxValue = 255, int numThreads = 1);
+            void BakePosterior(const GMM3D& gmm1, const GMM3D& gmm2, int bitsPerChannel = 6, double minValue = 0, double maxValue = 255, int numThreads = 1);
+
+            /// <summary> Nearest-node lookup of an 8-bit color. </summary>
+            float Lookup(unsigned char x, unsigned char y, unsigned char z) const {
+                return m_values[m_nearestOffsets[0][x] + m_nearestOffsets[1][y] + m_nearestOffsets[2][z]];
+            }
+
+            /// <summary> Lookup of any color. Colors outside [minValue, maxValue] are clamped to the table. </summary>
+            float Lookup(const Vec3& observation, Interpolation interpolation = Nearest) const;
+
+            /// <summary> Lookup of every pixel of an image. 8-bit maps store round(255 * value), clamped to [0, 255] (so they are only useful for
+            ///           posterior tables). </summary>
+            /// <param name="image">  [in] The input image. </param>
+            /// <param name="map">    [out] The value of each pixel. </param>
+            /// <param name="interpolation"> [optional] Nearest node or trilinear interpolation. </param>
+            /// <param name="numThreads"> [optional] Number of threads (0 = one per hardware thread). </param>
+            void Lookup(const ImageView& image, const ProbabilityMapView& map, Interpolation interpolation = Nearest, int numThreads = 1) const;
+
+            /// <summary> Number of nodes per channel (0 if the table has not been baked). </summary>
+            int Resolution() const { return m_resolution; }
+
+            /// <summary> All values, stored as [x][y][z] (z varies fastest). </summary>
+            const std::vector<float>& Values() const { return m_values; }
+
+        private:
+            /// <summary> Set up the grid and the nearest-node offsets of 8-bit colors. </summary>
+            void InitializeGrid(int bitsPerChannel, double minValue, double maxValue);
+
+            /// <summary> Node coordinate of a color value along one channel, clamped to [0, m_resolution - 1]. </summary>
+            double GridCoordinate(double value) const;
+
+            float LookupNearest(double x, double y, double z) const;
+            float LookupTrilinear(double x, double y, double z) const;
+
+            /// <summary> Evaluate func(xs, ys, zs, numObservations, values) for every row of the grid (fixed x, y), in blocks of c_CompiledBlockSize. </summary>
+            template <typename Func>
+            void Bake(size_t scratchSize, int numThreads, Func func);
+
+            template <typename Channel>
+            void LookupImage(const ImageView& image, const ProbabilityMapView& map, Interpolation interpolation, int numThreads) const;
+
+            std::vector<float> m_values; // Table values, [x][y][z]
+            int m_resolution; // Nodes per channel
+            double m_minValue; // Color value of the first node
+            double m_nodeSpacing; // Distance between nodes, in color units
+            int m_nearestOffsets[3][256]; // Offset in m_values of the nearest node of each 8-bit value, for each channel
+        };
+    }
+}
+
+#endif
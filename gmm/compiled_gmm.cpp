@@ -0,0 +1,273 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <cmath>
+#include "compiled_gmm.h"
+#include "gmm.h"
+#include "parallel.h"
+
+// Local helper functions
+namespace
+{
+    using AC::GMM::CompiledGMMData;
+    using AC::GMM::c_CompiledBlockSize;
+
+    //----------------------------------------------------------------------------
+    // Transpose a block of (at most c_CompiledBlockSize) observations into structure-of-arrays form. The rest of the block is zeroed, since the
+    // vectorized kernels process full SIMD registers.
+    template <typename Vec>
+    void TransposeBlock(const Vec* observations, int numObservations, double* xs, double* ys, double* zs)
+    {
+        for (int i = 0; i < numObservations; ++i) {
+            xs[i] = observations[i][0];
+            ys[i] = observations[i][1];
+            zs[i] = observations[i][2];
+        }
+        for (int i = numObservations; i < c_CompiledBlockSize; ++i)
+            xs[i] = ys[i] = zs[i] = 0;
+    }
+
+    //----------------------------------------------------------------------------
+    // Compute constants[k] - 0.5 * (x - mu_k)^T * inv(Cov_k) * (x - mu_k) for a single observation x = (x, y, z)
+    inline double EvaluateLogTerm(const CompiledGMMData& gmm, const double* constants, int k, double x, double y, double z)
+    {
+        double dx = x - gmm.Array(CompiledGMMData::MeanX)[k], dy = y - gmm.Array(CompiledGMMData::MeanY)[k], dz = z - gmm.Array(CompiledGMMData::MeanZ)[k];
+        double mahalanobis = dx * (gmm.Precision(CompiledGMMData::Precision00, k) * dx + gmm.Precision(CompiledGMMData::Precision01, k) * dy + gmm.Precision(CompiledGMMData::Precision02, k) * dz)
+            + dy * (gmm.Precision(CompiledGMMData::Precision11, k) * dy + gmm.Precision(CompiledGMMData::Precision12, k) * dz)
+            + gmm.Precision(CompiledGMMData::Precision22, k) * dz * dz;
+        return constants[k] - 0.5 * mahalanobis;
+    }
+
+    //----------------------------------------------------------------------------
+    // Run func(xs, ys, zs, numBlockObservations, offset, logTerms) on every block of observations, split in shards across threads.
+    // Each shard owns its scratch memory, so the only allocation is one vector per shard.
+    template <typename Vec, typename Func>
+    void ForEachBlock(const CompiledGMMData& gmm, const Vec* observations, size_t numObservations, int numThreads, Func func)
+    {
+        AC::ParallelFor(numObservations, AC::ResolveNumThreads(numThreads), [&](int, size_t begin, size_t end) {
+            std::vector<double> scratch((gmm.stride + 3) * c_CompiledBlockSize);
+            double* xs = scratch.data();
+            double* ys = xs + c_CompiledBlockSize;
+            double* zs = ys + c_CompiledBlockSize;
+            double* logTerms = zs + c_CompiledBlockSize;
+            for (size_t blockBegin = begin; blockBegin < end; blockBegin += c_CompiledBlockSize) {
+                int numBlockObservations = (int)std::min<size_t>(c_CompiledBlockSize, end - blockBegin);
+                TransposeBlock(observations + blockBegin, numBlockObservations, xs, ys, zs);
+                func(xs, ys, zs, numBlockObservations, blockBegin, logTerms);
+            }
+        });
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename Scalar>
+AC::GMM::CompiledGMM3D::CompiledGMM3D(const GMM3DT<Scalar>& gmm)
+    : m_numModes((int)gmm.Modes().size())
+    , m_globalWeight(gmm.GlobalWeight())
+    , m_kernels(&Kernels::GetKernels())
+    , m_precision(EvaluationPrecision::Exact)
+{
+    m_stride = std::max(1, (m_numModes + c_CompiledModeAlignment - 1) / c_CompiledModeAlignment) * c_CompiledModeAlignment;
+    m_sharedPrecision = gmm.covarianceType() == CovarianceType::Tied;
+    m_data.assign(CompiledGMMData::Size(m_stride, m_sharedPrecision), 0.0);
+
+    // Padding modes: zero mean and precision, and a log constant that makes them irrelevant in any log-sum-exp or maximum
+    std::fill(m_data.begin() + CompiledGMMData::LogConstant * m_stride, m_data.begin() + CompiledGMMData::Precision00 * m_stride,
+        -std::numeric_limits<double>::max());
+
+    // Tied modes share one precision (EM gives them the same covariance), so only the one of the first mode is stored
+    int precisionStride = m_sharedPrecision ? 1 : m_stride;
+    double* precisions = m_data.data() + CompiledGMMData::Precision00 * m_stride;
+    for (int k = 0; k < m_numModes; ++k) {
+        const typename GMM3DT<Scalar>::ModeType& mode = *gmm.Modes(k);
+        m_data[CompiledGMMData::MeanX * m_stride + k] = mode.Mean()[0];
+        m_data[CompiledGMMData::MeanY * m_stride + k] = mode.Mean()[1];
+        m_data[CompiledGMMData::MeanZ * m_stride + k] = mode.Mean()[2];
+        m_data[CompiledGMMData::LogConstant * m_stride + k] = mode.LogNormFactor() + mode.LogWeight();
+        m_data[CompiledGMMData::LogNormFactor * m_stride + k] = mode.LogNormFactor();
+        if (m_sharedPrecision && k > 0)
+            continue;
+        Mat3 precision = mode.InvCovariance().template cast<double>();
+        precisions[0 * precisionStride + k] = precision(0, 0);
+        precisions[1 * precisionStride + k] = precision(0, 1) + precision(1, 0);
+        precisions[2 * precisionStride + k] = precision(0, 2) + precision(2, 0);
+        precisions[3 * precisionStride + k] = precision(1, 1);
+        precisions[4 * precisionStride + k] = precision(1, 2) + precision(2, 1);
+        precisions[5 * precisionStride + k] = precision(2, 2);
+    }
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::CompiledGMMData AC::GMM::CompiledGMM3D::Data() const
+{
+    CompiledGMMData data;
+    data.data = m_data.data();
+    data.numModes = m_numModes;
+    data.stride = m_stride;
+    data.sharedPrecision = m_sharedPrecision;
+    data.globalWeight = m_globalWeight;
+    return data;
+}
+
+//----------------------------------------------------------------------------
+double AC::GMM::CompiledGMM3D::LogLikelihood(const Vec3& observation) const
+{
+    // Trivial case (same as GMM3D::LogLikelihood)
+    if (m_numModes == 0)
+        return 0;
+
+    // Single-pass log-sum-exp (see GMM3D::LogLikelihood), so that we do not need any temporary storage
+    CompiledGMMData gmm = Data();
+    const double* logConstants = gmm.Array(CompiledGMMData::LogConstant);
+    double maxLogValue = -std::numeric_limits<double>::max();
+    double expsum = 0;
+    for (int k = 0; k < gmm.numModes; ++k) {
+        double logValue = EvaluateLogTerm(gmm, logConstants, k, observation[0], observation[1], observation[2]);
+        if (logValue <= maxLogValue) {
+            if (logValue - maxLogValue >= c_LogSumExpFlushThreshold)
+                expsum += exp(logValue - maxLogValue);
+        }
+        else {
+            expsum = maxLogValue - logValue >= c_LogSumExpFlushThreshold ? expsum * exp(maxLogValue - logValue) + 1 : 1;
+            maxLogValue = logValue;
+        }
+    }
+    return maxLogValue + log(expsum);
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::GMM::CompiledGMM3D::LogLikelihoods(const Vec* observations, size_t numObservations, double* logLikelihoods, int numThreads) const
+{
+    ForEachBlock(Data(), observations, numObservations, numThreads, [&](const double* xs, const double* ys, const double* zs, int n, size_t offset, double* logTerms) {
+        double blockLogLikelihoods[c_CompiledBlockSize];
+        LogLikelihoodsBlock(xs, ys, zs, n, logTerms, blockLogLikelihoods);
+        std::copy(blockLogLikelihoods, blockLogLikelihoods + n, logLikelihoods + offset);
+    });
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::CompiledGMM3D::LogLikelihoodsBlock(const double* xs, const double* ys, const double* zs, int numObservations, double* logTerms, double* logLikelihoods) const
+{
+    // Trivial case (same as GMM3D::LogLikelihood)
+    CompiledGMMData gmm = Data();
+    if (gmm.numModes == 0) {
+        std::fill(logLikelihoods, logLikelihoods + numObservations, 0.0);
+        return;
+    }
+
+    double maxLogTerms[c_CompiledBlockSize];
+    m_kernels->evaluateLogTerms(gmm, gmm.Array(CompiledGMMData::LogConstant), xs, ys, zs, numObservations, logTerms, maxLogTerms);
+    if (m_precision == EvaluationPrecision::Fast) {
+        m_kernels->fastExponentiateLogTerms(gmm.numModes, numObservations, maxLogTerms, logTerms, logLikelihoods);
+        m_kernels->fastLog(numObservations, logLikelihoods);
+    }
+    else {
+        m_kernels->exponentiateLogTerms(gmm.numModes, numObservations, maxLogTerms, logTerms, logLikelihoods, true);
+        for (int i = 0; i < numObservations; ++i)
+            logLikelihoods[i] = log(logLikelihoods[i]);
+    }
+    for (int i = 0; i < numObservations; ++i)
+        logLikelihoods[i] += maxLogTerms[i];
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::GMM::CompiledGMM3D::Likelihoods(const Vec* observations, size_t numObservations, double* likelihoods, int numThreads) const
+{
+    LogLikelihoods(observations, numObservations, likelihoods, numThreads);
+    bool fast = m_precision == EvaluationPrecision::Fast;
+    for (size_t o = 0; o < numObservations; ++o) {
+        // FastExp() clamps its argument instead of underflowing, so we flush large negative values explicitly
+        double likelihood = fast ? (likelihoods[o] < -708.0 ? 0.0 : Kernels::FastExp(likelihoods[o])) * m_globalWeight : exp(likelihoods[o]) * m_globalWeight;
+        likelihoods[o] = IsFinite(likelihood) ? likelihood : 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::GMM::CompiledGMM3D::Responsibilities(const Vec* observations, size_t numObservations, double* responsibilities, int numThreads) const
+{
+    CompiledGMMData gmm = Data();
+    const double* logConstants = gmm.Array(CompiledGMMData::LogConstant);
+    ForEachBlock(gmm, observations, numObservations, numThreads, [&](const double* xs, const double* ys, const double* zs, int n, size_t offset, double* logTerms) {
+        double maxLogTerms[c_CompiledBlockSize];
+        double sums[c_CompiledBlockSize];
+        m_kernels->evaluateLogTerms(gmm, logConstants, xs, ys, zs, n, logTerms, maxLogTerms);
+        // Negligible terms are not flushed in exact mode: they are tiny, but they are still valid responsibilities
+        if (m_precision == EvaluationPrecision::Fast)
+            m_kernels->fastExponentiateLogTerms(gmm.numModes, n, maxLogTerms, logTerms, sums);
+        else
+            m_kernels->exponentiateLogTerms(gmm.numModes, n, maxLogTerms, logTerms, sums, false);
+        for (int i = 0; i < n; ++i) {
+            double* row = responsibilities + (offset + i) * gmm.numModes;
+            for (int k = 0; k < gmm.numModes; ++k) {
+                double responsibility = logTerms[k * c_CompiledBlockSize + i] / sums[i];
+                row[k] = IsFinite(responsibility) ? responsibility : 0;
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::GMM::CompiledGMM3D::ClosestModes(const Vec* observations, size_t numObservations, int* modes, double* logProbabilities, int numThreads) const
+{
+    CompiledGMMData gmm = Data();
+    const double* logNormFactors = gmm.Array(CompiledGMMData::LogNormFactor);
+    ForEachBlock(gmm, observations, numObservations, numThreads, [&](const double* xs, const double* ys, const double* zs, int n, size_t offset, double* logTerms) {
+        double maxLogTerms[c_CompiledBlockSize];
+        m_kernels->evaluateLogTerms(gmm, logNormFactors, xs, ys, zs, n, logTerms, maxLogTerms);
+        for (int i = 0; i < n; ++i) {
+            // Same tie-breaking as GMM3D::ClosestMode: the first mode with the maximum log probability
+            double bestLogProbability = -std::numeric_limits<double>::max();
+            int mode = INVALID_MODE;
+            for (int k = 0; k < gmm.numModes; ++k) {
+                if (logTerms[k * c_CompiledBlockSize + i] > bestLogProbability) {
+                    mode = k;
+                    bestLogProbability = logTerms[k * c_CompiledBlockSize + i];
+                }
+            }
+            modes[offset + i] = mode;
+            if (logProbabilities != nullptr)
+                logProbabilities[offset + i] = bestLogProbability;
+        }
+    });
+}
+
+// Supported scalar types
+template AC::GMM::CompiledGMM3D::CompiledGMM3D(const GMM3D&);
+template AC::GMM::CompiledGMM3D::CompiledGMM3D(const GMM3Df&);
+template void AC::GMM::CompiledGMM3D::LogLikelihoods(const Vec3*, size_t, double*, int) const;
+template void AC::GMM::CompiledGMM3D::LogLikelihoods(const Vec3f*, size_t, double*, int) const;
+template void AC::GMM::CompiledGMM3D::Likelihoods(const Vec3*, size_t, double*, int) const;
+template void AC::GMM::CompiledGMM3D::Likelihoods(const Vec3f*, size_t, double*, int) const;
+template void AC::GMM::CompiledGMM3D::Responsibilities(const Vec3*, size_t, double*, int) const;
+template void AC::GMM::CompiledGMM3D::Responsibilities(const Vec3f*, size_t, double*, int) const;
+template void AC::GMM::CompiledGMM3D::ClosestModes(const Vec3*, size_t, int*, double*, int) const;
+template void AC::GMM::CompiledGMM3D::ClosestModes(const Vec3f*, size_t, int*, double*, int) const;
@@ -0,0 +1,117 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __COMPILED_GMM_H__
+#define __COMPILED_GMM_H__
+
+#include <vector>
+#include "math_utils.h"
+#include "gmm_kernels.h"
+#include "gmm.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        /// <summary> Read-only GMM evaluator "compiled" from a trained GMM3D. The means, packed symmetric inverse covariances and the per-mode
+        ///           constants log(norm factor) + log(weight) are stored as flat, contiguous arrays (see CompiledGMMData), so that the evaluation
+        ///           does not chase one pointer per mode, and the whole model fits in L1 for typical numbers of modes (~1.4KB for 16 modes, ~0.7KB if the
+        ///           covariances are tied, since tied modes share a single precision).
+        ///           All evaluation functions are const and thread-safe. The batch functions process c_CompiledBlockSize observations at a time
+        ///           with the vectorized kernels in gmm_kernels.h, selected at runtime for the CPU we are running on. Both double and float GMMs
+        ///           (and observations) are supported; the compiled parameters and the kernels are always double precision. </summary>
+        class CompiledGMM3D {
+        public:
+            /// <summary> Compile a GMM. Later changes to the GMM are not reflected in the compiled GMM. </summary>
+            /// <param name="gmm"> The (trained) GMM (GMM3D or GMM3Df). </param>
+            template <typename Scalar>
+            explicit CompiledGMM3D(const GMM3DT<Scalar>& gmm);
+
+            /// <summary> Compute the log likelihood of the mixture model for an observation (see GMM3D::LogLikelihood()). </summary>
+            double LogLikelihood(const Vec3& observation) const;
+
+            // The batch functions accept Vec3 or Vec3f observations.
+
+            /// <summary> Compute the log likelihood log P(x_n) of each observation in a batch (see GMM3D::LogLikelihoods()). </summary>
+            template <typename Vec>
+            void LogLikelihoods(const Vec* observations, size_t numObservations, double* logLikelihoods, int numThreads = 1) const;
+
+            /// <summary> Compute the log likelihood of a block of (at most c_CompiledBlockSize) observations, given in structure-of-arrays form.
+            ///           This is the building block of LogLikelihoods(), for callers that produce observations in their own layout (e.g. images).
+            ///           The arrays xs, ys, zs and logLikelihoods must have room for c_CompiledBlockSize entries, and the padding in xs, ys, zs
+            ///           must be finite. </summary>
+            /// <param name="logTerms"> Scratch memory of BlockScratchSize() doubles. </param>
+            void LogLikelihoodsBlock(const double* xs, const double* ys, const double* zs, int numObservations, double* logTerms, double* logLikelihoods) const;
+
+            /// <summary> Number of doubles of scratch memory needed by LogLikelihoodsBlock(). </summary>
+            size_t BlockScratchSize() const { return (size_t)m_stride * c_CompiledBlockSize; }
+
+            /// <summary> Compute the likelihood P(x_n) of each observation in a batch (see GMM3D::Likelihoods()). </summary>
+            template <typename Vec>
+            void Likelihoods(const Vec* observations, size_t numObservations, double* likelihoods, int numThreads = 1) const;
+
+            /// <summary> Compute the responsibilities p(k|x_n) of each observation in a batch, stored point-major (see GMM3D::Responsibilities()). </summary>
+            template <typename Vec>
+            void Responsibilities(const Vec* observations, size_t numObservations, double* responsibilities, int numThreads = 1) const;
+
+            /// <summary> Compute the closest mode of each observation in a batch (see GMM3D::ClosestModes()). </summary>
+            template <typename Vec>
+            void ClosestModes(const Vec* observations, size_t numObservations, int* modes, double* logProbabilities = nullptr, int numThreads = 1) const;
+
+            /// <summary> View of the compiled parameters (only valid while this object is alive and unchanged). </summary>
+            CompiledGMMData Data() const;
+
+            int NumModes() const { return m_numModes; }
+            double GlobalWeight() const { return m_globalWeight; }
+
+            /// <summary> Limit the instruction set of the kernels used by the batch functions (by default, the fastest one supported by the CPU). </summary>
+            /// <param name="maxInstructionSet"> The fastest instruction set we allow. </param>
+            void setInstructionSet(Kernels::InstructionSet maxInstructionSet) { m_kernels = &Kernels::GetKernels(maxInstructionSet); }
+            Kernels::InstructionSet InstructionSet() const { return m_kernels->instructionSet; }
+
+            /// <summary> Select the precision of exp() and log() in LogLikelihoods(), Likelihoods() and Responsibilities() (by default, exact).
+            ///           In fast mode, log likelihoods and likelihoods have a relative error below ~1e-15 (see Kernels::FastExp and Kernels::FastLog), and
+            ///           responsibilities below exp(c_LogSumExpFlushThreshold) relative to the largest one are flushed to 0. </summary>
+            /// <remarks> In exact mode the kernels vectorize everything but exp() and log(), which still go through the C library, one value at
+            ///           a time. That caps the speedup over the per-observation path (GMM3D::LogLikelihood in a loop) at about 2x (1M observations,
+            ///           16 modes, AVX-512); only fast mode gets close to an order of magnitude (about 6x to 10x on the same benchmark). </remarks>
+            void setPrecision(EvaluationPrecision precision) { m_precision = precision; }
+            EvaluationPrecision Precision() const { return m_precision; }
+
+        private:
+            std::vector<double, Eigen::aligned_allocator<double>> m_data; // Storage for all parameters (see CompiledGMMData)
+            int m_numModes; // Number of modes
+            int m_stride; // Number of modes padded to c_CompiledModeAlignment
+            bool m_sharedPrecision; // All modes share the precision of the first one (tied covariances)
+            double m_globalWeight; // Global weight of the GMM
+            const Kernels::KernelTable* m_kernels; // Kernels used in the batch functions
+            EvaluationPrecision m_precision; // Precision of exp() and log() in the batch functions
+        };
+    }
+}
+
+#endif
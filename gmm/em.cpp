@@ -27,104 +27,341 @@ SOFTWARE.
 */
 #include "gmm.h"
 #include "em.h"
+#include "parallel.h"
 
 //----------------------------------------------------------------------------
-AC::GMM::EM::EM(int numObservations, int numModes, double tolerance, int maxIterations) 
-    : m_numTrainingPoints(numObservations)
+template <int Dims, typename Scalar>
+AC::GMM::EMT<Dims, Scalar>::EMT(int numObservations, int numModes, double tolerance, int maxIterations, int numThreads) 
+    : m_storage(ResponsibilityStorage::ModeMajor)
+    , m_topK(c_EMDefaultTopKResponsibilities)
+    , m_numTrainingPoints(numObservations)
+    , m_weights(nullptr)
+    , m_sumWeights(numObservations)
     , m_tolerance(tolerance)
     , m_maxIterations(maxIterations)
+    , m_numModes(numModes)
 {
-    // Reserve memory for our temporary vectors (to avoid allocations while processing)
-    m_tmpResponsibilities.reserve(numModes);
+    // The responsibilities are allocated in Process(), once we know how to store them
+    setNumThreads(numThreads);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::AllocateResponsibilities(size_t numObservations, int numModes)
+{
+    // Release the storage of the other strategies, and (re)allocate ours only if its size changed, to avoid allocations in the iterations
+    if (m_storage != ResponsibilityStorage::ModeMajor)
+        std::vector<std::vector<Scalar>>().swap(m_tmpResponsibilities);
+    if (m_storage != ResponsibilityStorage::PointMajor)
+        std::vector<float>().swap(m_tmpPointResponsibilities);
+    if (m_storage != ResponsibilityStorage::TopK) {
+        std::vector<uint16_t>().swap(m_tmpTopKModes);
+        std::vector<float>().swap(m_tmpTopKResponsibilities);
+    }
+
+    switch (m_storage) {
+    case ResponsibilityStorage::ModeMajor:
+        m_tmpResponsibilities.resize(numModes);
+        for (auto& responsibilities : m_tmpResponsibilities)
+            responsibilities.resize(numObservations);
+        break;
+    case ResponsibilityStorage::PointMajor:
+        m_tmpPointResponsibilities.resize(numObservations * numModes);
+        break;
+    case ResponsibilityStorage::TopK: {
+        _ASSERT(numModes <= std::numeric_limits<uint16_t>::max() && L"Too many modes for TopK responsibilities");
+        size_t topK = (size_t)std::min(m_topK, numModes);
+        m_tmpTopKModes.resize(numObservations * topK);
+        m_tmpTopKResponsibilities.resize(numObservations * topK);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::ResetStatistics(AlignedVector<StatisticsType>& statistics, const GMMType& gmm)
+{
+    int numModes = (int)gmm.Modes().size();
+    statistics.resize(numModes);
     for (int k = 0; k < numModes; ++k)
-        m_tmpResponsibilities.emplace_back(std::vector<double>(numObservations));
+        statistics[k].Reset(gmm.Modes(k)->Mean().template cast<double>(), gmm.covarianceType());
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::MergeStatistics(int numModes)
+{
+    for (int t = 1; t < m_numThreads; ++t)
+        for (int k = 0; k < numModes; ++k)
+            m_tmpStatistics[0][k].Merge(m_tmpStatistics[t][k]);
 }
 
 //----------------------------------------------------------------------------
-void AC::GMM::EM::UpdateResponsibilities(const std::vector<Vec3>& observations, GMM3D& gmm)
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::setNumThreads(int numThreads)
+{
+    m_numThreads = ResolveNumThreads(numThreads);
+    m_tmpLogProbabilities.assign(m_numThreads, std::vector<double>(m_numModes));
+    m_tmpStatistics.assign(m_numThreads, AlignedVector<StatisticsType>(m_numModes));
+    m_tmpLogLikelihoods.assign(m_numThreads, 0.0);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::EMT<Dims, Scalar>::UpdateResponsibilities(const std::vector<VecType>& observations, GMMType& gmm)
 {
     _ASSERT(observations.size() == m_numTrainingPoints && m_numTrainingPoints >= gmm.Modes().size() && "Invalid number of observations.");
-    int numObservations = (int)observations.size();
+    bool accumulate = m_storage == ResponsibilityStorage::None;
+    ParallelFor(observations.size(), m_numThreads, [&](int idxThread, size_t begin, size_t end) {
+        if (accumulate)
+            ResetStatistics(m_tmpStatistics[idxThread], gmm);
+        m_tmpLogLikelihoods[idxThread] = UpdateResponsibilities(observations, gmm, begin, end, m_tmpLogProbabilities[idxThread], m_tmpStatistics[idxThread]);
+    });
+    if (accumulate)
+        MergeStatistics((int)gmm.Modes().size());
+
+    // Reduce in a fixed order, so that the result only depends on the number of threads
+    double logLikelihood = 0;
+    for (double threadLogLikelihood : m_tmpLogLikelihoods)
+        logLikelihood += threadLogLikelihood;
+
+    // If NaN or infinite, return minimum possible value for log (corresponding to 0 probability)
+    return IsFinite(logLikelihood) ? logLikelihood : -std::numeric_limits<double>::max();
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::EMT<Dims, Scalar>::UpdateResponsibilities(const std::vector<VecType>& observations, GMMType& gmm, size_t begin, size_t end, std::vector<double>& logProbabilities,
+    AlignedVector<StatisticsType>& statistics)
+{
     int numModes = (int)gmm.Modes().size();
-    for (int o = 0; o < numObservations; ++o) {
+    logProbabilities.resize(numModes);
+    double logLikelihood = 0;
+    for (size_t o = begin; o < end; ++o) {
+        // Evaluate log(p(x_n|k)) + log(P(k)) once per mode, and keep track of the maximum for the log-sum-exp trick
+        double maxLogProbability = -std::numeric_limits<double>::max();
+        for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+            double logProbability = gmm.Modes(idxMode)->EvaluateLog(observations[o]) + gmm.Modes(idxMode)->LogWeight();
+            logProbabilities[idxMode] = logProbability;
+            if (logProbability > maxLogProbability)
+                maxLogProbability = logProbability;
+        }
+
+        // log(p(x_n)) = max + log(sum_k(exp(log(p(x_n|k)) + log(P(k)) - max))). We keep the scaled exponentials, since
+        // p(k|x_n) = exp(log(p(x_n|k)) + log(P(k)) - max) / sum_k(exp(log(p(x_n|k)) + log(P(k)) - max)).
+        double expsum = 0;
         for (int idxMode = 0; idxMode < numModes; ++idxMode) {
-            double responsibility = exp(gmm.LogResponsibility(observations[o], idxMode));
-            m_tmpResponsibilities[idxMode][o] = IsFinite(responsibility) ? responsibility : 0;
+            logProbabilities[idxMode] = exp(logProbabilities[idxMode] - maxLogProbability);
+            expsum += logProbabilities[idxMode];
+        }
+        double weight = m_weights != nullptr ? (*m_weights)[o] : 1.0;
+        logLikelihood += weight * (maxLogProbability + log(expsum));
+
+        for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+            double responsibility = logProbabilities[idxMode] / expsum;
+            logProbabilities[idxMode] = IsFinite(responsibility) ? responsibility : 0;
+        }
+
+        if (m_storage == ResponsibilityStorage::None) {
+            for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+                if (logProbabilities[idxMode] > 0)
+                    statistics[idxMode].Push(observations[o], logProbabilities[idxMode] * weight);
+            }
+        }
+        else {
+            StoreResponsibilities(o, logProbabilities);
         }
     }
+    return logLikelihood;
 }
 
 //----------------------------------------------------------------------------
-void AC::GMM::EM::UpdateWeights(GMM3D& gmm)
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::StoreResponsibilities(size_t o, const std::vector<double>& responsibilities)
 {
-    _ASSERT(m_numTrainingPoints >= gmm.Modes().size() && "Invalid number of observations.");
-    int numModes = (int)gmm.Modes().size();
-    for (int k = 0; k < numModes; ++k) {
-        AC::OnlineMean<double> weight;
-        for (int o = 0; o < m_numTrainingPoints; ++o)
-            weight.Push(m_tmpResponsibilities[k][o]);
-        gmm.Modes(k)->setWeight(std::max(weight.Mean(), c_SafeMinWeight)); // sum_n(p(k|x_n))/N
+    int numModes = (int)responsibilities.size();
+    switch (m_storage) {
+    case ResponsibilityStorage::ModeMajor:
+        for (int idxMode = 0; idxMode < numModes; ++idxMode)
+            m_tmpResponsibilities[idxMode][o] = (Scalar)responsibilities[idxMode];
+        break;
+    case ResponsibilityStorage::PointMajor: {
+        float* pointResponsibilities = &m_tmpPointResponsibilities[o * numModes];
+        for (int idxMode = 0; idxMode < numModes; ++idxMode)
+            pointResponsibilities[idxMode] = (float)responsibilities[idxMode];
+        break;
+    }
+    case ResponsibilityStorage::TopK: {
+        // Keep the topK largest responsibilities (insertion into a short sorted list), and renormalize them to sum to one
+        int topK = std::min(m_topK, numModes);
+        uint16_t* modes = &m_tmpTopKModes[o * topK];
+        float* values = &m_tmpTopKResponsibilities[o * topK];
+        int numKept = 0;
+        for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+            double responsibility = responsibilities[idxMode];
+            if (numKept == topK && !(responsibility > values[topK - 1]))
+                continue;
+            int pos = numKept < topK ? numKept++ : topK - 1;
+            for (; pos > 0 && values[pos - 1] < responsibility; --pos) {
+                values[pos] = values[pos - 1];
+                modes[pos] = modes[pos - 1];
+            }
+            values[pos] = (float)responsibility;
+            modes[pos] = (uint16_t)idxMode;
+        }
+        double sumKept = 0;
+        for (int j = 0; j < topK; ++j)
+            sumKept += values[j];
+        for (int j = 0; j < topK; ++j)
+            values[j] = sumKept > 0 ? (float)(values[j] / sumKept) : 0.0f;
+        break;
+    }
+    default:
+        break;
     }
 }
 
 //----------------------------------------------------------------------------
-void AC::GMM::EM::UpdateMeans(const std::vector<Vec3>& observations, GMM3D& gmm)
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::AccumulateStatistics(const std::vector<VecType>& observations, const GMMType& gmm)
 {
     _ASSERT(observations.size() == m_numTrainingPoints && m_numTrainingPoints >= gmm.Modes().size() && "Invalid number of observations.");
-    int numModes = (int)gmm.Modes().size();
-    AC::OnlineMean<Vec3> sumMean;
-    for (int k = 0; k < numModes; ++k) {
-        for (int o = 0; o < m_numTrainingPoints; ++o)
-            sumMean.Push(observations[o] * m_tmpResponsibilities[k][o]); // sum_n(p(k|x_n)*x_n)/N
-                                                                         // In UpdateWeights, we calculate sum_n( p(k|x_n) )/N, so the /N in sumMean cancels this one, and we get:
-        gmm.Modes(k)->setMean(sumMean.Mean() / std::max(gmm.Modes(k)->Weight(), c_SafeMinWeight)); // sum_n(p(k|x_n)*x_n)/sum_n(p(k|x_n)) 
-        sumMean.Reset(); // Reset for the next use
+    ParallelFor(observations.size(), m_numThreads, [&](int idxThread, size_t begin, size_t end) {
+        ResetStatistics(m_tmpStatistics[idxThread], gmm);
+        AccumulateStatistics(observations, begin, end, m_tmpStatistics[idxThread]);
+    });
+
+    // Merge the per-thread statistics into thread 0, in a fixed order
+    MergeStatistics((int)gmm.Modes().size());
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::AccumulateStatistics(const std::vector<VecType>& observations, size_t begin, size_t end, AlignedVector<StatisticsType>& statistics)
+{
+    int numModes = (int)statistics.size();
+    if (m_storage == ResponsibilityStorage::PointMajor) {
+        // The responsibilities of each observation are contiguous, so a single sequential pass reads everything
+        for (size_t o = begin; o < end; ++o) {
+            double weight = m_weights != nullptr ? (*m_weights)[o] : 1.0;
+            const float* pointResponsibilities = &m_tmpPointResponsibilities[o * numModes];
+            for (int k = 0; k < numModes; ++k) {
+                if (pointResponsibilities[k] > 0)
+                    statistics[k].Push(observations[o], pointResponsibilities[k] * weight);
+            }
+        }
+        return;
+    }
+    if (m_storage == ResponsibilityStorage::TopK) {
+        int topK = std::min(m_topK, numModes);
+        for (size_t o = begin; o < end; ++o) {
+            double weight = m_weights != nullptr ? (*m_weights)[o] : 1.0;
+            for (size_t j = o * topK; j < (o + 1) * topK; ++j) {
+                if (m_tmpTopKResponsibilities[j] > 0)
+                    statistics[m_tmpTopKModes[j]].Push(observations[o], m_tmpTopKResponsibilities[j] * weight);
+            }
+        }
+        return;
+    }
+
+    // Sweep all modes over one block of observations at a time, so that the data is read from memory only once per M-step
+    for (size_t blockBegin = begin; blockBegin < end; blockBegin += c_EMBlockSize) {
+        size_t blockEnd = std::min(blockBegin + c_EMBlockSize, end);
+        for (int k = 0; k < numModes; ++k) {
+            StatisticsType& modeStatistics = statistics[k];
+            const std::vector<Scalar>& responsibilities = m_tmpResponsibilities[k];
+            for (size_t o = blockBegin; o < blockEnd; ++o) {
+                if (responsibilities[o] > 0)
+                    modeStatistics.Push(observations[o], m_weights != nullptr ? responsibilities[o] * (*m_weights)[o] : (double)responsibilities[o]);
+            }
+        }
     }
 }
 
 //----------------------------------------------------------------------------
-void AC::GMM::EM::UpdateCovariances(const std::vector<Vec3>& observations, GMM3D& gmm)
+template <int Dims, typename Scalar>
+void AC::GMM::EMT<Dims, Scalar>::UpdateModes(GMMType& gmm)
 {
-    _ASSERT(observations.size() == m_numTrainingPoints && m_numTrainingPoints >= gmm.Modes().size() && "Invalid number of observations.");
+    _ASSERT(m_tmpStatistics[0].size() == gmm.Modes().size() && "Statistics must be accumulated before the M-step.");
     int numModes = (int)gmm.Modes().size();
-    Vec3 centeredObservation;
-    Mat3 cov;
-    Mat3 centeredObservationOuterProd;
+    bool tied = gmm.covarianceType() == CovarianceType::Tied;
+    typename StatisticsType::MatD pooledCovariance;
     for (int k = 0; k < numModes; ++k) {
-        cov = Mat3::Zero();
-        for (int o = 0; o < m_numTrainingPoints; ++o) {
-            centeredObservation = observations[o] - gmm.Modes(k)->Mean();
-            centeredObservationOuterProd = centeredObservation * centeredObservation.transpose();
-            cov += m_tmpResponsibilities[k][o] * centeredObservationOuterProd;
-        }
-        // In UpdateWeights, we calculate sum_n( p(k|x_n) )/N, and we need sum_n( p(k|x_n) ) in the denominator below
-        cov /= m_numTrainingPoints * std::max(gmm.Modes(k)->Weight(), c_SafeMinWeight); // so we divide by sum_n(p(k|x_n))/N * N
+        const StatisticsType& statistics = m_tmpStatistics[0][k];
+        gmm.Modes(k)->setWeight(std::max(statistics.SumResponsibilities() / m_sumWeights, c_SafeMinWeight)); // sum_n(p(k|x_n))/N
+
+        // We need sum_n( p(k|x_n) ) in the denominator of the mean and covariance, so we divide by sum_n(p(k|x_n))/N * N
+        double normalization = m_sumWeights * gmm.Modes(k)->Weight();
+        typename StatisticsType::VecD mean = statistics.Mean(normalization); // sum_n(p(k|x_n)*x_n)/sum_n(p(k|x_n))
+        gmm.Modes(k)->setMean(mean.template cast<Scalar>());
+        if (!tied)
+            gmm.Modes(k)->setCovariance(statistics.Covariance(mean, normalization).template cast<Scalar>()); // sum_n(p(k|x_n)*(x_n-mu_k)(x_n-mu_k)^T)/sum_n(p(k|x_n))
+        else if (k == 0)
+            pooledCovariance = statistics.Covariance(mean, m_sumWeights);
+        else
+            pooledCovariance += statistics.Covariance(mean, m_sumWeights);
+    }
 
-        gmm.Modes(k)->setCovariance(cov);
+    // Tied modes share one covariance, the sum of the scatter matrices of all modes over N
+    if (tied && numModes > 0) {
+        typename GMMType::MatType covariance = pooledCovariance.template cast<Scalar>();
+        for (int k = 0; k < numModes; ++k)
+            gmm.Modes(k)->setCovariance(covariance);
     }
 }
 
 //----------------------------------------------------------------------------
-bool AC::GMM::EM::Process(const std::vector<Vec3>& observations, GMM3D& gmm)
+template <int Dims, typename Scalar>
+bool AC::GMM::EMT<Dims, Scalar>::Process(const std::vector<VecType>& observations, GMMType& gmm)
 {
+    return Process(observations, std::vector<double>(), gmm);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+bool AC::GMM::EMT<Dims, Scalar>::Process(const std::vector<VecType>& observations, const std::vector<double>& weights, GMMType& gmm)
+{
+    _ASSERT((weights.empty() || weights.size() == observations.size()) && "Invalid number of weights.");
+    m_weights = weights.empty() ? nullptr : &weights;
+    m_sumWeights = m_numTrainingPoints;
+    if (m_weights != nullptr) {
+        m_sumWeights = 0;
+        for (double weight : weights)
+            m_sumWeights += weight;
+    }
+
     _ASSERT(m_numTrainingPoints > 0 && m_numTrainingPoints > gmm.Modes().size() && "Invalid number of observations.");
+    AllocateResponsibilities(observations.size(), (int)gmm.Modes().size());
     int numIterations = 0;
     double OldLikelihood;
     double NewLikelihood = -std::numeric_limits<double>::max();
-    do {
-        // E-Step
-        UpdateResponsibilities(observations, gmm);
 
-        // M-Step
-        UpdateWeights(gmm);
-        UpdateMeans(observations, gmm);
-        UpdateCovariances(observations, gmm);
+    // Initial E-Step. Its log likelihood (that of the initial GMM) is not used in the stopping condition, so that EM always runs at
+    // least two M-steps, as when the likelihood was only evaluated after each M-step.
+    UpdateResponsibilities(observations, gmm);
+    do {
+        // M-Step (without stored responsibilities, the E-step already accumulated the statistics)
+        if (m_storage != ResponsibilityStorage::None)
+            AccumulateStatistics(observations, gmm);
+        UpdateModes(gmm);
 
-        // Update GMM likelihood (stopping condition)
+        // E-Step for the next iteration, which also updates the GMM likelihood (stopping condition)
         OldLikelihood = NewLikelihood;
-        NewLikelihood = gmm.LogLikelihood(observations);
+        NewLikelihood = UpdateResponsibilities(observations, gmm);
     } while (abs((NewLikelihood - OldLikelihood) / OldLikelihood) > m_tolerance && numIterations++ < m_maxIterations);
 
     // Return true if converged
+    m_weights = nullptr;
     return numIterations < m_maxIterations;
 }
+
+// Supported dimensions and scalar types (same as GMM)
+#define AC_EM_INSTANTIATE(Dims) \
+    template class AC::GMM::EMT<Dims, double>; \
+    template class AC::GMM::EMT<Dims, float>;
+AC_EM_INSTANTIATE(2) AC_EM_INSTANTIATE(3) AC_EM_INSTANTIATE(4) AC_EM_INSTANTIATE(5)
+AC_EM_INSTANTIATE(6) AC_EM_INSTANTIATE(7) AC_EM_INSTANTIATE(8) AC_EM_INSTANTIATE(Eigen::Dynamic)
+#undef AC_EM_INSTANTIATE
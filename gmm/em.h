@@ -36,19 +36,158 @@ namespace AC
 {
     namespace GMM
     {
+        const int c_EMBlockSize = 256; // Number of observations processed together when accumulating sufficient statistics (keeps the block in cache while sweeping all modes)
 
-        // Expectation-Maximization algorithm for GMM
-        class EM {
+        /// <summary> Sufficient statistics of one Gaussian mode for the M-step, i.e., sum_n(p(k|x_n)), sum_n(p(k|x_n)*x_n) and sum_n(p(k|x_n)*x_n*x_n^T).
+        ///           Observations are accumulated relative to a shift (typically the mode mean before the M-step), so that the covariance
+        ///           can be recovered without the catastrophic cancellation of E[xx^T] - E[x]E[x]^T. The statistics are always accumulated in
+        ///           double precision, whatever the scalar type of the observations. Diagonal and spherical Gaussians only need the diagonal
+        ///           of sum_n(p(k|x_n)*x_n*x_n^T), so only the squares of the observations are accumulated for them. </summary>
+        template <int Dims>
+        class GaussianStatistics {
+        public:
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            typedef Eigen::Matrix<double, Dims, 1> VecD;
+            typedef Eigen::Matrix<double, Dims, Dims> MatD;
+
+            GaussianStatistics() { Reset(VecD::Zero(Dims == Eigen::Dynamic ? 0 : Dims)); }
+
+            /// <summary> Resets the statistics to zero, and sets the shift subtracted from all observations (which also sets the dimensions)
+            ///           and the covariance type to accumulate statistics for. </summary>
+            void Reset(const VecD& shift, CovarianceType covarianceType = CovarianceType::Full)
+            {
+                m_shift = shift;
+                m_diagonalOnly = covarianceType == CovarianceType::Diagonal || covarianceType == CovarianceType::Spherical;
+                m_sumResponsibilities = 0;
+                m_sumObservations.setZero(shift.size());
+                m_sumOuterProducts.setZero(shift.size(), shift.size());
+            }
+
+            /// <summary> Accumulate one observation (of any scalar type) with responsibility p(k|x_n). </summary>
+            template <typename ObservationVec>
+            void Push(const ObservationVec& observation, double responsibility)
+            {
+                VecD centeredObservation = observation.template cast<double>() - m_shift;
+                m_sumResponsibilities += responsibility;
+                m_sumObservations += responsibility * centeredObservation;
+                if (m_diagonalOnly)
+                    m_sumOuterProducts.diagonal() += responsibility * centeredObservation.cwiseAbs2();
+                else
+                    m_sumOuterProducts.noalias() += (responsibility * centeredObservation) * centeredObservation.transpose();
+            }
+
+            /// <summary> Add the statistics in 'rhs' to these ones. Both must have been accumulated with the same shift. </summary>
+            void Merge(const GaussianStatistics& rhs)
+            {
+                _ASSERT(m_shift == rhs.m_shift && m_diagonalOnly == rhs.m_diagonalOnly && "Statistics must share the same shift and type to be merged");
+                m_sumResponsibilities += rhs.m_sumResponsibilities;
+                m_sumObservations += rhs.m_sumObservations;
+                m_sumOuterProducts += rhs.m_sumOuterProducts;
+            }
+
+            /// <summary> Change the shift of the statistics, as if they had been accumulated around 'shift' in the first place. </summary>
+            void Recenter(const VecD& shift)
+            {
+                // (x_n - shift') = (x_n - shift) - offset, with offset = shift' - shift
+                VecD offset = shift - m_shift;
+                if (m_diagonalOnly)
+                    m_sumOuterProducts.diagonal() += -2 * m_sumObservations.cwiseProduct(offset) + m_sumResponsibilities * offset.cwiseAbs2();
+                else
+                    m_sumOuterProducts += -m_sumObservations * offset.transpose() - offset * m_sumObservations.transpose() + m_sumResponsibilities * offset * offset.transpose();
+                m_sumObservations -= m_sumResponsibilities * offset;
+                m_shift = shift;
+            }
+
+            /// <summary> Multiply all statistics by 'factor', i.e., reweight every accumulated observation (e.g., to forget old observations). </summary>
+            void Scale(double factor)
+            {
+                m_sumResponsibilities *= factor;
+                m_sumObservations *= factor;
+                m_sumOuterProducts *= factor;
+            }
+
+            /// <summary> Set the statistics of sumResponsibilities observations with mean Shift() and the given covariance (e.g., to continue
+            ///           accumulating on top of a trained Gaussian). </summary>
+            void SetMoments(double sumResponsibilities, const MatD& covariance)
+            {
+                m_sumResponsibilities = sumResponsibilities;
+                m_sumObservations.setZero();
+                if (m_diagonalOnly) {
+                    m_sumOuterProducts.setZero();
+                    m_sumOuterProducts.diagonal() = sumResponsibilities * covariance.diagonal();
+                }
+                else {
+                    m_sumOuterProducts = sumResponsibilities * covariance;
+                }
+            }
+
+            /// <summary> Compute the weighted mean sum_n(p(k|x_n)*x_n) / normalization. </summary>
+            VecD Mean(double normalization) const
+            {
+                return (m_sumObservations + m_sumResponsibilities * m_shift) / normalization;
+            }
+
+            /// <summary> Compute the weighted covariance sum_n(p(k|x_n)*(x_n - mean)(x_n - mean)^T) / normalization around the given mean
+            ///           (only its diagonal, for diagonal and spherical statistics). </summary>
+            MatD Covariance(const VecD& mean, double normalization) const
+            {
+                // x_n - mean = (x_n - shift) - (mean - shift), so we only need to correct the centered sums by the (small) offset of the new mean
+                VecD offset = mean - m_shift;
+                if (m_diagonalOnly) {
+                    VecD variances = m_sumOuterProducts.diagonal() - 2 * m_sumObservations.cwiseProduct(offset) + m_sumResponsibilities * offset.cwiseAbs2();
+                    return MatD(variances.asDiagonal()) / normalization;
+                }
+                MatD cov = m_sumOuterProducts - m_sumObservations * offset.transpose() - offset * m_sumObservations.transpose() + m_sumResponsibilities * offset * offset.transpose();
+                return cov / normalization;
+            }
+
+            double SumResponsibilities() const { return m_sumResponsibilities; }
+            const VecD& Shift() const { return m_shift; }
+
+        private:
+            VecD m_shift;               // Value subtracted from every observation before accumulating
+            double m_sumResponsibilities; // sum_n(p(k|x_n))
+            VecD m_sumObservations;     // sum_n(p(k|x_n) * (x_n - shift))
+            MatD m_sumOuterProducts;    // sum_n(p(k|x_n) * (x_n - shift)(x_n - shift)^T) (only its diagonal if m_diagonalOnly)
+            bool m_diagonalOnly;        // Accumulate only the diagonal of the outer products (diagonal and spherical covariances)
+        };
+
+        // Expectation-Maximization algorithm for GMM. Observations and responsibilities are stored with the scalar type of the GMM (float halves
+        // their memory footprint), while the log likelihood and the sufficient statistics are accumulated in double. The dimensions of the
+        // observations are those of the GMM (Dims, or any number of dimensions for Eigen::Dynamic). EM is the 3D, double precision version.
+        template <int Dims, typename Scalar = double>
+        class EMT {
 
         public:
-            EM(int numObservations, int numModes, double tolerance = c_EMDefaultTolerance, int maxIterations = c_EMDefaultMaxIterations);
+            typedef GMM<Dims, Scalar> GMMType;
+            typedef typename GMMType::VecType VecType;
+            typedef GaussianStatistics<Dims> StatisticsType;
+
+            /// <summary> Constructor. </summary>
+            /// <param name="numObservations"> Number of observations used in training. </param>
+            /// <param name="numModes"> Number of modes (Gaussians) in the GMM. </param>
+            /// <param name="tolerance"> [optional] Stopping condition in EM (see setTolerance). </param>
+            /// <param name="maxIterations"> [optional] Max number of iterations of EM. </param>
+            /// <param name="numThreads"> [optional] Number of threads. The observations are split in numThreads contiguous shards, and the per-thread
+            ///                           results are merged in a fixed order, so the output is identical for a given number of threads. 0 = all hardware threads.
+            ///                           The threads are started and joined in every E-step and M-step (see ParallelFor). </param>
+            EMT(int numObservations, int numModes, double tolerance = c_EMDefaultTolerance, int maxIterations = c_EMDefaultMaxIterations, int numThreads = 1);
 
             /// <summary> Train gaussian mixture model with the EM algorithm. Given a set of observations and an *Initialized* GMM, this function optimizes the location
             ///           of the gaussians via iterative expectations and maximizations. </summary>
             /// <param name="observations"> The set of observations. </param>
             /// <param name="gmm">          [in,out] The computed GMM. This GMM should be already initialized by some other method (e.g., k-means), or at random. </param>
             /// <returns> true if EM converged before reaching the max number of iterations </returns>
-            bool Process(const std::vector<Vec3>& observations, GMM3D& gmm);
+            bool Process(const std::vector<VecType>& observations, GMMType& gmm);
+
+            /// <summary> Same as above, with a (positive) weight per observation, e.g., the number of times each distinct value appears in the data
+            ///           set (see CountUniqueObservations). Each observation counts as 'weight' repeated observations in the log likelihood and in the
+            ///           M-step, so EM over the distinct values gives the same GMM as EM over all of them, at a fraction of the cost. </summary>
+            /// <param name="observations"> The set of observations (numObservations, as given in the constructor). </param>
+            /// <param name="weights"> The weight of each observation (or an empty vector for unit weights). </param>
+            /// <param name="gmm">          [in,out] The computed GMM, already initialized. </param>
+            /// <returns> true if EM converged before reaching the max number of iterations </returns>
+            bool Process(const std::vector<VecType>& observations, const std::vector<double>& weights, GMMType& gmm);
 
             /// <summary> Sets maximum number of iterations of EM. </summary>
             /// <param name="maxIters"> The maximum number of iterations. </param>
@@ -59,32 +198,83 @@ namespace AC
             /// <param name="tolerance"> The tolerance. </param>
             void setTolerance(double tolerance) { m_tolerance = tolerance; }
 
+            /// <summary> Sets the number of threads used in the E-step and M-step (0 = all hardware threads). </summary>
+            /// <param name="numThreads"> The number of threads. </param>
+            void setNumThreads(int numThreads);
+
+            /// <summary> Sets how the responsibilities are stored between the E-step and the M-step (see ResponsibilityStorage). Memory is only
+            ///           allocated in Process(), for the selected storage. </summary>
+            void setResponsibilityStorage(ResponsibilityStorage storage) { m_storage = storage; }
+            ResponsibilityStorage responsibilityStorage() const { return m_storage; }
+
+            /// <summary> Sets the number of responsibilities kept per observation with ResponsibilityStorage::TopK. </summary>
+            void setTopK(int topK) { _ASSERT(topK > 0 && L"Invalid number of responsibilities"); m_topK = topK; }
+
         private:
-            /// <summary> Updates the gaussian responsibilities, so that: responsibilities[k][n] = log p_kn = log(p(x_n|k)) + log(P(k)) - log(p(x_n)).
-            ///           (the responsibilities vector is stored internally). This corresponds to the E-step in EM. </summary>
+            /// <summary> Updates the gaussian responsibilities, so that: responsibilities[k][n] = p_kn = exp(log(p(x_n|k)) + log(P(k)) - log(p(x_n))).
+            ///           (the responsibilities vector is stored internally). This corresponds to the E-step in EM. 
+            ///           Each Gaussian is evaluated once per observation, and the same log-sum-exp that normalizes the responsibilities
+            ///           gives us log(p(x_n)), so the log likelihood of the data set comes for free. </summary>
             /// <param name="observations"> The input set of observations. </param>
             /// <param name="gmm">          The current GMM. </param>
-            void UpdateResponsibilities(const std::vector<Vec3>& observations, GMM3D& gmm);
+            /// <returns> The log likelihood of the current GMM for the whole set of observations, i.e., sum_n log(p(x_n)). </returns>
+            double UpdateResponsibilities(const std::vector<VecType>& observations, GMMType& gmm);
 
-            /// <summary> Updates the GMM weights P(k) according to the (internally stored) responsibilities vector. This corresponds to the 1st part of the M-Step. </summary>
-            /// <param name="gmm"> [out] The gmm with updated weights. </param>
-            void UpdateWeights(GMM3D& gmm);
+            /// <summary> E-step on the shard of observations [begin, end). With ResponsibilityStorage::None, the responsibilities are pushed into
+            ///           the statistics of the calling thread instead (already reset). </summary>
+            /// <param name="logProbabilities"> [in,out] k-Vector of scratch memory owned by the calling thread. </param>
+            /// <param name="statistics"> [in,out] k-Vector of statistics owned by the calling thread (only used with ResponsibilityStorage::None). </param>
+            /// <returns> The log likelihood of the observations in [begin, end). </returns>
+            double UpdateResponsibilities(const std::vector<VecType>& observations, GMMType& gmm, size_t begin, size_t end, std::vector<double>& logProbabilities,
+                AlignedVector<StatisticsType>& statistics);
 
-            /// <summary> Updates the GMM means according to the observations and responsibilities. This corresponds to the 2nd part of the M-step. </summary>
-            /// <param name="observations"> The input set of observations. </param>
-            /// <param name="gmm"> [out] The gmm with updated means. </param>
-            void UpdateMeans(const std::vector<Vec3>& observations, GMM3D& gmm);
+            /// <summary> Store the responsibilities of observation o (given in 'responsibilities') with the selected storage. </summary>
+            void StoreResponsibilities(size_t o, const std::vector<double>& responsibilities);
+
+            /// <summary> Allocates the storage of the responsibilities for the given number of observations and modes. </summary>
+            void AllocateResponsibilities(size_t numObservations, int numModes);
+
+            /// <summary> Reset the per-thread statistics of each mode, centered on the current means (see GaussianStatistics::Reset). </summary>
+            void ResetStatistics(AlignedVector<StatisticsType>& statistics, const GMMType& gmm);
 
-            /// <summary> Updates the GMM covariance matrices according to the observations, responsibilities and means. This corresponds to the 3rd part of the M-step. </summary>
+            /// <summary> Merge the per-thread statistics into thread 0, in a fixed order. </summary>
+            void MergeStatistics(int numModes);
+
+            /// <summary> Accumulates the sufficient statistics of every mode (see GaussianStatistics) from the observations and the (internally stored)
+            ///           responsibilities. All modes are accumulated in a single pass over the observations, in blocks of c_EMBlockSize. </summary>
             /// <param name="observations"> The input set of observations. </param>
-            /// <param name="gmm"> [out] The gmm with updated covariance matrices. </param>
-            void UpdateCovariances(const std::vector<Vec3>& observations, GMM3D& gmm);
+            /// <param name="gmm"> The current GMM (its means are used as the shift of the statistics). </param>
+            void AccumulateStatistics(const std::vector<VecType>& observations, const GMMType& gmm);
+
+            /// <summary> Accumulates the sufficient statistics of every mode over the shard of observations [begin, end). </summary>
+            /// <param name="statistics"> [in,out] k-Vector of statistics owned by the calling thread (already reset). </param>
+            void AccumulateStatistics(const std::vector<VecType>& observations, size_t begin, size_t end, AlignedVector<StatisticsType>& statistics);
+
+            /// <summary> Updates the GMM weights, means and covariance matrices from the accumulated sufficient statistics. This corresponds to the M-step.
+            ///           Tied GMMs get the covariance pooled over all modes, i.e., sum_k(sum_n(p(k|x_n)*(x_n-mu_k)(x_n-mu_k)^T)) / N. </summary>
+            /// <param name="gmm"> [out] The gmm with updated weights, means and covariances. </param>
+            void UpdateModes(GMMType& gmm);
 
-            std::vector<std::vector<double>> m_tmpResponsibilities;
+            std::vector<std::vector<Scalar>> m_tmpResponsibilities; // k-Vector of N-vectors with the responsibilities p(k|x_n) (ResponsibilityStorage::ModeMajor)
+            std::vector<float> m_tmpPointResponsibilities; // N x k matrix with the responsibilities p(k|x_n) (ResponsibilityStorage::PointMajor)
+            std::vector<uint16_t> m_tmpTopKModes; // N x topK matrix with the modes of the largest responsibilities (ResponsibilityStorage::TopK)
+            std::vector<float> m_tmpTopKResponsibilities; // N x topK matrix with the largest responsibilities (ResponsibilityStorage::TopK)
+            ResponsibilityStorage m_storage; // How the responsibilities are stored between the E-step and the M-step
+            int m_topK;              // Number of responsibilities per observation with ResponsibilityStorage::TopK
+            std::vector<std::vector<double>> m_tmpLogProbabilities; // Per-thread k-Vector (temporary) to store log(p(x_n|k)) + log(P(k)) for one observation
+            std::vector<AlignedVector<StatisticsType>> m_tmpStatistics; // Per-thread k-Vector with the sufficient statistics of each mode (merged into thread 0)
+            std::vector<double> m_tmpLogLikelihoods; // Per-thread log likelihood of its shard of observations
             int m_numTrainingPoints; // Number of observations used in training
+            const std::vector<double>* m_weights; // Weight of each observation during Process (nullptr for unit weights)
+            double m_sumWeights;     // Sum of the weights of the observations (m_numTrainingPoints for unit weights)
             double m_tolerance;      // Stopping condition in EM. If ratio of new vs old log likelihoods is lower than tolerance, finish process. 
             int m_maxIterations;     // Max number of iterations of EM. If we do not get under the tolerance in MaxIterations, we give up.
+            int m_numThreads;        // Number of threads (shards of observations) used in the E-step and M-step
+            int m_numModes;          // Number of modes the temporary vectors are allocated for
         };
+        typedef EMT<3, double> EM; // The original (3D) EM class
+        typedef EMT<3, double> EM3D;
+        typedef EMT<3, float> EM3Df;
     }
 }
 
@@ -0,0 +1,129 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __FIXED_GMM_H__
+#define __FIXED_GMM_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include "math_utils.h"
+#include "gmm.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        /// <summary> Value-type GMM with at most MaxModes modes, stored inline (no heap allocations at all), to keep one model per object or
+        ///           pixel in a plain array. Each mode is a flat record with the mean, the inverse Cholesky factor (or the inverse variances, for
+        ///           the diagonal covariance types) and the precomputed log norm factor and log weight, so a FixedGMM is trivially copyable:
+        ///           copies and moves are a memcpy, and it can be relocated or written to disk as raw bytes. It is built from a trained GMM
+        ///           (see FromGMM and ToGMM) and evaluates exactly like it (same log-sum-exp, same results for the same modes).
+        ///           Only fixed Dims are supported. See gmm_bank.h to save FixedGMMs and to score them from a memory-mapped file. </summary>
+        template <int MaxModes, int Dims = 3, typename Scalar = double>
+        class FixedGMM {
+        public:
+            typedef GMM<Dims, Scalar> GMMType;
+            typedef Eigen::Matrix<Scalar, Dims, 1> VecType;
+            typedef Eigen::Matrix<Scalar, Dims, Dims> MatType;
+
+            /// <summary> One mode of the mixture, as a plain record. Matrices are column-major, as in Eigen. </summary>
+            struct Mode {
+                Scalar mean[Dims];
+                Scalar invCholeskyFactor[Dims * Dims]; // inv(L), with Cov = L * L^T (Full and Tied covariances)
+                Scalar invVariances[Dims];             // Diagonal of inv(Cov) (Diagonal and Spherical covariances)
+                double weight;
+                double logWeight;
+                double logNormFactor;
+            };
+
+            /// <summary> Constructor of an empty mixture. </summary>
+            FixedGMM();
+
+            /// <summary> Copy the modes of a GMM, replacing the current ones. </summary>
+            /// <returns> false (and the mixture is left unchanged) if the GMM has more than MaxModes modes. </returns>
+            bool FromGMM(const GMMType& gmm);
+
+            /// <summary> Build a regular GMM with the same modes. The covariances are recovered from their inverses, so they may differ from
+            ///           the ones of the original GMM by rounding errors. </summary>
+            GMMType ToGMM() const;
+
+            /// <summary> Evaluates the log of the (unweighted) Gaussian pdf of mode k at the given observation (see GaussianDistribution::EvaluateLog). </summary>
+            double EvaluateLog(int k, const VecType& observation) const;
+
+            /// <summary> Compute the log likelihood of the mixture model for an observation (see GMM::LogLikelihood). </summary>
+            double LogLikelihood(const VecType& observation) const;
+
+            /// <summary> Compute the likelihood of the mixture model for an observation, including the global weight (see GMM::Likelihood). </summary>
+            double Likelihood(const VecType& observation) const;
+
+            /// <summary> Compute the log likelihood of each observation in a batch (single-threaded, no temporary storage). </summary>
+            void LogLikelihoods(const VecType* observations, size_t numObservations, double* logLikelihoods) const;
+
+            /// <summary> Find the mode with the highest (unweighted) log probability for an observation (see GMM::ClosestMode). </summary>
+            /// <param name="mode"> [out] Index of the closest mode, or INVALID_MODE if the mixture is empty. </param>
+            /// <returns> The log probability of the observation in the closest mode. </returns>
+            double ClosestMode(const VecType& observation, int& mode) const;
+
+            /// <summary> Remove modes with weight less than some (small) tolerance, keeping the order of the rest (see GMM::RemoveBadModes). </summary>
+            /// <returns> The number of remaining modes. </returns>
+            int RemoveBadModes(double tolerance);
+
+            /// <summary> Sort the modes by decreasing weight. </summary>
+            void SortModes();
+
+            int NumModes() const { return m_numModes; }
+            static int Capacity() { return MaxModes; }
+            const Mode& Modes(int k) const { _ASSERT(k < m_numModes && k >= 0 && L"Invalid index"); return m_modes[k]; }
+            VecType Mean(int k) const { return Eigen::Map<const VecType>(Modes(k).mean); }
+            double Weight(int k) const { return Modes(k).weight; }
+
+            double GlobalWeight() const { return m_globalWeight; }
+            void SetGlobalWeight(double w) { m_globalWeight = w; }
+
+            CovarianceType covarianceType() const { return m_covarianceType; }
+
+        private:
+            Mode m_modes[MaxModes];
+            int m_numModes;
+            CovarianceType m_covarianceType;
+            double m_globalWeight;
+        };
+
+        template <int MaxModes>
+        using FixedGMM3D = FixedGMM<MaxModes, 3, double>;
+        template <int MaxModes>
+        using FixedGMM3Df = FixedGMM<MaxModes, 3, float>;
+    }
+}
+
+#include "fixed_gmm.inl"
+
+#endif
@@ -0,0 +1,203 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::FixedGMM()
+    : m_numModes(0)
+    , m_covarianceType(CovarianceType::Full)
+    , m_globalWeight(1.0)
+{
+    static_assert(MaxModes > 0, "FixedGMM needs room for at least one mode");
+    static_assert(Dims != Eigen::Dynamic, "FixedGMM only supports fixed dimensions");
+    static_assert(std::is_trivially_copyable<FixedGMM<MaxModes, Dims, Scalar>>::value, "FixedGMM must be trivially copyable");
+
+    // Clear the unused modes (and the padding), so that the bytes of a FixedGMM only depend on its modes (see SaveGMMBank)
+    memset(m_modes, 0, sizeof(m_modes));
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+bool AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::FromGMM(const GMMType& gmm)
+{
+    if (gmm.Modes().size() > (size_t)MaxModes)
+        return false;
+
+    memset(m_modes, 0, sizeof(m_modes));
+    m_covarianceType = gmm.covarianceType();
+    m_globalWeight = gmm.GlobalWeight();
+    m_numModes = (int)gmm.Modes().size();
+    for (int k = 0; k < m_numModes; ++k) {
+        const auto& src = *gmm.Modes(k);
+        Mode& dst = m_modes[k];
+        Eigen::Map<VecType>(dst.mean) = src.Mean();
+        Eigen::Map<MatType>(dst.invCholeskyFactor) = src.InvCholeskyFactor();
+        Eigen::Map<VecType>(dst.invVariances) = src.InvCovariance().diagonal();
+        dst.weight = src.Weight();
+        dst.logWeight = src.LogWeight();
+        dst.logNormFactor = src.LogNormFactor();
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+typename AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::GMMType AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::ToGMM() const
+{
+    typedef Eigen::Matrix<double, Dims, Dims> MatD;
+    GMMType gmm(m_numModes);
+    gmm.setCovarianceType(m_covarianceType);
+    gmm.SetGlobalWeight(m_globalWeight);
+    for (int k = 0; k < m_numModes; ++k) {
+        const Mode& src = m_modes[k];
+        MatD cov = MatD::Zero();
+        if (m_covarianceType == CovarianceType::Diagonal || m_covarianceType == CovarianceType::Spherical) {
+            for (int i = 0; i < Dims; ++i)
+                cov(i, i) = 1.0 / (double)src.invVariances[i];
+        }
+        else {
+            // Cov = L * L^T, and L is the inverse of the (lower triangular) inverse Cholesky factor
+            MatD choleskyFactor = Eigen::Map<const MatType>(src.invCholeskyFactor).template cast<double>()
+                .template triangularView<Eigen::Lower>().solve(MatD::Identity());
+            cov = choleskyFactor * choleskyFactor.transpose();
+        }
+        auto& dst = *gmm.Modes(k);
+        dst.setMean(Eigen::Map<const VecType>(src.mean));
+        dst.setCovariance(cov.template cast<Scalar>());
+        dst.setWeight(src.weight);
+    }
+    return gmm;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+double AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::EvaluateLog(int k, const VecType& observation) const
+{
+    const Mode& mode = m_modes[k];
+    VecType centeredObservation = observation - Eigen::Map<const VecType>(mode.mean);
+    double exponentialTerm;
+    switch (m_covarianceType) {
+    case CovarianceType::Diagonal:
+        exponentialTerm = centeredObservation.cwiseAbs2().dot(Eigen::Map<const VecType>(mode.invVariances));
+        break;
+    case CovarianceType::Spherical:
+        exponentialTerm = centeredObservation.squaredNorm() * mode.invVariances[0];
+        break;
+    default:
+        exponentialTerm = (Eigen::Map<const MatType>(mode.invCholeskyFactor) * centeredObservation).squaredNorm();
+        break;
+    }
+    return mode.logNormFactor - 0.5 * exponentialTerm;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+double AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::LogLikelihood(const VecType& observation) const
+{
+    if (m_numModes == 0)
+        return 0;
+
+    // Single-pass LogSumExp, as in GMM::LogLikelihood
+    double maxLogValue = -std::numeric_limits<double>::max();
+    double expsum = 0;
+    for (int k = 0; k < m_numModes; ++k) {
+        double logValue = EvaluateLog(k, observation) + m_modes[k].logWeight;
+        if (logValue <= maxLogValue) {
+            if (logValue - maxLogValue >= c_LogSumExpFlushThreshold)
+                expsum += exp(logValue - maxLogValue);
+        }
+        else {
+            expsum = maxLogValue - logValue >= c_LogSumExpFlushThreshold ? expsum * exp(maxLogValue - logValue) + 1 : 1;
+            maxLogValue = logValue;
+        }
+    }
+    return maxLogValue + log(expsum);
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+double AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::Likelihood(const VecType& observation) const
+{
+    double likelihood = exp(LogLikelihood(observation)) * GlobalWeight();
+    return IsFinite(likelihood) ? likelihood : 0;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+void AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::LogLikelihoods(const VecType* observations, size_t numObservations, double* logLikelihoods) const
+{
+    for (size_t n = 0; n < numObservations; ++n)
+        logLikelihoods[n] = LogLikelihood(observations[n]);
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+double AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::ClosestMode(const VecType& observation, int& mode) const
+{
+    double bestLogProbability = -std::numeric_limits<double>::max();
+    mode = INVALID_MODE;
+    for (int k = 0; k < m_numModes; ++k) {
+        double prob = EvaluateLog(k, observation);
+        if (prob > bestLogProbability) {
+            mode = k;
+            bestLogProbability = prob;
+        }
+    }
+    return bestLogProbability;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+int AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::RemoveBadModes(double tolerance)
+{
+    // Modes are moved as raw bytes and the freed slots are cleared, so that the bytes of a FixedGMM still only depend on its modes
+    int numGoodModes = 0;
+    for (int k = 0; k < m_numModes; ++k) {
+        if (m_modes[k].weight > tolerance) {
+            if (k != numGoodModes)
+                memcpy(&m_modes[numGoodModes], &m_modes[k], sizeof(Mode));
+            ++numGoodModes;
+        }
+    }
+    memset(m_modes + numGoodModes, 0, (m_numModes - numGoodModes) * sizeof(Mode));
+    m_numModes = numGoodModes;
+    return m_numModes;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+void AC::GMM::FixedGMM<MaxModes, Dims, Scalar>::SortModes()
+{
+    // Sort the indices and move the modes as raw bytes, since copies of a Mode do not have to preserve its (zero) padding
+    int order[MaxModes];
+    std::iota(order, order + m_numModes, 0);
+    std::sort(order, order + m_numModes, [this](int k1, int k2) { return m_modes[k1].weight > m_modes[k2].weight; });
+    Mode sortedModes[MaxModes];
+    for (int k = 0; k < m_numModes; ++k)
+        memcpy(&sortedModes[k], &m_modes[order[k]], sizeof(Mode));
+    memcpy(m_modes, sortedModes, m_numModes * sizeof(Mode));
+}
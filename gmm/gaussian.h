@@ -28,22 +28,56 @@ SOFTWARE.
 #ifndef __GAUSSIAN_H__
 #define __GAUSSIAN_H__
 
+#include <memory>
 #include "math_utils.h"
 
 namespace AC
 {
-    static const double c_SafeDeterminantWithoutUnderflow = 1e-50; // minimum determinant without underflow in Gaussian evaluation
+    static const double c_SafeDeterminantWithoutUnderflow = 1e-50; // minimum determinant without underflow in Gaussian evaluation (of a 3D Gaussian, i.e., c_SafeVarianceWithoutUnderflow^3)
+    static const double c_SafeVarianceWithoutUnderflow = 2.1544346900318883e-17; // minimum geometric mean of the variances, det(Cov)^(1/D), so that the limit does not depend on the number of dimensions
     static const double c_SafeMatrixRCOND = 1e-10; // Minimum value for us to consider that a covariance matrix is badly conditioned
     static const double c_SafeCovarianceFactor = 1e-10; // Factor added to the diagonal elements of an ill-conditioned covariance matrix to make it well-conditioned.
 
+    /// <summary> Structure of the covariance matrix of a Gaussian. Diagonal and spherical Gaussians are evaluated in O(Dims) instead of O(Dims^2). </summary>
+    enum class CovarianceType {
+        Full,      // Any symmetric positive definite matrix (default)
+        Diagonal,  // Independent dimensions, i.e., diag(sigma_1^2, ..., sigma_D^2)
+        Spherical, // Same variance in all dimensions, i.e., sigma^2 * I
+        Tied       // Full matrix shared by all modes of a GMM. A single Gaussian behaves as Full, the sharing is done by EM (see GMM::setCovarianceType)
+    };
+
+    /// <summary> Underflow protection constants for the scalar type in which a Gaussian is stored (see above for their meaning). Determinants and
+    ///           inverses are always computed in double, but in single precision the stored inverse covariance must be better conditioned,
+    ///           the diagonal correction must be noticeable next to float epsilon, and the quadratic form must not overflow. </summary>
+    template <typename Scalar>
+    struct GaussianLimits
+    {
+        static double SafeVarianceWithoutUnderflow() { return c_SafeVarianceWithoutUnderflow; }
+        static double SafeMatrixRCOND() { return c_SafeMatrixRCOND; }
+        static double SafeCovarianceFactor() { return c_SafeCovarianceFactor; }
+    };
+
+    template <>
+    struct GaussianLimits<float>
+    {
+        static double SafeVarianceWithoutUnderflow() { return 1e-10; } // det(Cov) >= 1e-30 in 3D
+        static double SafeMatrixRCOND() { return 1e-5; }
+        static double SafeCovarianceFactor() { return 1e-5; }
+    };
+
     template <typename Vec, typename Mat, int Dims>
     class GaussianDistribution
     {
     public:
         typedef std::shared_ptr<GaussianDistribution<Vec, Mat, Dims>> SP;
+        typedef typename Vec::Scalar Scalar; // Scalar type of the mean and covariance (likelihoods are always computed and returned in double)
+        typedef GaussianLimits<Scalar> Limits;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW // Fixed-size vectorizable members (e.g., Dims = 2 or 4)
 
         /// <summary> Default constructor (initializes with mean 0 and unit spherical covariance). </summary>
-        GaussianDistribution();
+        /// <param name="dimensions"> [optional] Number of dimensions. Only needed if Dims is Eigen::Dynamic. </param>
+        explicit GaussianDistribution(int dimensions = Dims);
 
         /// <summary> Constructor. </summary>
         /// <param name="mean">     The mean. </param>
@@ -62,12 +96,12 @@ namespace AC
         /// <summary> Evaluates Gaussian distribution at the given observation point. </summary>
         /// <param name="observation"> The observation. </param>
         /// <returns> The value of the gaussian pdf(observation).  </returns>
-        double Evaluate(const Vec& observation);
+        double Evaluate(const Vec& observation) const;
 
         /// <summary> Evaluates log Gaussian distribution at the given observation point. </summary>
         /// <param name="observation"> The observation. </param>
         /// <returns> The value of log (gaussian pdf(observation)). </returns>
-        double EvaluateLog(const Vec& observation);
+        double EvaluateLog(const Vec& observation) const;
 
         /// <summary> Reinitialize Gaussian distribution with some mean and variance (spherical covariance matrix)  </summary>
         /// <param name="mean">     The mean. </param>
@@ -81,12 +115,28 @@ namespace AC
 
         const Mat& Covariance() const { return m_covariance; }
         const Mat& InvCovariance() const { return m_invCovariance; }
+
+        /// <summary> Inverse of the lower triangular Cholesky factor L of the covariance matrix (Cov = L * L^T), i.e., the whitening transform
+        ///           such that (x - mu)^T * inv(Cov) * (x - mu) = ||inv(L) * (x - mu)||^2. It is lower triangular as well. </summary>
+        const Mat& InvCholeskyFactor() const { return m_invCholeskyFactor; }
+
+        /// <summary> Sets the covariance matrix, and computes its Cholesky factor, inverse and normalization factor. With underflow protection,
+        ///           a matrix that cannot be factored (not positive definite), or with a tiny determinant, is reset to a small diagonal one, and
+        ///           an ill-conditioned one gets a small value added to its diagonal. Diagonal and spherical Gaussians keep only the diagonal of
+        ///           'cov' (spherical ones, its average), and their underflow protection clamps each variance to a minimum value instead. </summary>
         void setCovariance(const Mat& cov);
 
+        /// <summary> Sets the structure of the covariance matrix, and projects the current covariance matrix onto it (see setCovariance). </summary>
+        void setCovarianceType(CovarianceType type) { m_covarianceType = type; setCovariance(m_covariance); }
+        CovarianceType covarianceType() const { return m_covarianceType; }
+
         const Vec& Mean() const { return m_mean; }
         Vec& Mean() { return m_mean; }
         void setMean(const Vec& mean) { m_mean = mean; }
 
+        /// <summary> Normalization factor in log scale, i.e., -log((2*PI)^(Dims/2)) - log(det(Cov)^(1/2)). </summary>
+        double LogNormFactor() const { return m_logNormFactor; }
+
         double Weight() const { return m_weight; }
         double LogWeight() const { return m_logWeight; }
         void setWeight(double w) { m_weight = w; m_logWeight = log(w); }
@@ -97,21 +147,21 @@ namespace AC
         void DisableUnderflowProtection() { m_underflowProtection = false; }
         bool UnderflowProtection() const { return m_underflowProtection; }
 
-        const int Dimensions() const { return Dims; }
+        int Dimensions() const { return (int)m_mean.size(); }
 
     private:
         Mat m_covariance; // Covariance matrix
         Mat m_invCovariance; // Inverse Covariance matrix
+        Mat m_invCholeskyFactor; // Inverse of the lower triangular Cholesky factor of the covariance matrix
         Vec m_mean; // Mean of the distribution
         double m_logNormFactor; // Normalization factor in log scale. That is: -log (1/(2*PI)^(M/2)) - log (det(Cov)^(1/2))
         double m_weight; // Weight of distribution
         double m_logWeight; // log(Weight) of distribution
         bool m_underflowProtection; // Use underflow protection in covariance matrix.
-                                    /* Temporaries */
-        Vec m_tmpCenteredObservation; // Temporary vector to avoid lots of constructor calls
-        Vec m_tmpProdOutput; // Temporary vector to avoid lots of constructor calls
+        CovarianceType m_covarianceType; // Structure of the covariance matrix
     };
     typedef GaussianDistribution<Vec3, Mat3, 3> GaussianDistribution3D;
+    typedef GaussianDistribution<Vec3f, Mat3f, 3> GaussianDistribution3Df;
 
 #include "gaussian.inl"
 }
@@ -30,14 +30,15 @@ SOFTWARE.
 
 //----------------------------------------------------------------------------
 template <typename Vec, typename Mat, int Dims>
-AC::GaussianDistribution<Vec, Mat, Dims>::GaussianDistribution() : m_underflowProtection(true)
+AC::GaussianDistribution<Vec, Mat, Dims>::GaussianDistribution(int dimensions) : m_underflowProtection(true), m_covarianceType(CovarianceType::Full)
 {
-    Reinitialize(Vec::Zero() /* zero mean */, 1.0 /* Unit variance */, 1.0 /* Unit weight */);
+    _ASSERT(dimensions > 0 && (Dims == Eigen::Dynamic || dimensions == Dims) && "Invalid number of dimensions");
+    Reinitialize(Vec::Zero(dimensions) /* zero mean */, 1.0 /* Unit variance */, 1.0 /* Unit weight */);
 }
 
 //----------------------------------------------------------------------------
 template <typename Vec, typename Mat, int Dims>
-AC::GaussianDistribution<Vec, Mat, Dims>::GaussianDistribution(const Vec& mean, double variance, double weight) : m_underflowProtection(true)
+AC::GaussianDistribution<Vec, Mat, Dims>::GaussianDistribution(const Vec& mean, double variance, double weight) : m_underflowProtection(true), m_covarianceType(CovarianceType::Full)
 {
     Reinitialize(mean, variance, weight);
 }
@@ -45,13 +46,15 @@ AC::GaussianDistribution<Vec, Mat, Dims>::GaussianDistribution(const Vec& mean,
 //----------------------------------------------------------------------------
 template <typename Vec, typename Mat, int Dims>
 AC::GaussianDistribution<Vec, Mat, Dims>::GaussianDistribution(const GaussianDistribution<Vec, Mat, Dims>& rhs) :
-    m_weight(rhs.m_weight),
-    m_logWeight(rhs.m_logWeight),
-    m_logNormFactor(rhs.m_logNormFactor),
-    m_mean(rhs.m_mean),
     m_covariance(rhs.m_covariance),
     m_invCovariance(rhs.m_invCovariance),
-    m_underflowProtection(rhs.m_underflowProtection)
+    m_invCholeskyFactor(rhs.m_invCholeskyFactor),
+    m_mean(rhs.m_mean),
+    m_logNormFactor(rhs.m_logNormFactor),
+    m_weight(rhs.m_weight),
+    m_logWeight(rhs.m_logWeight),
+    m_underflowProtection(rhs.m_underflowProtection),
+    m_covarianceType(rhs.m_covarianceType)
 {
 }
 
@@ -66,7 +69,9 @@ void AC::GaussianDistribution<Vec, Mat, Dims>::swap(GaussianDistribution<Vec, Ma
     swap(m_mean, rhs.m_mean);
     swap(m_covariance, rhs.m_covariance);
     swap(m_invCovariance, rhs.m_invCovariance);
+    swap(m_invCholeskyFactor, rhs.m_invCholeskyFactor);
     swap(m_underflowProtection, rhs.m_underflowProtection);
+    swap(m_covarianceType, rhs.m_covarianceType);
 }
 
 //----------------------------------------------------------------------------
@@ -81,41 +86,96 @@ GaussianDistribution<Vec, Mat, Dims>& AC::GaussianDistribution<Vec, Mat, Dims>::
 template <typename Vec, typename Mat, int Dims>
 void AC::GaussianDistribution<Vec, Mat, Dims>::setCovariance(const Mat& cov)
 {
+    if (m_covarianceType == CovarianceType::Diagonal || m_covarianceType == CovarianceType::Spherical) {
+        // Keep the variances only (their average, if spherical). The inverse and the log determinant come directly from them, and
+        // summing logs cannot underflow, so the only protection we need is a minimum variance.
+        Vec variances = cov.diagonal();
+        if (m_covarianceType == CovarianceType::Spherical)
+            variances.setConstant((Scalar)(variances.template cast<double>().sum() / Dimensions()));
+        m_covariance = Mat::Zero(cov.rows(), cov.cols());
+        m_invCovariance = Mat::Zero(cov.rows(), cov.cols());
+        m_invCholeskyFactor = Mat::Zero(cov.rows(), cov.cols());
+        double logDeterminant = 0;
+        for (int i = 0; i < Dimensions(); ++i) {
+            double variance = UnderflowProtection() ? std::max((double)variances[i], Limits::SafeCovarianceFactor()) : (double)variances[i];
+            m_covariance(i, i) = (Scalar)variance;
+            m_invCovariance(i, i) = (Scalar)(1.0 / variance);
+            m_invCholeskyFactor(i, i) = (Scalar)(1.0 / sqrt(variance));
+            logDeterminant += log(variance);
+        }
+        m_logNormFactor = -0.5 * (Dimensions() * log(M_PI * 2) + logDeterminant);
+        return;
+    }
+
     m_covariance = cov;
 
-    double determinant;
+    // Factor the covariance matrix in double precision, whatever the scalar type we store: Cov = L * L^T. The factor gives us the log
+    // determinant (2 * sum_i(log(L_ii))) and an estimate of the conditioning without computing any inverse, and its triangular inverse
+    // gives the Mahalanobis distance (see EvaluateLog). A factorization failure means that the matrix is not positive definite.
+    typedef Eigen::Matrix<double, Dims, Dims> MatD;
+    Eigen::LLT<MatD> llt(m_covariance.template cast<double>());
+    double logDeterminant = 2 * llt.matrixLLT().diagonal().array().log().sum();
     if (UnderflowProtection()) {
-        // A very small determinant leads to an invalid logNormFactor. If that happens, reset the covariance matrix to a diagonal one.
-        determinant = m_covariance.determinant();
-        if (determinant < c_SafeDeterminantWithoutUnderflow) {
+        // A matrix that is not positive definite cannot be factored. If it is only semidefinite (e.g., the scatter matrix of observations
+        // that lie on a plane, or one that lost definiteness to rounding), the diagonal correction makes it definite: regularize and factor again.
+        if (llt.info() != Eigen::Success) {
+            for (int i = 0; i < Dimensions(); ++i)
+                m_covariance(i, i) += (Scalar)Limits::SafeCovarianceFactor();
+            llt.compute(m_covariance.template cast<double>());
+            logDeterminant = 2 * llt.matrixLLT().diagonal().array().log().sum();
+        }
+
+        // If the factorization still fails (an indefinite matrix), or the determinant is so small that logNormFactor would be invalid, reset
+        // the covariance matrix to a diagonal one. The determinant is compared per dimension (as the geometric mean of the variances), since
+        // the determinant of a valid covariance shrinks exponentially with the number of dimensions.
+        if (llt.info() != Eigen::Success || !(logDeterminant / Dimensions() >= log(Limits::SafeVarianceWithoutUnderflow()))) {
             m_covariance.setIdentity();
-            m_covariance *= c_SafeCovarianceFactor;
+            m_covariance *= (Scalar)Limits::SafeCovarianceFactor();
+            llt.compute(m_covariance.template cast<double>());
         }
 
         // Is this covariance matrix degenerate? If RCOND is close to zero, it means that cov is ill-conditioned (close to degenerate).
-        if (RCOND(m_covariance) < c_SafeMatrixRCOND) {
+        if (llt.rcond() < Limits::SafeMatrixRCOND()) {
             // Make cov = cov + eye(Dims)*SomeSmallValue to make it better conditioned, even if it's inaccurate.
-            for (int i = 0; i < Dims; ++i)
-                m_covariance(i, i) += c_SafeCovarianceFactor;
+            for (int i = 0; i < Dimensions(); ++i)
+                m_covariance(i, i) += (Scalar)Limits::SafeCovarianceFactor();
+            llt.compute(m_covariance.template cast<double>());
         }
+        logDeterminant = 2 * llt.matrixLLT().diagonal().array().log().sum();
     }
 
-    determinant = m_covariance.determinant();
-    m_invCovariance = m_covariance.inverse();
-    m_logNormFactor = -0.5*log(pow(M_PI * 2, Dims) * determinant);
+    // inv(L) is a single triangular inversion, and inv(Cov) = inv(L)^T * inv(L) follows from it without solving a second system
+    MatD invCholeskyFactor = llt.matrixL().solve(MatD::Identity(Dimensions(), Dimensions()));
+    m_invCholeskyFactor = invCholeskyFactor.template cast<Scalar>();
+    m_invCovariance = (invCholeskyFactor.transpose() * invCholeskyFactor).template cast<Scalar>();
+    m_logNormFactor = -0.5 * (Dimensions() * log(M_PI * 2) + logDeterminant);
 }
 
 //----------------------------------------------------------------------------
 template <typename Vec, typename Mat, int Dims>
-double AC::GaussianDistribution<Vec, Mat, Dims>::EvaluateLog(const Vec& observation)
+double AC::GaussianDistribution<Vec, Mat, Dims>::EvaluateLog(const Vec& observation) const
 {
-    double exponentialTerm = ((observation - Mean()).transpose() * InvCovariance() * (observation - Mean()));
+    Vec centeredObservation = observation - Mean();
+    double exponentialTerm;
+    switch (m_covarianceType) {
+    case CovarianceType::Diagonal:
+        exponentialTerm = centeredObservation.cwiseAbs2().dot(InvCovariance().diagonal());
+        break;
+    case CovarianceType::Spherical:
+        exponentialTerm = centeredObservation.squaredNorm() * InvCovariance()(0, 0);
+        break;
+    default:
+        // (x - mu)^T * inv(L * L^T) * (x - mu) = ||inv(L) * (x - mu)||^2, i.e., the squared norm of the solution of the triangular system
+        // L * y = x - mu. inv(L) is precomputed in setCovariance(), so the solve is a triangular matrix-vector product.
+        exponentialTerm = (m_invCholeskyFactor.template triangularView<Eigen::Lower>() * centeredObservation).squaredNorm();
+        break;
+    }
     return m_logNormFactor - 0.5 * exponentialTerm;
 }
 
 //----------------------------------------------------------------------------
 template <typename Vec, typename Mat, int Dims>
-double AC::GaussianDistribution<Vec, Mat, Dims>::Evaluate(const Vec& observation)
+double AC::GaussianDistribution<Vec, Mat, Dims>::Evaluate(const Vec& observation) const
 {
     return exp(EvaluateLog(observation));
 }
@@ -125,9 +185,8 @@ template <typename Vec, typename Mat, int Dims>
 void AC::GaussianDistribution<Vec, Mat, Dims>::Reinitialize(const Vec& mean, double variance, double weight)
 {
     m_mean = mean;
-    Mat cov;
-    cov.setIdentity();
-    cov *= UnderflowProtection() ? std::max(variance, c_SafeCovarianceFactor) : variance;
+    Mat cov = Mat::Identity(mean.size(), mean.size());
+    cov *= (Scalar)(UnderflowProtection() ? std::max(variance, Limits::SafeCovarianceFactor()) : variance);
     setCovariance(cov);
     setWeight(weight);
 }
@@ -136,11 +195,10 @@ void AC::GaussianDistribution<Vec, Mat, Dims>::Reinitialize(const Vec& mean, dou
 template <typename Vec, typename Mat, int Dims>
 void AC::GaussianDistribution<Vec, Mat, Dims>::Rescale(const Vec& scalingFactors)
 {
-    Mat scalingMat;
-    scalingMat.setZero();
+    Mat scalingMat = Mat::Zero(scalingFactors.size(), scalingFactors.size());
     for (int i = 0; i < scalingFactors.size(); ++i) {
         _ASSERT(!UnderflowProtection() || (UnderflowProtection() && scalingFactors[i] > c_SafeCovarianceFactor && "Invalid Scaling Factor (should be > 0)"));
-        scalingMat(i, i) = scalingFactors[i] > c_SafeCovarianceFactor ? 1 / scalingFactors[i] : 1;
+        scalingMat(i, i) = scalingFactors[i] > c_SafeCovarianceFactor ? 1 / scalingFactors[i] : (Scalar)1;
     }
 
     m_mean = scalingMat * m_mean;
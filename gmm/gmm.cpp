@@ -25,32 +25,121 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
+#include <algorithm>
 #include <cmath>
+#include <numeric>
 #include <random>
 #include "gmm.h"
 #include "em.h"
 #include "math_utils.h"
 #include "KMeans.h"
 #include "gaussian.h"
+#include "compiled_gmm.h"
+#include "parallel.h"
 
 // Local helper functions
 namespace
 {
     //----------------------------------------------------------------------------
-    bool CompareWeights3D(const AC::GaussianDistribution3D::SP& g1, const AC::GaussianDistribution3D::SP& g2)
+    template <typename ModeSP>
+    bool CompareWeights3D(const ModeSP& g1, const ModeSP& g2)
     {
         return g1->Weight() > g2->Weight();
     }
 
     //----------------------------------------------------------------------------
-    void SortModes(std::vector<AC::GaussianDistribution3D::SP>& modes)
+    template <typename ModeSP>
+    void SortModes(std::vector<ModeSP>& modes)
     {
-        std::sort(modes.begin(), modes.end(), CompareWeights3D);
+        std::sort(modes.begin(), modes.end(), CompareWeights3D<ModeSP>);
     }
+
+    //----------------------------------------------------------------------------
+    // Batch evaluation of a GMM. 3D GMMs are compiled (O(numModes), cheap compared to scoring a batch) into the cache-friendly layout
+    // used by the vectorized kernels; any other dimension evaluates one observation at a time, in shards across threads.
+    struct BatchEvaluation
+    {
+        template <int Dims, typename Scalar>
+        static void LogLikelihoods(const AC::GMM::GMM<Dims, Scalar>& gmm, const typename AC::GMM::GMM<Dims, Scalar>::VecType* observations,
+            size_t numObservations, double* logLikelihoods, int numThreads)
+        {
+            AC::ParallelFor(numObservations, AC::ResolveNumThreads(numThreads), [&](int, size_t begin, size_t end) {
+                for (size_t o = begin; o < end; ++o)
+                    logLikelihoods[o] = gmm.LogLikelihood(observations[o]);
+            });
+        }
+
+        template <int Dims, typename Scalar>
+        static void Likelihoods(const AC::GMM::GMM<Dims, Scalar>& gmm, const typename AC::GMM::GMM<Dims, Scalar>::VecType* observations,
+            size_t numObservations, double* likelihoods, int numThreads)
+        {
+            AC::ParallelFor(numObservations, AC::ResolveNumThreads(numThreads), [&](int, size_t begin, size_t end) {
+                for (size_t o = begin; o < end; ++o)
+                    likelihoods[o] = gmm.Likelihood(observations[o]);
+            });
+        }
+
+        template <int Dims, typename Scalar>
+        static void Responsibilities(const AC::GMM::GMM<Dims, Scalar>& gmm, const typename AC::GMM::GMM<Dims, Scalar>::VecType* observations,
+            size_t numObservations, double* responsibilities, int numThreads)
+        {
+            int numModes = (int)gmm.Modes().size();
+            AC::ParallelFor(numObservations, AC::ResolveNumThreads(numThreads), [&](int, size_t begin, size_t end) {
+                for (size_t o = begin; o < end; ++o) {
+                    double logLikelihood = gmm.LogLikelihood(observations[o]);
+                    for (int k = 0; k < numModes; ++k) {
+                        double responsibility = exp(gmm.Modes(k)->EvaluateLog(observations[o]) + gmm.Modes(k)->LogWeight() - logLikelihood);
+                        responsibilities[o * numModes + k] = AC::IsFinite(responsibility) ? responsibility : 0;
+                    }
+                }
+            });
+        }
+
+        template <int Dims, typename Scalar>
+        static void ClosestModes(const AC::GMM::GMM<Dims, Scalar>& gmm, const typename AC::GMM::GMM<Dims, Scalar>::VecType* observations,
+            size_t numObservations, int* modes, double* logProbabilities, int numThreads)
+        {
+            AC::ParallelFor(numObservations, AC::ResolveNumThreads(numThreads), [&](int, size_t begin, size_t end) {
+                for (size_t o = begin; o < end; ++o) {
+                    double logProbability = gmm.ClosestMode(observations[o], modes[o]);
+                    if (logProbabilities != nullptr)
+                        logProbabilities[o] = logProbability;
+                }
+            });
+        }
+
+        template <typename Scalar>
+        static void LogLikelihoods(const AC::GMM::GMM<3, Scalar>& gmm, const typename AC::GMM::GMM<3, Scalar>::VecType* observations,
+            size_t numObservations, double* logLikelihoods, int numThreads)
+        {
+            AC::GMM::CompiledGMM3D(gmm).LogLikelihoods(observations, numObservations, logLikelihoods, numThreads);
+        }
+
+        template <typename Scalar>
+        static void Likelihoods(const AC::GMM::GMM<3, Scalar>& gmm, const typename AC::GMM::GMM<3, Scalar>::VecType* observations,
+            size_t numObservations, double* likelihoods, int numThreads)
+        {
+            AC::GMM::CompiledGMM3D(gmm).Likelihoods(observations, numObservations, likelihoods, numThreads);
+        }
+
+        template <typename Scalar>
+        static void Responsibilities(const AC::GMM::GMM<3, Scalar>& gmm, const typename AC::GMM::GMM<3, Scalar>::VecType* observations,
+            size_t numObservations, double* responsibilities, int numThreads)
+        {
+            AC::GMM::CompiledGMM3D(gmm).Responsibilities(observations, numObservations, responsibilities, numThreads);
+        }
+
+        template <typename Scalar>
+        static void ClosestModes(const AC::GMM::GMM<3, Scalar>& gmm, const typename AC::GMM::GMM<3, Scalar>::VecType* observations,
+            size_t numObservations, int* modes, double* logProbabilities, int numThreads)
+        {
+            AC::GMM::CompiledGMM3D(gmm).ClosestModes(observations, numObservations, modes, logProbabilities, numThreads);
+        }
+    };
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::LogSumExp(const std::vector<double>& logValues1, const std::vector<double>& logValues2)
+double AC::GMM::LogSumExp(const std::vector<double>& logValues1, const std::vector<double>& logValues2, EvaluationPrecision precision)
 {
     _ASSERT(logValues1.size() == logValues2.size() && L"Vectors must have the same size");
 
@@ -66,59 +155,87 @@ double AC::GMM::LogSumExp(const std::vector<double>& logValues1, const std::vect
             maxLogValue = logValue;
     }
 
+    // Terms far below the maximum do not change the sum, so we skip their exp()
     double expsum = 0;
-    for (int i = 0; i < logValues1.size(); i++)
-        expsum += exp(logValues1[i] + logValues2[i] - maxLogValue);
-
+    if (precision == EvaluationPrecision::Fast) {
+        for (int i = 0; i < logValues1.size(); i++) {
+            double logValue = logValues1[i] + logValues2[i] - maxLogValue;
+            if (logValue >= c_LogSumExpFlushThreshold)
+                expsum += Kernels::FastExp(logValue);
+        }
+        return maxLogValue + Kernels::FastLog(expsum);
+    }
+    for (int i = 0; i < logValues1.size(); i++) {
+        double logValue = logValues1[i] + logValues2[i] - maxLogValue;
+        if (logValue >= c_LogSumExpFlushThreshold)
+            expsum += exp(logValue);
+    }
     return maxLogValue + log(expsum);
 }
 
 //----------------------------------------------------------------------------
-AC::GMM::GMM3D::GMM3D(int numModes)
-    : m_tmpLogWeights(numModes)
-    , m_tmpLogLikelihoods(numModes)
-    , m_globalWeight(1.0)
+template <int Dims, typename Scalar>
+AC::GMM::GMM<Dims, Scalar>::GMM(int numModes, int dimensions)
+    : m_globalWeight(1.0)
+    , m_dimensions(dimensions)
+    , m_covarianceType(CovarianceType::Full)
 {
-
-    // Reserve memory for our temporary vectors (to avoid allocations while processing)
+    _ASSERT(dimensions > 0 && (Dims == Eigen::Dynamic || dimensions == Dims) && L"Invalid number of dimensions");
     m_modes.reserve(numModes);
     // Create the set of gaussians in our GMM
     for (int k = 0; k < numModes; ++k)
-        m_modes.emplace_back(new GaussianDistribution3D());
+        m_modes.emplace_back(new ModeType(dimensions));
 }
 
 //----------------------------------------------------------------------------
-AC::GMM::GMM3D::GMM3D(const GMM3D& rhs)
-    : m_tmpLogLikelihoods(rhs.m_tmpLogLikelihoods.begin(), rhs.m_tmpLogLikelihoods.end())
-    , m_tmpLogWeights(rhs.m_tmpLogWeights.begin(), rhs.m_tmpLogWeights.end())
-    , m_globalWeight(rhs.m_globalWeight)
+template <int Dims, typename Scalar>
+AC::GMM::GMM<Dims, Scalar>::GMM(const GMM<Dims, Scalar>& rhs)
+    : m_globalWeight(rhs.m_globalWeight)
+    , m_dimensions(rhs.m_dimensions)
+    , m_covarianceType(rhs.m_covarianceType)
 {
     m_modes.reserve(rhs.m_modes.size());
     for (auto& mode : rhs.m_modes)
-        m_modes.emplace_back(new GaussianDistribution3D(*mode));
+        m_modes.emplace_back(new ModeType(*mode));
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::GMM3D::LogLikelihood(const Vec3& observation)
+template <int Dims, typename Scalar>
+double AC::GMM::GMM<Dims, Scalar>::LogLikelihood(const VecType& observation) const
 {
-    for (int k = 0; k < m_modes.size(); ++k) {
-        m_tmpLogLikelihoods[k] = Modes(k)->EvaluateLog(observation);
-        m_tmpLogWeights[k] = Modes(k)->LogWeight();
-    }
+    // Trivial case (same as LogSumExp)
+    if (m_modes.empty())
+        return 0;
 
-    // We have to use the LogExpSum trick to evaluate likelihoods to avoid underflows
-    return LogSumExp(m_tmpLogLikelihoods, m_tmpLogWeights);
+    // We have to use the LogExpSum trick to evaluate likelihoods to avoid underflows. We use its single-pass form, rescaling the
+    // running sum whenever a new maximum appears, so that we do not need any temporary storage (and this function can be const).
+    double maxLogValue = -std::numeric_limits<double>::max();
+    double expsum = 0;
+    for (const auto& mode : m_modes) {
+        double logValue = mode->EvaluateLog(observation) + mode->LogWeight();
+        if (logValue <= maxLogValue) {
+            if (logValue - maxLogValue >= c_LogSumExpFlushThreshold)
+                expsum += exp(logValue - maxLogValue);
+        }
+        else {
+            expsum = maxLogValue - logValue >= c_LogSumExpFlushThreshold ? expsum * exp(maxLogValue - logValue) + 1 : 1;
+            maxLogValue = logValue;
+        }
+    }
+    return maxLogValue + log(expsum);
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::GMM3D::Likelihood(const Vec3& observation)
+template <int Dims, typename Scalar>
+double AC::GMM::GMM<Dims, Scalar>::Likelihood(const VecType& observation) const
 {
     double likelihood = exp(LogLikelihood(observation)) * GlobalWeight();
     return IsFinite(likelihood) ? likelihood : 0;
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::GMM3D::LogLikelihood(const std::vector<Vec3>& observations)
+template <int Dims, typename Scalar>
+double AC::GMM::GMM<Dims, Scalar>::LogLikelihood(const std::vector<VecType>& observations) const
 {
     double sum = 0;
     for (const auto& observation : observations)
@@ -129,7 +246,21 @@ double AC::GMM::GMM3D::LogLikelihood(const std::vector<Vec3>& observations)
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::GMM3D::LogResponsibility(const Vec3& observation, int idxMode)
+template <int Dims, typename Scalar>
+double AC::GMM::GMM<Dims, Scalar>::LogLikelihood(const std::vector<VecType>& observations, const std::vector<double>& weights) const
+{
+    _ASSERT(observations.size() == weights.size() && L"Vectors must be the same size");
+    double sum = 0;
+    for (size_t o = 0; o < observations.size(); ++o)
+        sum += weights[o] * LogLikelihood(observations[o]);
+
+    // If NaN or infinite, return minimum possible value for log (corresponding to 0 probability)
+    return IsFinite(sum) ? sum : -std::numeric_limits<double>::max();
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::GMM<Dims, Scalar>::LogResponsibility(const VecType& observation, int idxMode) const
 {
     // output: p(k|x_n) = p(x_n|k)p(k)/sum_k(p(x_n|k))
     // We need to use logs to avoid underflow, so: log p(k|x_n) = log(x_n|k) + log(p(k)) - log(sum_k(p(x_n|k))
@@ -137,22 +268,76 @@ double AC::GMM::GMM3D::LogResponsibility(const Vec3& observation, int idxMode)
 }
 
 //----------------------------------------------------------------------------
-bool AC::GMM::GMM3D::Process(const std::vector<Vec3>& observations, int numKMeansRestarts, Vec3* scalingFactors, double EMTolerance, int maxIterations)
+template <int Dims, typename Scalar>
+bool AC::GMM::GMM<Dims, Scalar>::Process(const std::vector<VecType>& observations, int numKMeansRestarts, VecType* scalingFactors, double EMTolerance, int maxIterations, int numThreads)
+{
+    TrainingOptions options;
+    options.numKMeansRestarts = numKMeansRestarts;
+    options.kmeansInitialization = KMeansInitialization::Random;
+    options.EMTolerance = EMTolerance;
+    options.EMMaxIterations = maxIterations;
+    options.numThreads = numThreads;
+    return Process(observations, options, scalingFactors);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+bool AC::GMM::GMM<Dims, Scalar>::Process(const std::vector<VecType>& observations, const TrainingOptions& options, VecType* scalingFactors)
 {
-    // Compute K-Means to initialize GMM
-    AC::KMeans3D kmeans((int)Modes().size());
-    std::vector<int> assignments(observations.size());
-    kmeans.Process(observations, numKMeansRestarts, assignments);
+    if (options.summarize) {
+        double cellSize = options.summaryCellSize > 0 ? options.summaryCellSize : ObservationSummary<VecType>::CellSizeFor(observations);
+        ObservationSummary<VecType> summary(cellSize, options.summaryMaxBins);
+        summary.Push(observations, options.numThreads);
+        std::vector<VecType> representatives;
+        std::vector<double> weights;
+        summary.Representatives(representatives, weights);
+        return Process(representatives, weights, options, scalingFactors);
+    }
+    if (options.deduplicate) {
+        std::vector<VecType> uniqueObservations;
+        std::vector<double> counts;
+        CountUniqueObservations(observations, uniqueObservations, counts);
+        return Process(uniqueObservations, counts, options, scalingFactors);
+    }
+    return Process(observations, std::vector<double>(), options, scalingFactors);
+}
 
-    // Initialize GMM from K-Means results
-    for (int k = 0; k < kmeans.numCentroids(); ++k) {
-        Modes(k)->Reinitialize(kmeans.Centroids(k), kmeans.AvgVariance(k));
-        Modes(k)->setWeight(kmeans.CentroidAssignmentRatio(k));
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+bool AC::GMM::GMM<Dims, Scalar>::Process(const std::vector<VecType>& observations, const std::vector<double>& weights, const TrainingOptions& options, VecType* scalingFactors)
+{
+    if (options.warmStart) {
+        // Bring the current modes to the space of the (whitened) observations
+        if (scalingFactors != nullptr) {
+            VecType invScalingFactors = scalingFactors->cwiseInverse();
+            for (int k = 0; k < Modes().size(); ++k)
+                Modes(k)->Rescale(invScalingFactors);
+        }
+        if (options.reseedWeakModes)
+            ReseedWeakModes(observations, options.numThreads);
+    } else {
+        // Compute K-Means to initialize GMM
+        AC::KMeans<VecType> kmeans((int)Modes().size());
+        kmeans.setInitialization(options.kmeansInitialization);
+        kmeans.setAlgorithm(options.kmeansAlgorithm);
+        kmeans.setMiniBatchSize(options.miniBatchSize);
+        kmeans.setMiniBatchIterations(options.miniBatchIterations);
+        kmeans.setSeed(options.seed);
+        kmeans.setNumThreads(options.numThreads);
+        std::vector<int> assignments(observations.size());
+        kmeans.Process(observations, weights, options.numKMeansRestarts, assignments);
+
+        // Initialize GMM from K-Means results
+        for (int k = 0; k < kmeans.numCentroids(); ++k) {
+            Modes(k)->Reinitialize(kmeans.Centroids(k), kmeans.AvgVariance(k));
+            Modes(k)->setWeight(kmeans.CentroidAssignmentRatio(k));
+        }
     }
 
     // Use EM to optimize GMM
-    AC::GMM::EM EMTraining((int)observations.size(), (int)Modes().size(), EMTolerance, maxIterations);
-    bool success = EMTraining.Process(observations, *this);
+    AC::GMM::EMT<Dims, Scalar> EMTraining((int)observations.size(), (int)Modes().size(), options.EMTolerance, options.EMMaxIterations, options.numThreads);
+    EMTraining.setResponsibilityStorage(options.responsibilityStorage);
+    bool success = EMTraining.Process(observations, weights, *this);
 
     // Sort modes according to weight
     SortModes(Modes());
@@ -162,16 +347,73 @@ bool AC::GMM::GMM3D::Process(const std::vector<Vec3>& observations, int numKMean
         for (int k = 0; k < Modes().size(); ++k)
             Modes(k)->Rescale(*scalingFactors);
 
-    // Prune bad modes
-    RemoveBadModes(c_SafeMinWeight);
+    // Prune bad modes. Warm starts keep them, so that the number of modes is stable across refits, and the modes that lost their support
+    // are reseeded by the next refit (see TrainingOptions::reseedWeakModes).
+    if (!options.warmStart)
+        RemoveBadModes(c_SafeMinWeight);
 
     // Set global weight based on the number of observations (to compare against other GMMs)
-    SetGlobalWeight(log(observations.size()));
+    double sumWeights = (double)observations.size();
+    if (!weights.empty())
+        sumWeights = std::accumulate(weights.begin(), weights.end(), 0.0);
+    SetGlobalWeight(log(sumWeights));
     return success;
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::GMM3D::ClosestMode(const Vec3& observation, int& mode) const
+template <int Dims, typename Scalar>
+int AC::GMM::GMM<Dims, Scalar>::ReseedWeakModes(const std::vector<VecType>& observations, int numThreads)
+{
+    std::vector<int> weakModes;
+    double avgVariance = 0;
+    int numStrongModes = 0;
+    for (int k = 0; k < (int)Modes().size(); ++k) {
+        if (Modes(k)->Weight() <= c_SafeMinWeight) {
+            weakModes.push_back(k);
+        } else {
+            avgVariance += Modes(k)->Covariance().trace() / Dimensions();
+            ++numStrongModes;
+        }
+    }
+    if (weakModes.empty() || observations.empty())
+        return 0;
+
+    // Remove the weak modes from the mixture, so that they do not take part in the evaluation
+    avgVariance = numStrongModes > 0 ? avgVariance / numStrongModes : 1.0;
+    for (int k : weakModes)
+        Modes(k)->setWeight(0);
+
+    // Worst explained observations first
+    std::vector<size_t> order(observations.size());
+    int numReseeded = (int)std::min(weakModes.size(), observations.size());
+    if (numStrongModes > 0) {
+        std::vector<double> logLikelihoods(observations.size());
+        LogLikelihoods(observations.data(), observations.size(), logLikelihoods.data(), numThreads);
+        for (size_t o = 0; o < order.size(); ++o)
+            order[o] = o;
+        std::partial_sort(order.begin(), order.begin() + numReseeded, order.end(),
+            [&](size_t a, size_t b) { return logLikelihoods[a] < logLikelihoods[b] || (logLikelihoods[a] == logLikelihoods[b] && a < b); });
+    } else {
+        for (int i = 0; i < numReseeded; ++i)
+            order[i] = (size_t)i * observations.size() / numReseeded;
+    }
+
+    for (int i = 0; i < (int)weakModes.size(); ++i) {
+        Modes(weakModes[i])->Reinitialize(observations[order[i % numReseeded]], avgVariance);
+        Modes(weakModes[i])->setWeight(1.0 / Modes().size());
+    }
+
+    double sumWeights = 0;
+    for (auto& mode : Modes())
+        sumWeights += mode->Weight();
+    for (auto& mode : Modes())
+        mode->setWeight(mode->Weight() / sumWeights);
+    return (int)weakModes.size();
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::GMM<Dims, Scalar>::ClosestMode(const VecType& observation, int& mode) const
 {
     double bestLogProbability = -std::numeric_limits<double>::max();
     mode = INVALID_MODE;
@@ -187,7 +429,58 @@ double AC::GMM::GMM3D::ClosestMode(const Vec3& observation, int& mode) const
 }
 
 //----------------------------------------------------------------------------
-size_t AC::GMM::GMM3D::RemoveBadModes(double tolerance)
+template <int Dims, typename Scalar>
+void AC::GMM::GMM<Dims, Scalar>::LogLikelihoods(const VecType* observations, size_t numObservations, double* logLikelihoods, int numThreads) const
+{
+    BatchEvaluation::LogLikelihoods(*this, observations, numObservations, logLikelihoods, numThreads);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::GMM<Dims, Scalar>::Likelihoods(const VecType* observations, size_t numObservations, double* likelihoods, int numThreads) const
+{
+    BatchEvaluation::Likelihoods(*this, observations, numObservations, likelihoods, numThreads);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::GMM<Dims, Scalar>::Responsibilities(const VecType* observations, size_t numObservations, double* responsibilities, int numThreads) const
+{
+    BatchEvaluation::Responsibilities(*this, observations, numObservations, responsibilities, numThreads);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::GMM<Dims, Scalar>::ClosestModes(const VecType* observations, size_t numObservations, int* modes, double* logProbabilities, int numThreads) const
+{
+    BatchEvaluation::ClosestModes(*this, observations, numObservations, modes, logProbabilities, numThreads);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::GMM<Dims, Scalar>::setCovarianceType(CovarianceType type)
+{
+    m_covarianceType = type;
+    for (auto& mode : m_modes)
+        mode->setCovarianceType(type);
+
+    // Tied modes share the weighted average of the current covariances
+    if (type == CovarianceType::Tied && !m_modes.empty()) {
+        Eigen::Matrix<double, Dims, Dims> pooled = Eigen::Matrix<double, Dims, Dims>::Zero(m_dimensions, m_dimensions);
+        double sumWeights = 0;
+        for (const auto& mode : m_modes) {
+            pooled += mode->Weight() * mode->Covariance().template cast<double>();
+            sumWeights += mode->Weight();
+        }
+        MatType covariance = (pooled / sumWeights).template cast<Scalar>();
+        for (auto& mode : m_modes)
+            mode->setCovariance(covariance);
+    }
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+size_t AC::GMM::GMM<Dims, Scalar>::RemoveBadModes(double tolerance)
 {
     // Erase any mode with weight under a certain tolerance
     Modes().erase(std::remove_if(
@@ -195,18 +488,26 @@ size_t AC::GMM::GMM3D::RemoveBadModes(double tolerance)
         [&](mode_type m) { return m->Weight() <= tolerance; }),
         Modes().end());
 
-    // If we erased any mode, need to resize and reset the temporary vectors.
-    m_tmpLogLikelihoods.resize(Modes().size(), 0.0);
-    m_tmpLogWeights.resize(Modes().size(), 0.0);
-
     return Modes().size();
 }
 
 //----------------------------------------------------------------------------
-double AC::GMM::GMMLikelihoodRatio(GMM3D& gmm1, GMM3D& gmm2, const Vec3& observation)
+template <int Dims, typename Scalar>
+double AC::GMM::GMMLikelihoodRatio(const GMM<Dims, Scalar>& gmm1, const GMM<Dims, Scalar>& gmm2, const typename GMM<Dims, Scalar>::VecType& observation)
 {
-    double fgLikelihood = gmm1.Likelihood(observation);
-    double bgLikelihood = gmm2.Likelihood(observation);
-    return fgLikelihood / (fgLikelihood + bgLikelihood);
+    // p1 / (p1 + p2) = 1 / (1 + exp(log(p2) - log(p1))), which does not underflow to 0/0 for observations far from both GMMs
+    double logFgLikelihood = gmm1.LogLikelihood(observation) + log(gmm1.GlobalWeight());
+    double logBgLikelihood = gmm2.LogLikelihood(observation) + log(gmm2.GlobalWeight());
+    return 1.0 / (1.0 + exp(logBgLikelihood - logFgLikelihood));
 }
 
+
+// Supported dimensions and scalar types
+#define AC_GMM_INSTANTIATE(Dims, Scalar) \
+    template class AC::GMM::GMM<Dims, Scalar>; \
+    template double AC::GMM::GMMLikelihoodRatio(const GMM<Dims, Scalar>&, const GMM<Dims, Scalar>&, const GMM<Dims, Scalar>::VecType&);
+AC_GMM_INSTANTIATE(2, double) AC_GMM_INSTANTIATE(3, double) AC_GMM_INSTANTIATE(4, double) AC_GMM_INSTANTIATE(5, double)
+AC_GMM_INSTANTIATE(6, double) AC_GMM_INSTANTIATE(7, double) AC_GMM_INSTANTIATE(8, double) AC_GMM_INSTANTIATE(Eigen::Dynamic, double)
+AC_GMM_INSTANTIATE(2, float) AC_GMM_INSTANTIATE(3, float) AC_GMM_INSTANTIATE(4, float) AC_GMM_INSTANTIATE(5, float)
+AC_GMM_INSTANTIATE(6, float) AC_GMM_INSTANTIATE(7, float) AC_GMM_INSTANTIATE(8, float) AC_GMM_INSTANTIATE(Eigen::Dynamic, float)
+#undef AC_GMM_INSTANTIATE
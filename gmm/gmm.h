@@ -31,6 +31,9 @@ SOFTWARE.
 #include <vector>
 #include <memory>
 #include "gaussian.h"
+#include "kmeans.h"
+#include "observation_summary.h"
+#include "gmm_kernels.h"
 
 namespace AC
 {
@@ -41,93 +44,245 @@ namespace AC
         const int INVALID_MODE = -1; // If you call ClosestMode() and there are no modes, the mode returned is INVALID_MODE
         const int c_EMDefaultMaxIterations = 10; // Max number of iterations of EM. If we do not get under the tolerance in MaxIterations, we give up.
         const double c_EMDefaultTolerance = 1e-4; // Stopping condition in EM. If ratio of new vs old log likelihoods is lower than tolerance, finish process. 
+        const int c_KMeansPlusPlusRestarts = 2; // Default number of restarts for KMeans initialization seeded with k-means++ (see TrainingOptions)
+        const int c_EMDefaultTopKResponsibilities = 4; // Number of responsibilities kept per observation with ResponsibilityStorage::TopK
 
-        class GMM3D {
+        /// <summary> How EM stores the responsibilities p(k|x_n) between the E-step and the M-step. </summary>
+        enum class ResponsibilityStorage {
+            ModeMajor,  // K vectors of N responsibilities, with the scalar type of the GMM (default). K*N*sizeof(Scalar) bytes.
+            PointMajor, // One contiguous N x K matrix of floats, point-major, so the M-step reads the responsibilities of each observation
+                        // sequentially. K*N*4 bytes.
+            TopK,       // Only the largest few responsibilities of each observation (see EM::setTopK), renormalized to sum to one, as (mode, float)
+                        // pairs. Approximate (truncated EM), but the small responsibilities are mostly noise. TopK*N*6 bytes.
+            None        // Not stored: the E-step accumulates the sufficient statistics of the M-step on the fly, in the same pass over the
+                        // observations, so EM needs no memory per observation. Same GMM as ModeMajor (up to rounding).
+        };
+
+        /// <summary> Options of GMM::Process(). By default, k-means is seeded with k-means++, which needs far fewer restarts than the
+        ///           random seeding of the original Process() overload to reach the same quality. </summary>
+        struct TrainingOptions
+        {
+            TrainingOptions()
+                : numKMeansRestarts(c_KMeansPlusPlusRestarts)
+                , kmeansInitialization(KMeansInitialization::KMeansPlusPlus)
+                , kmeansAlgorithm(KMeansAlgorithm::Hamerly)
+                , miniBatchSize(c_KMeansMiniBatchSize)
+                , miniBatchIterations(c_KMeansMiniBatchIterations)
+                , EMTolerance(c_EMDefaultTolerance)
+                , EMMaxIterations(c_EMDefaultMaxIterations)
+                , numThreads(1)
+                , seed(c_DefaultRandomSeed)
+                , warmStart(false)
+                , reseedWeakModes(true)
+                , deduplicate(false)
+                , summarize(false)
+                , summaryCellSize(0)
+                , summaryMaxBins(c_SummaryDefaultMaxBins)
+                , responsibilityStorage(ResponsibilityStorage::ModeMajor)
+            {}
+
+            int numKMeansRestarts; // Number of restarts in KMeans initialization
+            KMeansInitialization kmeansInitialization; // Seeding of the centroids in each KMeans restart
+            KMeansAlgorithm kmeansAlgorithm; // Algorithm of the KMeans iterations (Hamerly gives the same result as Lloyd, faster; MiniBatch for very large sets)
+            int miniBatchSize; // Number of observations per iteration if kmeansAlgorithm is MiniBatch
+            int miniBatchIterations; // Number of iterations if kmeansAlgorithm is MiniBatch
+            double EMTolerance; // Stopping condition in EM. If ratio of new vs old log likelihoods is lower than tolerance, finish process.
+            int EMMaxIterations; // Max number of iterations of EM. If we do not get under the EM tolerance in MaxIterations, we give up.
+            int numThreads; // Number of threads used in the KMeans restarts and in EM (0 = all hardware threads). Results are identical for a given number of threads. The threads are started for every E-step and M-step (see ParallelFor), so only large sets benefit from them.
+            uint64_t seed; // Seed of the random numbers used in KMeans (see KMeans::setSeed)
+            bool warmStart; // If true, skip KMeans and start EM from the current modes (e.g. to refit the GMM of a previous frame). Usually converges in a few EM iterations. Modes whose weight falls to c_SafeMinWeight are kept (not pruned), so the number of modes is stable across refits.
+            bool reseedWeakModes; // If warmStart, replace the modes whose weight fell to c_SafeMinWeight (e.g. in the previous refit) before EM (see ReseedWeakModes)
+            bool deduplicate; // Collapse repeated observations into weighted distinct values before training (see CountUniqueObservations). Worth it if many observations are repeated (e.g., image colours).
+            bool summarize; // Train on the weighted representatives of an ObservationSummary of the observations (approximate, but the cost of KMeans and EM no longer grows with N). Takes precedence over deduplicate.
+            double summaryCellSize; // Initial (finest) cell size of the summary if summarize is set, in the units of the observations given to Process. 0 = derived from their range (see ObservationSummary::CellSizeFor).
+            size_t summaryMaxBins; // Max number of representatives in the summary if summarize is set
+            ResponsibilityStorage responsibilityStorage; // How EM stores the responsibilities (None needs no memory per observation, see ResponsibilityStorage)
+        };
+
+        /// <summary> Gaussian Mixture Model of Dims-dimensional observations. Small dimensions (2 to 8) use fixed-size Eigen types, so that all
+        ///           per-observation math is unrolled; Dims = Eigen::Dynamic is a fallback for long feature vectors (e.g. 32 to 128 dimensions),
+        ///           whose size is given at construction. The means and covariances of the modes (and the observations) are stored with the
+        ///           given scalar type, while weights, likelihoods and all accumulations are computed in double. The library is instantiated
+        ///           for Dims in [2, 8] and Eigen::Dynamic, with double and float. </summary>
+        template <int Dims, typename Scalar = double>
+        class GMM {
         public:
-            typedef std::shared_ptr<GMM3D> SP;
-            typedef GaussianDistribution3D::SP mode_type;
+            typedef std::shared_ptr<GMM<Dims, Scalar>> SP;
+            typedef Eigen::Matrix<Scalar, Dims, 1> VecType;
+            typedef Eigen::Matrix<Scalar, Dims, Dims> MatType;
+            typedef GaussianDistribution<VecType, MatType, Dims> ModeType;
+            typedef typename ModeType::SP mode_type;
 
             /// <summary> Constructor. </summary>
             /// <remarks> Alcollet, 7/17/2013. </remarks>
             /// <param name="numModes"> Number of modes (Gaussians) in GMM. </param>
-            GMM3D(int numModes);
-            GMM3D(const GMM3D& rhs);
+            /// <param name="dimensions"> [optional] Number of dimensions of the observations. Only needed if Dims is Eigen::Dynamic. </param>
+            GMM(int numModes, int dimensions = Dims);
+            GMM(const GMM<Dims, Scalar>& rhs);
 
-            /// <summary> Compute a GMM from a given set of observations. The GMM is initialized using k-means, and then we use EM to train the full-covariance GMMs. </summary>
+            /// <summary> Compute a GMM from a given set of observations. The GMM is initialized using k-means (with random seeding), and then we
+            ///           use EM to train the GMM with the current covariance type (see setCovarianceType). </summary>
             /// <param name="observations"> The observations. </param>
             /// <param name="numKMeansRestarts"> [optional] Number of restarts in KMeans initialization. </param>
             /// <param name="scalingFactors"> [optional] Scaling factor for each observation. Useful if the observations have been whitened (so that the output GMM will still be unwhitened). </param>
             /// <param name="EMTolerance"> [optional] Stopping condition in EM. If ratio of new vs old log likelihoods is lower than tolerance, finish process.  </param>
             /// <param name="EMMaxIterations"> [optional] Max number of iterations of EM. If we do not get under the EM tolerance in MaxIterations, we give up. </param>
+            /// <param name="numThreads"> [optional] Number of threads used in the KMeans restarts and in EM (0 = all hardware threads). Results are identical for a given number of threads. </param>
             /// <returns> true if it succeeds, false if it fails. </returns>
-            bool Process(const std::vector<Vec3>& observations, 
+            bool Process(const std::vector<VecType>& observations, 
                 int numKMeansRestarts = c_KMeansRestarts, 
-                Vec3* scalingFactors = nullptr, 
+                VecType* scalingFactors = nullptr, 
                 double EMTolerance = c_EMDefaultTolerance, 
-                int EMMaxIterations = c_EMDefaultMaxIterations);
+                int EMMaxIterations = c_EMDefaultMaxIterations,
+                int numThreads = 1);
+
+            /// <summary> Compute a GMM from a given set of observations, as above, with the given training options. If options.warmStart is set,
+            ///           KMeans is skipped and EM starts from the current modes (given in the unwhitened space if scalingFactors is given). </summary>
+            /// <param name="observations"> The observations. </param>
+            /// <param name="options"> The training options (see TrainingOptions). </param>
+            /// <param name="scalingFactors"> [optional] Scaling factor for each observation. Useful if the observations have been whitened (so that the output GMM will still be unwhitened). </param>
+            /// <returns> true if it succeeds, false if it fails. </returns>
+            bool Process(const std::vector<VecType>& observations, const TrainingOptions& options, VecType* scalingFactors = nullptr);
+
+            /// <summary> Compute a GMM from a given set of weighted observations, as above. Each observation counts as 'weight' repeated observations
+            ///           in KMeans and EM (e.g., the distinct values and counts given by CountUniqueObservations), and the global weight is set to
+            ///           log(sum of weights). </summary>
+            /// <param name="observations"> The observations. </param>
+            /// <param name="weights"> The (positive) weight of each observation (or an empty vector for unit weights). </param>
+            /// <param name="options"> The training options (see TrainingOptions). </param>
+            /// <param name="scalingFactors"> [optional] Scaling factor for each observation. Useful if the observations have been whitened (so that the output GMM will still be unwhitened). </param>
+            /// <returns> true if it succeeds, false if it fails. </returns>
+            bool Process(const std::vector<VecType>& observations, const std::vector<double>& weights, const TrainingOptions& options, VecType* scalingFactors = nullptr);
+
+            /// <summary> Replace the modes whose weight fell to c_SafeMinWeight (i.e. modes that lost all their support, as left by EM or OnlineEM)
+            ///           with spherical modes centered at the worst explained observations, i.e. the ones with the lowest log likelihood under the
+            ///           remaining modes. Reseeded modes get the average variance of the remaining modes and weight 1/numModes, and all weights are
+            ///           renormalized to sum to one. </summary>
+            /// <param name="observations"> The observations. </param>
+            /// <param name="numThreads"> [optional] Number of threads used to evaluate the observations (0 = all hardware threads). </param>
+            /// <returns> The number of reseeded modes. </returns>
+            int ReseedWeakModes(const std::vector<VecType>& observations, int numThreads = 1);
 
             /// <summary> Compute the log likelihood of the mixture model for an observation x_n, such that: log P(x_n) = log ( sum_k ( p(x_n|k)*p(k) )) </summary>
             /// <param name="observation"> The observation. </param>
             /// <returns> The log likelihood of the mixture model for this observation </returns>
-            double LogLikelihood(const Vec3& observation);
+            double LogLikelihood(const VecType& observation) const;
 
             /// <summary> Compute the likelihood of the mixture model for an observation x_n, such that: P(x_n) = sum_k ( p(x_n|k)*p(k) ) </summary>
             /// <param name="observation"> The observation. </param>
             /// <returns> Likelihood of the mixture model for this observation </returns>
-            double Likelihood(const Vec3& observation);
+            double Likelihood(const VecType& observation) const;
 
             /// <summary> Compute the log likelihood of the mixture model for a set of observations, as: log P(X) = sum_{x_n in X} log P(x_n) </summary>
             /// <param name="observations"> The observations. </param>
             /// <returns> . </returns>
-            double LogLikelihood(const std::vector<Vec3>& observations);
+            double LogLikelihood(const std::vector<VecType>& observations) const;
+
+            /// <summary> Compute the log likelihood of the mixture model for a set of weighted observations, as: log P(X) = sum_{x_n in X} w_n * log P(x_n) </summary>
+            /// <param name="observations"> The observations. </param>
+            /// <param name="weights"> The weight of each observation (e.g., the number of times it is repeated). </param>
+            /// <returns> The weighted log likelihood. </returns>
+            double LogLikelihood(const std::vector<VecType>& observations, const std::vector<double>& weights) const;
 
             /// <summary> Compute the log responsibility log(p(k|x_n)) = log(p(x_n|k)) + log(P(k)) - log(p(x_n)). </summary>
             /// <param name="observation"> The observation x_n </param>
             /// <param name="idxMode"> The mode index k. </param>
             /// <returns> The log responsibility log(p(k|x_n)) </returns>
-            double LogResponsibility(const Vec3& observation, int idxMode);
+            double LogResponsibility(const VecType& observation, int idxMode) const;
 
             /// <summary> Compute closest mode for a given observation. </summary>
             /// <param name="observation"> The observation. </param>
             /// <param name="assignment">  [out] Index of the closest mode K to this observation. </param>
             /// <returns> The log probability that this observation was created from mode K in the GMM. </returns>
-            double ClosestMode(const Vec3& observation, int& mode) const;
+            double ClosestMode(const VecType& observation, int& mode) const;
+
+            /// <summary> Compute the log likelihood log P(x_n) of each observation in a batch. This function is const and does not use any shared
+            ///           mutable state, so the same GMM can be used to score from multiple threads concurrently. 3D GMMs are evaluated with the
+            ///           vectorized kernels of CompiledGMM3D; other dimensions evaluate each observation with LogLikelihood(). The GMM is compiled
+            ///           again in every call of the batch functions (a small allocation, O(numModes)): to score many small batches with the same
+            ///           model, e.g. on a latency-critical path, compile it once with CompiledGMM3D and call the batch functions of that one. </summary>
+            /// <param name="observations"> Pointer to the first of numObservations observations. </param>
+            /// <param name="numObservations"> Number of observations. </param>
+            /// <param name="logLikelihoods"> [out] numObservations-vector of log likelihoods. </param>
+            /// <param name="numThreads"> [optional] Number of threads to split the batch into (0 = all hardware threads). </param>
+            void LogLikelihoods(const VecType* observations, size_t numObservations, double* logLikelihoods, int numThreads = 1) const;
+
+            /// <summary> Compute the likelihood P(x_n) (see Likelihood()) of each observation in a batch. Const and thread-safe, see LogLikelihoods(). </summary>
+            /// <param name="observations"> Pointer to the first of numObservations observations. </param>
+            /// <param name="numObservations"> Number of observations. </param>
+            /// <param name="likelihoods"> [out] numObservations-vector of likelihoods. </param>
+            /// <param name="numThreads"> [optional] Number of threads to split the batch into (0 = all hardware threads). </param>
+            void Likelihoods(const VecType* observations, size_t numObservations, double* likelihoods, int numThreads = 1) const;
+
+            /// <summary> Compute the responsibilities p(k|x_n) of every mode for each observation in a batch. Const and thread-safe, see LogLikelihoods(). </summary>
+            /// <param name="observations"> Pointer to the first of numObservations observations. </param>
+            /// <param name="numObservations"> Number of observations. </param>
+            /// <param name="responsibilities"> [out] numObservations x numModes matrix (point-major), so that responsibilities[n * numModes + k] = p(k|x_n). </param>
+            /// <param name="numThreads"> [optional] Number of threads to split the batch into (0 = all hardware threads). </param>
+            void Responsibilities(const VecType* observations, size_t numObservations, double* responsibilities, int numThreads = 1) const;
+
+            /// <summary> Compute the closest mode (see ClosestMode()) of each observation in a batch. Const and thread-safe, see LogLikelihoods(). </summary>
+            /// <param name="observations"> Pointer to the first of numObservations observations. </param>
+            /// <param name="numObservations"> Number of observations. </param>
+            /// <param name="modes"> [out] numObservations-vector with the index of the closest mode to each observation. </param>
+            /// <param name="logProbabilities"> [out, optional] numObservations-vector with the log probability of each observation in its closest mode. Can be nullptr. </param>
+            /// <param name="numThreads"> [optional] Number of threads to split the batch into (0 = all hardware threads). </param>
+            void ClosestModes(const VecType* observations, size_t numObservations, int* modes, double* logProbabilities = nullptr, int numThreads = 1) const;
 
             /// <summary> Remove modes with weight less than some (small) tolerance. </summary> 
             /// <param name="tolerance"> Max weight to consider a mode as 'valid'. </param>
             /// <returns> The number of valid modes after removal </returns> 
             size_t RemoveBadModes(double tolerance);
 
-            std::vector<GaussianDistribution3D::SP>& Modes() { return m_modes; }
-            const std::vector<GaussianDistribution3D::SP>& Modes() const { return m_modes; }
+            std::vector<mode_type>& Modes() { return m_modes; }
+            const std::vector<mode_type>& Modes() const { return m_modes; }
 
-            GaussianDistribution3D::SP& Modes(int k) { _ASSERT(k < m_modes.size() && k >= 0 && L"Invalid index"); return m_modes[k]; }
-            const GaussianDistribution3D::SP& Modes(int k) const { _ASSERT(k < m_modes.size() && k >= 0 && L"Invalid index"); return m_modes[k]; }
+            mode_type& Modes(int k) { _ASSERT(k < m_modes.size() && k >= 0 && L"Invalid index"); return m_modes[k]; }
+            const mode_type& Modes(int k) const { _ASSERT(k < m_modes.size() && k >= 0 && L"Invalid index"); return m_modes[k]; }
 
-            double GlobalWeight() { return m_globalWeight; }
+            double GlobalWeight() const { return m_globalWeight; }
             void SetGlobalWeight(double w) { m_globalWeight = w; }
 
+            int Dimensions() const { return m_dimensions; }
+
+            /// <summary> Sets the structure of the covariance matrices of all modes (Full by default). Diagonal and spherical modes are evaluated
+            ///           and trained in O(Dims) per observation instead of O(Dims^2). Tied modes are evaluated as full ones, but EM estimates
+            ///           a single covariance matrix pooled over all modes. Each tied mode keeps its own copy of it, so that it can be evaluated on
+            ///           its own, but CompiledGMM3D stores their precision only once. The current covariances are projected onto the new structure
+            ///           (tied modes get the weighted average of the current covariances). </summary>
+            void setCovarianceType(CovarianceType type);
+            CovarianceType covarianceType() const { return m_covarianceType; }
+
         private:
-            std::vector<GaussianDistribution3D::SP> m_modes; // k-Vector containing the multiple Gaussians
-            std::vector<double> m_tmpLogLikelihoods; // k-Vector (temporary) to store the log likelihoods for each Gaussian
-            std::vector<double> m_tmpLogWeights; // k-Vector (temporary) to store the LogWeights for each Gaussian
+            std::vector<mode_type> m_modes; // k-Vector containing the multiple Gaussians
             double m_globalWeight; // Total weight for this GMM distribution (by default, = 1)
+            int m_dimensions; // Number of dimensions of the observations
+            CovarianceType m_covarianceType; // Structure of the covariance matrices of all modes
         };
+        template <typename Scalar>
+        using GMM3DT = GMM<3, Scalar>;
+        typedef GMM<3, double> GMM3D;
+        typedef GMM<3, float> GMM3Df;
+        typedef GMM<Eigen::Dynamic, double> GMMXD;
+        typedef GMM<Eigen::Dynamic, float> GMMXDf;
 
         /// <summary> Compute log( sum_n( x1_n * x2_n )) from vectors of logValues1 and logValues2, where logValuesK[n] = log(xK_n).
         ///           We use the log-sum-exp trick to avoid underflow: log( sum_n( x1_n * x2_n )) = log( sum_n( exp( log x1_n + log x2_n ))) = 
         ///           = log(x1_MAX) + log(x2_MAX) + log( sum_n( exp( log(x1_n) - log(x1_MAX) + log(x2_n) - log(x2_MAX))) </summary>
         /// <param name="logValues1"> The first vector of log values. </param>
         /// <param name="logValues2"> The second vector of log values. </param>
+        /// <param name="precision"> [optional] Precision of exp() and log() (see EvaluationPrecision). </param>
         /// <returns> log( sum_n( x1_n * x2_n )) </returns>
-        double LogSumExp(const std::vector<double>& logValues1, const std::vector<double>& logValues2);
+        double LogSumExp(const std::vector<double>& logValues1, const std::vector<double>& logValues2, EvaluationPrecision precision = EvaluationPrecision::Exact);
 
         /// <summary> Compute the probability of 'observation' to be a sample of gmm1 or gmm2. </summary>
         /// <param name="gmm1">        [in] The first gmm. </param>
         /// <param name="gmm2">        [in] The second gmm. </param>
         /// <param name="observation"> [in] The observation. </param>
-        /// <returns> The probability of 'observation' to be a sample of gmm1, i.e., p(obs|gmm1) / (p(obs|gmm1)+p(obs|gmm2))</returns>
-        double GMMLikelihoodRatio(GMM3D& gmm1, GMM3D& gmm2, const Vec3& observation);
+        /// <returns> The probability of 'observation' to be a sample of gmm1, i.e., p(obs|gmm1) / (p(obs|gmm1)+p(obs|gmm2)), computed in the log domain.
+        ///           To evaluate whole images, see ProbabilityMap() in probability_map.h. </returns>
+        template <int Dims, typename Scalar>
+        double GMMLikelihoodRatio(const GMM<Dims, Scalar>& gmm1, const GMM<Dims, Scalar>& gmm2, const typename GMM<Dims, Scalar>::VecType& observation);
     }
 }
 
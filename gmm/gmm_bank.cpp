@@ -0,0 +1,165 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <cstdio>
+#include <cstring>
+#include "gmm_bank.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(AC::GMM::GMMFileHeader) == 64, "GMMFileHeader must be 64 bytes");
+
+// Local helper functions
+namespace
+{
+    const char c_GMMFileMagic[8] = "ACGMMBK";
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::GMMFileHeader AC::GMM::MakeGMMFileHeader(uint32_t dimensions, uint32_t scalarSize, uint32_t maxModes, uint32_t recordSize, uint64_t numModels)
+{
+    GMMFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, c_GMMFileMagic, sizeof(header.magic));
+    header.version = c_GMMFileVersion;
+    header.byteOrder = c_GMMFileByteOrder;
+    header.dimensions = dimensions;
+    header.scalarSize = scalarSize;
+    header.maxModes = maxModes;
+    header.recordSize = recordSize;
+    header.numModels = numModels;
+    return header;
+}
+
+//----------------------------------------------------------------------------
+bool AC::GMM::IsCompatibleGMMFileHeader(const GMMFileHeader& header, const GMMFileHeader& expected)
+{
+    return memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+        && header.version == expected.version
+        && header.byteOrder == expected.byteOrder
+        && header.dimensions == expected.dimensions
+        && header.scalarSize == expected.scalarSize
+        && header.maxModes == expected.maxModes
+        && header.recordSize == expected.recordSize;
+}
+
+//----------------------------------------------------------------------------
+bool AC::GMM::WriteGMMFile(const std::string& path, const GMMFileHeader& header, const void* records, size_t recordsSize)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (success && recordsSize > 0)
+        success = fwrite(records, recordsSize, 1, file) == 1;
+    return fclose(file) == 0 && success;
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::MappedFile::MappedFile()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_handle(nullptr)
+{
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::MappedFile::~MappedFile()
+{
+    Close();
+}
+
+//----------------------------------------------------------------------------
+bool AC::GMM::MappedFile::Open(const std::string& path)
+{
+    Close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    // The mapping keeps its own reference to the file
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr)
+        return false;
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+    m_handle = mapping;
+    m_size = (size_t)size.QuadPart;
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        close(file);
+        return false;
+    }
+    // The mapping keeps its own reference to the file
+    void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+    m_size = (size_t)info.st_size;
+#endif
+    m_data = static_cast<const uint8_t*>(data);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::MappedFile::Close()
+{
+    if (m_data == nullptr)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+    CloseHandle(static_cast<HANDLE>(m_handle));
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_handle = nullptr;
+}
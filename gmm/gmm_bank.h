@@ -0,0 +1,150 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __GMM_BANK_H__
+#define __GMM_BANK_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "fixed_gmm.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        const uint32_t c_GMMFileVersion = 1; // Version of the binary format of GMMFileHeader and the records. Files of other versions are rejected.
+        const uint32_t c_GMMFileByteOrder = 0x01020304; // Written in native byte order, to reject files written on a machine with another endianness
+
+        /// <summary> Header of a binary GMM file (a single mixture or a bank of mixtures). The header is followed by numModels records of
+        ///           recordSize bytes, each one the raw bytes of a FixedGMM<maxModes, dimensions, Scalar>, i.e., the means, the inverse
+        ///           covariance factors and the log norm factors and log weights of its modes, ready to evaluate. The header is 64 bytes, so
+        ///           the records of a memory-mapped file are aligned. </summary>
+        struct GMMFileHeader {
+            char magic[8];        // "ACGMMBK" (with the terminating 0)
+            uint32_t version;     // c_GMMFileVersion
+            uint32_t byteOrder;   // c_GMMFileByteOrder
+            uint32_t dimensions;  // Dims of the FixedGMM records
+            uint32_t scalarSize;  // sizeof(Scalar) of the FixedGMM records
+            uint32_t maxModes;    // MaxModes of the FixedGMM records
+            uint32_t recordSize;  // sizeof(FixedGMM<maxModes, dimensions, Scalar>)
+            uint64_t numModels;   // Number of records
+            uint8_t reserved[24]; // Zero
+        };
+
+        /// <summary> Make the header of a file with the given record layout and number of records. </summary>
+        GMMFileHeader MakeGMMFileHeader(uint32_t dimensions, uint32_t scalarSize, uint32_t maxModes, uint32_t recordSize, uint64_t numModels);
+
+        /// <summary> Check that a header read from a file is valid and has the expected record layout (everything but numModels). </summary>
+        bool IsCompatibleGMMFileHeader(const GMMFileHeader& header, const GMMFileHeader& expected);
+
+        /// <summary> Write a header and its records to a file. </summary>
+        /// <returns> true if it succeeds, false if the file could not be written. </returns>
+        bool WriteGMMFile(const std::string& path, const GMMFileHeader& header, const void* records, size_t recordsSize);
+
+        /// <summary> Read-only memory mapping of a whole file. The pages are loaded on demand by the OS, and shared by all the processes
+        ///           mapping the same file. </summary>
+        class MappedFile {
+        public:
+            MappedFile();
+            ~MappedFile();
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            /// <summary> Map a file (closing the current one, if any). </summary>
+            /// <returns> true if it succeeds, false if the file could not be opened or mapped. </returns>
+            bool Open(const std::string& path);
+            void Close();
+
+            bool IsOpen() const { return m_data != nullptr; }
+            const uint8_t* Data() const { return m_data; }
+            size_t Size() const { return m_size; }
+
+        private:
+            const uint8_t* m_data; // Start of the mapping
+            size_t m_size; // Size of the file in bytes
+            void* m_handle; // Handle of the file mapping (Windows only)
+        };
+
+        /// <summary> Save a single mixture (a file with one record, see GMMFileHeader). To save a GMM, copy it first with FixedGMM::FromGMM. </summary>
+        /// <returns> true if it succeeds, false if the file could not be written. </returns>
+        template <int MaxModes, int Dims, typename Scalar>
+        bool SaveFixedGMM(const std::string& path, const FixedGMM<MaxModes, Dims, Scalar>& gmm);
+
+        /// <summary> Load a single mixture saved with SaveFixedGMM (or the first model of a bank), which must have the same MaxModes, Dims
+        ///           and Scalar. Use ToGMM() on the result to get a GMM. </summary>
+        /// <returns> true if it succeeds, false if the file could not be read or has another version or layout. </returns>
+        template <int MaxModes, int Dims, typename Scalar>
+        bool LoadFixedGMM(const std::string& path, FixedGMM<MaxModes, Dims, Scalar>& gmm);
+
+        /// <summary> Save a bank of mixtures, to open with GMMBank. </summary>
+        /// <returns> true if it succeeds, false if the file could not be written. </returns>
+        template <int MaxModes, int Dims, typename Scalar>
+        bool SaveGMMBank(const std::string& path, const FixedGMM<MaxModes, Dims, Scalar>* models, size_t numModels);
+        template <int MaxModes, int Dims, typename Scalar>
+        bool SaveGMMBank(const std::string& path, const std::vector<FixedGMM<MaxModes, Dims, Scalar>>& models);
+
+        /// <summary> Read-only bank of mixtures (e.g. one per camera or per object), memory-mapped from a file saved with SaveGMMBank. Opening
+        ///           a bank only maps the file and checks its header; the models are not deserialized, but evaluated in place (Model(i) is
+        ///           a reference into the mapping), so opening is almost free and only the pages of the models in use are ever read. All
+        ///           functions are const and thread-safe. Only the header is validated, so bank files must come from a trusted source. </summary>
+        template <int MaxModes, int Dims = 3, typename Scalar = double>
+        class GMMBank {
+        public:
+            typedef FixedGMM<MaxModes, Dims, Scalar> ModelType;
+            typedef typename ModelType::VecType VecType;
+
+            GMMBank();
+
+            /// <summary> Map a bank file. The file must not be modified while it is open. </summary>
+            /// <returns> true if it succeeds, false if the file could not be mapped, or has another version or layout, or is truncated. </returns>
+            bool Open(const std::string& path);
+            void Close();
+
+            bool IsOpen() const { return m_file.IsOpen(); }
+            size_t NumModels() const { return m_numModels; }
+            const ModelType& Model(size_t i) const { _ASSERT(i < m_numModels && L"Invalid index"); return m_models[i]; }
+
+            /// <summary> Compute the log likelihood of model i for an observation (see FixedGMM::LogLikelihood). </summary>
+            double LogLikelihood(size_t i, const VecType& observation) const { return Model(i).LogLikelihood(observation); }
+
+        private:
+            MappedFile m_file;
+            const ModelType* m_models; // Records in the mapping
+            size_t m_numModels;
+        };
+
+        template <int MaxModes>
+        using GMMBank3D = GMMBank<MaxModes, 3, double>;
+        template <int MaxModes>
+        using GMMBank3Df = GMMBank<MaxModes, 3, float>;
+    }
+}
+
+#include "gmm_bank.inl"
+
+#endif
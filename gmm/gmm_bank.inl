@@ -0,0 +1,101 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+bool AC::GMM::SaveFixedGMM(const std::string& path, const FixedGMM<MaxModes, Dims, Scalar>& gmm)
+{
+    return SaveGMMBank(path, &gmm, 1);
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+bool AC::GMM::LoadFixedGMM(const std::string& path, FixedGMM<MaxModes, Dims, Scalar>& gmm)
+{
+    GMMBank<MaxModes, Dims, Scalar> bank;
+    if (!bank.Open(path) || bank.NumModels() == 0)
+        return false;
+    gmm = bank.Model(0);
+    return true;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+bool AC::GMM::SaveGMMBank(const std::string& path, const FixedGMM<MaxModes, Dims, Scalar>* models, size_t numModels)
+{
+    typedef FixedGMM<MaxModes, Dims, Scalar> ModelType;
+    GMMFileHeader header = MakeGMMFileHeader(Dims, sizeof(Scalar), MaxModes, sizeof(ModelType), numModels);
+    return WriteGMMFile(path, header, models, numModels * sizeof(ModelType));
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+bool AC::GMM::SaveGMMBank(const std::string& path, const std::vector<FixedGMM<MaxModes, Dims, Scalar>>& models)
+{
+    return SaveGMMBank(path, models.data(), models.size());
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+AC::GMM::GMMBank<MaxModes, Dims, Scalar>::GMMBank()
+    : m_models(nullptr)
+    , m_numModels(0)
+{
+    static_assert(sizeof(GMMFileHeader) % alignof(ModelType) == 0, "The records of a mapped bank must be aligned");
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+bool AC::GMM::GMMBank<MaxModes, Dims, Scalar>::Open(const std::string& path)
+{
+    Close();
+    if (!m_file.Open(path))
+        return false;
+
+    // Check the header, and that the file holds all the records it announces
+    GMMFileHeader expected = MakeGMMFileHeader(Dims, sizeof(Scalar), MaxModes, sizeof(ModelType), 0);
+    const GMMFileHeader* header = reinterpret_cast<const GMMFileHeader*>(m_file.Data());
+    if (m_file.Size() < sizeof(GMMFileHeader) || !IsCompatibleGMMFileHeader(*header, expected) ||
+        header->numModels > (m_file.Size() - sizeof(GMMFileHeader)) / sizeof(ModelType)) {
+        Close();
+        return false;
+    }
+
+    // The mapping is page-aligned and the header is 64 bytes, so the records are aligned and can be used in place
+    m_models = reinterpret_cast<const ModelType*>(m_file.Data() + sizeof(GMMFileHeader));
+    m_numModels = (size_t)header->numModels;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+template <int MaxModes, int Dims, typename Scalar>
+void AC::GMM::GMMBank<MaxModes, Dims, Scalar>::Close()
+{
+    m_file.Close();
+    m_models = nullptr;
+    m_numModels = 0;
+}
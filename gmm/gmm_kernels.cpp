@@ -0,0 +1,177 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include "gmm_kernels.h"
+
+#if defined(AC_GMM_KERNELS_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//----------------------------------------------------------------------------
+// Scalar kernels (one double per "pack")
+namespace AC { namespace GMM { namespace Kernels { namespace ScalarImpl {
+    typedef double Pack;
+    const int c_PackWidth = 1;
+    inline Pack LoadPack(const double* p) { return *p; }
+    inline void StorePack(double* p, Pack a) { *p = a; }
+    inline Pack SetPack(double x) { return x; }
+    inline Pack AddPack(Pack a, Pack b) { return a + b; }
+    inline Pack SubPack(Pack a, Pack b) { return a - b; }
+    inline Pack MulPack(Pack a, Pack b) { return a * b; }
+    inline Pack MulAddPack(Pack a, Pack b, Pack c) { return a * b + c; }
+    inline Pack MaxPack(Pack a, Pack b) { return a > b ? a : b; }
+    inline Pack MinPack(Pack a, Pack b) { return a < b ? a : b; }
+    inline Pack DivPack(Pack a, Pack b) { return a / b; }
+    inline Pack SelectGreaterPack(Pack a, Pack b, Pack x, Pack y) { return a > b ? x : y; }
+    inline unsigned long long BitsOf(double x) { unsigned long long bits; memcpy(&bits, &x, sizeof(bits)); return bits; }
+    inline double DoubleOf(unsigned long long bits) { double x; memcpy(&x, &bits, sizeof(x)); return x; }
+    inline Pack Pow2Pack(Pack t) { return DoubleOf(BitsOf(t) << 52); }
+    inline Pack ExponentPack(Pack x) { return (double)(BitsOf(x) >> 52); }
+    inline Pack MantissaPack(Pack x) { return DoubleOf((BitsOf(x) & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull); }
+
+#include "gmm_kernels.inl"
+}}}}
+
+// Local helper functions
+namespace
+{
+    using namespace AC::GMM::Kernels;
+
+#if defined(AC_GMM_KERNELS_X86)
+    //----------------------------------------------------------------------------
+    void CpuId(int leaf, int subleaf, unsigned int info[4])
+    {
+#if defined(_MSC_VER)
+        __cpuidex(reinterpret_cast<int*>(info), leaf, subleaf);
+#else
+        __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+    }
+
+    //----------------------------------------------------------------------------
+    // Register state enabled by the OS (XCR0). AVX needs the OS to save the YMM registers on context switches, and AVX-512 also the ZMM/opmask registers.
+    unsigned long long EnabledRegisterState()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((unsigned long long)edx << 32) | eax;
+#endif
+    }
+#endif
+
+    //----------------------------------------------------------------------------
+    InstructionSet QueryInstructionSet()
+    {
+#if defined(AC_GMM_KERNELS_X86)
+        unsigned int info[4];
+        CpuId(0, 0, info);
+        int maxLeaf = (int)info[0];
+        if (maxLeaf < 1)
+            return Scalar;
+
+        CpuId(1, 0, info);
+        bool hasSSE42 = (info[2] & (1u << 20)) != 0;
+        bool hasFMA = (info[2] & (1u << 12)) != 0;
+        bool hasOSXSave = (info[2] & (1u << 27)) != 0;
+        bool hasAVX = (info[2] & (1u << 28)) != 0;
+        if (!hasSSE42)
+            return Scalar;
+        if (!hasOSXSave || !hasAVX || !hasFMA || maxLeaf < 7)
+            return SSE42;
+
+        unsigned long long registerState = EnabledRegisterState();
+        if ((registerState & 0x6) != 0x6) // XMM and YMM state
+            return SSE42;
+
+        CpuId(7, 0, info);
+        bool hasAVX2 = (info[1] & (1u << 5)) != 0;
+        bool hasAVX512F = (info[1] & (1u << 16)) != 0;
+        if (!hasAVX2)
+            return SSE42;
+#if defined(AC_GMM_KERNELS_AVX512)
+        if (hasAVX512F && (registerState & 0xE6) == 0xE6) // XMM, YMM, opmask and ZMM state
+            return AVX512;
+#endif
+        return AVX2;
+#else
+        return Scalar;
+#endif
+    }
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::Kernels::InstructionSet AC::GMM::Kernels::DetectInstructionSet()
+{
+    static const InstructionSet instructionSet = QueryInstructionSet();
+    return instructionSet;
+}
+
+//----------------------------------------------------------------------------
+const AC::GMM::Kernels::KernelTable& AC::GMM::Kernels::GetKernels(InstructionSet maxInstructionSet)
+{
+    InstructionSet instructionSet = std::min(maxInstructionSet, DetectInstructionSet());
+#if defined(AC_GMM_KERNELS_AVX512)
+    if (instructionSet >= AVX512)
+        return AVX512Kernels();
+#endif
+#if defined(AC_GMM_KERNELS_X86)
+    if (instructionSet >= AVX2)
+        return AVX2Kernels();
+    if (instructionSet >= SSE42)
+        return SSE42Kernels();
+#endif
+    return ScalarKernels();
+}
+
+//----------------------------------------------------------------------------
+const AC::GMM::Kernels::KernelTable& AC::GMM::Kernels::ScalarKernels()
+{
+    return ScalarImpl::MakeKernelTable(Scalar);
+}
+
+//----------------------------------------------------------------------------
+double AC::GMM::Kernels::FastExp(double x)
+{
+    return ScalarImpl::ExpPack(x);
+}
+
+//----------------------------------------------------------------------------
+double AC::GMM::Kernels::FastLog(double x)
+{
+    return ScalarImpl::LogPack(x);
+}
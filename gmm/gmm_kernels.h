@@ -0,0 +1,152 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __GMM_KERNELS_H__
+#define __GMM_KERNELS_H__
+
+// This header must stay free of Eigen and other template-heavy includes: it is included by translation units compiled for
+// specific instruction sets (see gmm_kernels_*.cpp), which must not emit inline code that could be shared with the rest of the program.
+
+// Instruction sets that we can generate kernels for in this compiler/platform
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define AC_GMM_KERNELS_X86
+#if defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1911)
+#define AC_GMM_KERNELS_AVX512
+#endif
+#endif
+
+namespace AC
+{
+    namespace GMM
+    {
+        const int c_CompiledModeAlignment = 8; // The number of modes in a compiled GMM is padded to a multiple of this (a full cache line of doubles)
+        const int c_CompiledBlockSize = 64; // Number of observations evaluated together by the kernels. Must be a multiple of the widest SIMD register (8 doubles).
+
+        // Terms of a log-sum-exp that are this far below the maximum term are skipped (their exp() is never evaluated). exp(-45) < 2^-53 / 1900, so
+        // the sum, which includes the maximum term exp(0) = 1, does not change at double precision unless there are more than ~1900 skipped terms.
+        const double c_LogSumExpFlushThreshold = -45.0;
+
+        /// <summary> Precision of exp() and log() when evaluating likelihoods. </summary>
+        enum class EvaluationPrecision {
+            Exact, // C library exp() and log() (default)
+            Fast   // Vectorized polynomial approximations. Max relative error: 5e-16 for exp() (|x| < 708) and 1e-15 for log() (see Kernels::FastExp and Kernels::FastLog)
+        };
+
+        /// <summary> Non-owning, read-only view of the parameters of a compiled GMM (see CompiledGMM3D). All parameters live in a single contiguous
+        ///           array of doubles, stored as a structure of arrays of 'stride' entries each (numModes rounded up to c_CompiledModeAlignment),
+        ///           except for the precision arrays of tied GMMs, which hold a single entry shared by all modes (see sharedPrecision).
+        ///           The padding modes are inert: their log constant is -DBL_MAX, so they never contribute to a likelihood. </summary>
+        struct CompiledGMMData
+        {
+            enum Array {
+                MeanX = 0, MeanY, MeanZ, // Mean of each mode
+                LogConstant, // log(normalization factor) + log(weight) of each mode
+                LogNormFactor, // log(normalization factor) of each mode
+                Precision00, Precision01, Precision02, Precision11, Precision12, Precision22, // Upper triangle of inv(Cov). Off-diagonal terms are pre-multiplied by 2.
+                c_NumArrays
+            };
+
+            const double* data; // Precision00 * stride + (c_NumArrays - Precision00) * PrecisionStride() doubles
+            int numModes;       // Number of (valid) modes
+            int stride;         // Number of entries per array (numModes padded to c_CompiledModeAlignment)
+            bool sharedPrecision; // All modes have the same inv(Cov) (CovarianceType::Tied), stored once
+            double globalWeight; // Global weight of the GMM (see GMM3D::GlobalWeight())
+
+            int PrecisionStride() const { return sharedPrecision ? 1 : stride; }
+            const double* Array(int idxArray) const {
+                return idxArray < Precision00 ? data + idxArray * stride : data + Precision00 * stride + (idxArray - Precision00) * PrecisionStride();
+            }
+
+            /// <summary> Entry of the precision array idxArray (Precision00 to Precision22) for mode k. </summary>
+            double Precision(int idxArray, int k) const { return Array(idxArray)[sharedPrecision ? 0 : k]; }
+
+            /// <summary> Number of doubles of a compiled GMM with the given number of entries per array. </summary>
+            static size_t Size(int stride, bool sharedPrecision) { return (size_t)Precision00 * stride + (size_t)(c_NumArrays - Precision00) * (sharedPrecision ? 1 : stride); }
+        };
+
+        namespace Kernels
+        {
+            /// <summary> Instruction sets with a specialized implementation of the kernels, from slowest to fastest. </summary>
+            enum InstructionSet {
+                Scalar = 0, // Plain C++ (any CPU)
+                SSE42,      // 2 doubles per instruction
+                AVX2,       // 4 doubles per instruction, with FMA
+                AVX512      // 8 doubles per instruction (AVX-512F)
+            };
+
+            /// <summary> Kernels that evaluate a block of (at most c_CompiledBlockSize) observations against all modes of a compiled GMM.
+            ///           The observations are given in structure-of-arrays form (xs, ys, zs), and all arrays indexed by observation
+            ///           must have room for c_CompiledBlockSize entries. Log terms are stored mode-major: logTerms[k * c_CompiledBlockSize + i]. </summary>
+            struct KernelTable
+            {
+                InstructionSet instructionSet;
+
+                /// <summary> logTerms[k][i] = constants[k] - 0.5 * (x_i - mu_k)^T * inv(Cov_k) * (x_i - mu_k), and maxLogTerms[i] = max_k(logTerms[k][i]). </summary>
+                void(*evaluateLogTerms)(const CompiledGMMData& gmm, const double* constants, const double* xs, const double* ys, const double* zs,
+                    int numObservations, double* logTerms, double* maxLogTerms);
+
+                /// <summary> logTerms[k][i] = exp(logTerms[k][i] - maxLogTerms[i]), and sums[i] = sum_k(logTerms[k][i]) (the log-sum-exp trick), using the
+                ///           C library exp(). If flushNegligibleTerms is true, terms below c_LogSumExpFlushThreshold are set to 0 without evaluating exp()
+                ///           (the sums are still exact, but the individual terms are not). </summary>
+                void(*exponentiateLogTerms)(int numModes, int numObservations, const double* maxLogTerms, double* logTerms, double* sums, bool flushNegligibleTerms);
+
+                /// <summary> Same as exponentiateLogTerms, with the vectorized FastExp() approximation. Negligible terms are always flushed to 0. </summary>
+                void(*fastExponentiateLogTerms)(int numModes, int numObservations, const double* maxLogTerms, double* logTerms, double* sums);
+
+                /// <summary> values[i] = FastLog(values[i]) for i in [0, numValues). The values must be positive, and the array must have room for
+                ///           c_CompiledBlockSize entries (entries past numValues may be overwritten). </summary>
+                void(*fastLog)(int numValues, double* values);
+            };
+
+            /// <summary> Detect the fastest instruction set supported by this CPU (and OS), via CPUID. The result is computed once and cached. </summary>
+            InstructionSet DetectInstructionSet();
+
+            /// <summary> Return the kernels for the fastest instruction set supported by this CPU that is not faster than maxInstructionSet. </summary>
+            /// <param name="maxInstructionSet"> [optional] The fastest instruction set we allow (e.g., to compare against the scalar path). </param>
+            const KernelTable& GetKernels(InstructionSet maxInstructionSet = AVX512);
+
+            /// <summary> Polynomial approximation of exp(x), with range reduction x = n*log(2) + r. Relative error below 5e-16 for |x| < 708 (measured: 2.3e-16).
+            ///           Arguments outside [-708, 709] are clamped (i.e., there is no underflow to 0 or overflow to infinity). </summary>
+            double FastExp(double x);
+
+            /// <summary> Polynomial approximation of log(x) for positive, normal x, with range reduction x = 2^e * m. Relative error below 1e-15 (measured: 4.5e-16). </summary>
+            double FastLog(double x);
+
+            // Kernels for each instruction set (implemented in gmm_kernels_*.cpp). Only call them if the CPU supports them!
+            const KernelTable& ScalarKernels();
+#ifdef AC_GMM_KERNELS_X86
+            const KernelTable& SSE42Kernels();
+            const KernelTable& AVX2Kernels();
+#endif
+#ifdef AC_GMM_KERNELS_AVX512
+            const KernelTable& AVX512Kernels();
+#endif
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,186 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+// Generic implementation of the GMM kernels declared in gmm_kernels.h. This file is included by each gmm_kernels_*.cpp inside its own
+// namespace, after defining the SIMD pack type for its instruction set:
+//   Pack                  SIMD register of c_PackWidth doubles
+//   LoadPack(p)           Load c_PackWidth doubles (unaligned)
+//   StorePack(p, a)       Store c_PackWidth doubles (unaligned)
+//   SetPack(x)            Broadcast a double
+//   AddPack(a, b), SubPack(a, b), MulPack(a, b)
+//   MulAddPack(a, b, c)   a * b + c (fused, if available)
+//   MaxPack(a, b)         a > b ? a : b (per lane, returning b if a is NaN)
+//   MinPack(a, b)         a < b ? a : b (per lane, returning b if a is NaN)
+//   DivPack(a, b)         a / b
+//   SelectGreaterPack(a, b, x, y)  a > b ? x : y (per lane)
+//   Pow2Pack(t)           Reinterpret the low 11 bits of the mantissa of t as the biased exponent of a double, i.e. 2^(bits(t) - 1023)
+//   ExponentPack(x)       Biased exponent of x (as a double)
+//   MantissaPack(x)       Mantissa of x, scaled to [1, 2)
+
+// Polynomial coefficients of exp(r) (Taylor series, 1/n!) and of log((1+s)/(1-s)) = 2*atanh(s) (2/(2n+1)), from highest to lowest degree
+const double c_ExpCoefficients[] = { 1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0,
+    1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0 };
+const double c_LogCoefficients[] = { 2.0 / 21.0, 2.0 / 19.0, 2.0 / 17.0, 2.0 / 15.0, 2.0 / 13.0, 2.0 / 11.0, 2.0 / 9.0, 2.0 / 7.0, 2.0 / 5.0, 2.0 / 3.0, 2.0 };
+const double c_Log2E = 1.44269504088896338700e+00;
+const double c_Ln2Hi = 6.93147180369123816490e-01; // log(2) split in two, so that n * c_Ln2Hi is exact for |n| < 2^11 (Cody-Waite)
+const double c_Ln2Lo = 1.90821492927058770002e-10;
+const double c_RoundingMagic = 6755399441055744.0; // 1.5 * 2^52: x + magic - magic rounds x to the nearest integer (for |x| < 2^51)
+
+//----------------------------------------------------------------------------
+// exp(x) with x = n * log(2) + r, |r| <= log(2) / 2. The degree-13 polynomial has a truncation error below 2e-17 in that range.
+// x is clamped to [-708, 709], so that 2^n is always a normal double.
+inline Pack ExpPack(Pack x)
+{
+    x = MinPack(MaxPack(x, SetPack(-708.0)), SetPack(709.0));
+    // t holds round(x / log(2)) + 1023 (the biased exponent of 2^n) in the low bits of its mantissa
+    Pack t = MulAddPack(x, SetPack(c_Log2E), SetPack(c_RoundingMagic + 1023.0));
+    Pack n = SubPack(t, SetPack(c_RoundingMagic + 1023.0));
+    Pack r = MulAddPack(n, SetPack(-c_Ln2Lo), MulAddPack(n, SetPack(-c_Ln2Hi), x));
+    Pack p = SetPack(c_ExpCoefficients[0]);
+    for (int i = 1; i < (int)(sizeof(c_ExpCoefficients) / sizeof(double)); ++i)
+        p = MulAddPack(p, r, SetPack(c_ExpCoefficients[i]));
+    return MulPack(p, Pow2Pack(t));
+}
+
+//----------------------------------------------------------------------------
+// log(x) with x = 2^e * m, m in [sqrt(1/2), sqrt(2)), and log(m) = 2*atanh(s), s = (m - 1) / (m + 1), |s| < 0.172. The series up to s^21
+// has a truncation error below 1e-18 in that range. x must be positive and normal (no checks for 0, infinity, NaN or denormals).
+inline Pack LogPack(Pack x)
+{
+    Pack m = MantissaPack(x);
+    Pack e = SubPack(ExponentPack(x), SetPack(1023.0));
+    Pack sqrt2 = SetPack(1.41421356237309504880);
+    e = SelectGreaterPack(m, sqrt2, AddPack(e, SetPack(1.0)), e);
+    m = SelectGreaterPack(m, sqrt2, MulPack(m, SetPack(0.5)), m);
+    Pack one = SetPack(1.0);
+    Pack s = DivPack(SubPack(m, one), AddPack(m, one));
+    Pack s2 = MulPack(s, s);
+    Pack p = SetPack(c_LogCoefficients[0]);
+    for (int i = 1; i < (int)(sizeof(c_LogCoefficients) / sizeof(double)); ++i)
+        p = MulAddPack(p, s2, SetPack(c_LogCoefficients[i]));
+    return MulAddPack(e, SetPack(c_Ln2Hi), MulAddPack(e, SetPack(c_Ln2Lo), MulPack(p, s)));
+}
+
+//----------------------------------------------------------------------------
+inline void EvaluateLogTerms(const CompiledGMMData& gmm, const double* constants, const double* xs, const double* ys, const double* zs,
+    int numObservations, double* logTerms, double* maxLogTerms)
+{
+    int numPadded = (numObservations + c_PackWidth - 1) / c_PackWidth * c_PackWidth;
+    Pack minValue = SetPack(-DBL_MAX);
+    for (int i = 0; i < numPadded; i += c_PackWidth)
+        StorePack(maxLogTerms + i, minValue);
+
+    Pack minusHalf = SetPack(-0.5);
+    for (int k = 0; k < gmm.numModes; ++k) {
+        Pack mx = SetPack(gmm.Array(CompiledGMMData::MeanX)[k]);
+        Pack my = SetPack(gmm.Array(CompiledGMMData::MeanY)[k]);
+        Pack mz = SetPack(gmm.Array(CompiledGMMData::MeanZ)[k]);
+        Pack p00 = SetPack(gmm.Precision(CompiledGMMData::Precision00, k));
+        Pack p01 = SetPack(gmm.Precision(CompiledGMMData::Precision01, k));
+        Pack p02 = SetPack(gmm.Precision(CompiledGMMData::Precision02, k));
+        Pack p11 = SetPack(gmm.Precision(CompiledGMMData::Precision11, k));
+        Pack p12 = SetPack(gmm.Precision(CompiledGMMData::Precision12, k));
+        Pack p22 = SetPack(gmm.Precision(CompiledGMMData::Precision22, k));
+        Pack constant = SetPack(constants[k]);
+        double* modeLogTerms = logTerms + k * c_CompiledBlockSize;
+        for (int i = 0; i < numPadded; i += c_PackWidth) {
+            Pack dx = SubPack(LoadPack(xs + i), mx);
+            Pack dy = SubPack(LoadPack(ys + i), my);
+            Pack dz = SubPack(LoadPack(zs + i), mz);
+            // (x - mu)^T * inv(Cov) * (x - mu) = dx * (p00*dx + p01*dy + p02*dz) + dy * (p11*dy + p12*dz) + dz * p22*dz
+            Pack rowX = MulAddPack(p02, dz, MulAddPack(p01, dy, MulPack(p00, dx)));
+            Pack rowY = MulAddPack(p12, dz, MulPack(p11, dy));
+            Pack mahalanobis = MulAddPack(dz, MulPack(p22, dz), MulAddPack(dy, rowY, MulPack(dx, rowX)));
+            Pack logTerm = MulAddPack(minusHalf, mahalanobis, constant);
+            StorePack(modeLogTerms + i, logTerm);
+            StorePack(maxLogTerms + i, MaxPack(logTerm, LoadPack(maxLogTerms + i)));
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+inline void ExponentiateLogTerms(int numModes, int numObservations, const double* maxLogTerms, double* logTerms, double* sums, bool flushNegligibleTerms)
+{
+    int numPadded = (numObservations + c_PackWidth - 1) / c_PackWidth * c_PackWidth;
+    Pack zero = SetPack(0.0);
+    for (int i = 0; i < numPadded; i += c_PackWidth)
+        StorePack(sums + i, zero);
+
+    for (int k = 0; k < numModes; ++k) {
+        double* modeTerms = logTerms + k * c_CompiledBlockSize;
+        for (int i = 0; i < numPadded; i += c_PackWidth)
+            StorePack(modeTerms + i, SubPack(LoadPack(modeTerms + i), LoadPack(maxLogTerms + i)));
+        // exp() is evaluated with the C library, to keep the accuracy of the scalar path. This loop dominates the cost of exact mode, and
+        // is the reason why exact mode is only ~2x faster than the per-observation path (see CompiledGMM3D::setPrecision)
+        if (flushNegligibleTerms) {
+            for (int i = 0; i < numObservations; ++i)
+                modeTerms[i] = modeTerms[i] < c_LogSumExpFlushThreshold ? 0.0 : exp(modeTerms[i]);
+        }
+        else {
+            for (int i = 0; i < numObservations; ++i)
+                modeTerms[i] = exp(modeTerms[i]);
+        }
+        for (int i = 0; i < numPadded; i += c_PackWidth)
+            StorePack(sums + i, AddPack(LoadPack(sums + i), LoadPack(modeTerms + i)));
+    }
+}
+
+//----------------------------------------------------------------------------
+inline void FastExponentiateLogTerms(int numModes, int numObservations, const double* maxLogTerms, double* logTerms, double* sums)
+{
+    int numPadded = (numObservations + c_PackWidth - 1) / c_PackWidth * c_PackWidth;
+    Pack zero = SetPack(0.0);
+    for (int i = 0; i < numPadded; i += c_PackWidth)
+        StorePack(sums + i, zero);
+
+    // Branch-free flush: the exp() of negligible terms is still evaluated (it is cheaper than branching), but replaced by 0
+    Pack threshold = SetPack(c_LogSumExpFlushThreshold);
+    for (int k = 0; k < numModes; ++k) {
+        double* modeTerms = logTerms + k * c_CompiledBlockSize;
+        for (int i = 0; i < numPadded; i += c_PackWidth) {
+            Pack logTerm = SubPack(LoadPack(modeTerms + i), LoadPack(maxLogTerms + i));
+            Pack term = SelectGreaterPack(threshold, logTerm, zero, ExpPack(logTerm));
+            StorePack(modeTerms + i, term);
+            StorePack(sums + i, AddPack(LoadPack(sums + i), term));
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+inline void FastLog(int numValues, double* values)
+{
+    int numPadded = (numValues + c_PackWidth - 1) / c_PackWidth * c_PackWidth;
+    for (int i = 0; i < numPadded; i += c_PackWidth)
+        StorePack(values + i, LogPack(LoadPack(values + i)));
+}
+
+//----------------------------------------------------------------------------
+inline const KernelTable& MakeKernelTable(InstructionSet instructionSet)
+{
+    static const KernelTable kernels = { instructionSet, &EvaluateLogTerms, &ExponentiateLogTerms, &FastExponentiateLogTerms, &FastLog };
+    return kernels;
+}
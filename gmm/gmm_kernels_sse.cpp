@@ -0,0 +1,81 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <cfloat>
+#include <cmath>
+#include "gmm_kernels.h"
+
+#if defined(AC_GMM_KERNELS_X86)
+#include <nmmintrin.h>
+
+// Everything below is compiled for SSE4.2. Only call it after checking the CPU with DetectInstructionSet().
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC target("sse4.2")
+#elif defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse4.2"))), apply_to = function)
+#endif
+
+namespace AC { namespace GMM { namespace Kernels { namespace SSE42Impl {
+    typedef __m128d Pack;
+    const int c_PackWidth = 2;
+    inline Pack LoadPack(const double* p) { return _mm_loadu_pd(p); }
+    inline void StorePack(double* p, Pack a) { _mm_storeu_pd(p, a); }
+    inline Pack SetPack(double x) { return _mm_set1_pd(x); }
+    inline Pack AddPack(Pack a, Pack b) { return _mm_add_pd(a, b); }
+    inline Pack SubPack(Pack a, Pack b) { return _mm_sub_pd(a, b); }
+    inline Pack MulPack(Pack a, Pack b) { return _mm_mul_pd(a, b); }
+    inline Pack MulAddPack(Pack a, Pack b, Pack c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    inline Pack MaxPack(Pack a, Pack b) { return _mm_max_pd(a, b); }
+    inline Pack MinPack(Pack a, Pack b) { return _mm_min_pd(a, b); }
+    inline Pack DivPack(Pack a, Pack b) { return _mm_div_pd(a, b); }
+    inline Pack SelectGreaterPack(Pack a, Pack b, Pack x, Pack y) { return _mm_blendv_pd(y, x, _mm_cmpgt_pd(a, b)); }
+    inline Pack Pow2Pack(Pack t) { return _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(t), 52)); }
+    inline Pack ExponentPack(Pack x)
+    {
+        // Biased exponent as an integer in the mantissa of 2^52, converted to double by subtracting 2^52
+        __m128i exponent = _mm_or_si128(_mm_srli_epi64(_mm_castpd_si128(x), 52), _mm_set1_epi64x(0x4330000000000000ll));
+        return _mm_sub_pd(_mm_castsi128_pd(exponent), _mm_set1_pd(4503599627370496.0));
+    }
+    inline Pack MantissaPack(Pack x)
+    {
+        __m128i mantissa = _mm_and_si128(_mm_castpd_si128(x), _mm_set1_epi64x(0x000FFFFFFFFFFFFFll));
+        return _mm_castsi128_pd(_mm_or_si128(mantissa, _mm_set1_epi64x(0x3FF0000000000000ll)));
+    }
+
+#include "gmm_kernels.inl"
+}}}}
+
+//----------------------------------------------------------------------------
+const AC::GMM::Kernels::KernelTable& AC::GMM::Kernels::SSE42Kernels()
+{
+    return SSE42Impl::MakeKernelTable(SSE42);
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
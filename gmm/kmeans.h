@@ -30,9 +30,38 @@ SOFTWARE.
 
 #include <memory>
 #include <vector>
+#include "random_generator.h"
+#include "parallel.h"
 
 namespace AC
 {
+    const int c_KMeansParallelRounds = 5; // Number of oversampling rounds in k-means|| (see KMeansInitialization::KMeansParallel)
+    const int c_KMeansParallelOversampling = 2; // Expected number of candidates sampled per round in k-means||, as a multiple of k
+    const int c_KMeansMiniBatchSize = 1024; // Default number of observations per iteration in mini-batch k-means
+    const int c_KMeansMiniBatchIterations = 100; // Default number of iterations in mini-batch k-means
+    const int c_KMeansMiniBatchSampleBatches = 16; // Size of the sample used to seed and rank the mini-batch restarts, in mini-batches
+
+    /// <summary> Initialization (seeding) of the centroids in each restart of KMeans::Process. </summary>
+    enum class KMeansInitialization {
+        Random,         // k distinct observations chosen at random (Forgy). Needs several restarts to avoid poor local minima (default).
+        KMeansPlusPlus, // k-means++: each centroid is an observation chosen with probability proportional to its squared distance to the
+                        // closest centroid chosen so far (k passes over the data). One or two restarts are usually enough.
+        KMeansParallel  // k-means||: c_KMeansParallelRounds passes that oversample candidates with the same D^2 probabilities, followed by
+                        // a weighted k-means++ over the (few) candidates. Same quality as k-means++, with fewer passes over very large sets.
+    };
+
+    /// <summary> Algorithm used for the iterations of KMeans::Process. </summary>
+    enum class KMeansAlgorithm {
+        Lloyd,  // Compare every observation against every centroid in each iteration (default)
+        Hamerly, // Lloyd with the bounds of Hamerly ("Making k-means even faster", 2010): a lower bound on the distance of each observation to its
+                 // second closest centroid and half the distance between centroids let us skip the search for observations that cannot change
+                 // cluster. Same assignments as Lloyd, with one distance (instead of k) for most observations after the first iterations.
+        MiniBatch // Mini-batch k-means (Sculley, "Web-scale k-means clustering", 2010): each iteration assigns a small random batch of observations
+                  // and moves each centroid towards its observations with a per-centroid learning rate of 1 / (number of observations it has seen).
+                  // The restarts are seeded and compared on a random sample, so only the final assignment reads the whole set. Approximate,
+                  // but the cost does not grow with the number of observations (e.g., to initialize EM on very large sets).
+    };
+
     template <typename Vec>
     class KMeans {
     public:
@@ -42,13 +71,27 @@ namespace AC
         /// <param name="numMeans"> Number of centroids to use in k-means (parameter k). </param>
         KMeans(int numMeans);
 
-        /// <summary> Compute K-Means algorithm on a set of observations with N random restarts. The resulting centroids are available through the function Centroids(). </summary>
+        /// <summary> Compute K-Means algorithm on a set of observations with N random restarts. The resulting centroids are available through the function Centroids().
+        ///           Restart r draws its random numbers from its own stream, RandomGenerator::StreamSeed(seed, r), and the restarts run in waves of
+        ///           numThreads concurrent restarts (see setNumThreads). We keep the restart with the lowest sum of squared distances (the lowest
+        ///           index on ties). A restart whose cost is already above the best one of the previous waves, and which is not improving fast
+        ///           enough to catch up, is abandoned. The result only depends on the seed and the number of threads. </summary>
         /// <param name="observations"> N-vector of D-dimensional observations. </param>
-        /// <param name="restarts"> Number of times to restart the algorithm (with random initialization). </param>
+        /// <param name="restarts"> Number of times to restart the algorithm (with a new random initialization, see setInitialization). </param>
         /// <param name="assignments">  [out] N-vector of point assignments. Assignment[i] = C --> means that observation[i] is clustered with centroid C. </param>
         /// <returns> Number of assignment changes at the last iteration (or 0 if the algorithm converged). </returns>
         int Process(const std::vector<Vec>& observations, int restarts, std::vector<int>& assignments);
 
+        /// <summary> Same as above, with a (positive) weight per observation, e.g., the number of times each distinct value appears in the
+        ///           data set (see CountUniqueObservations). Weighted observations count as that many repeated observations in the seeding
+        ///           (observations are chosen with probability proportional to their weight), in the centroids and in the costs. </summary>
+        /// <param name="observations"> N-vector of D-dimensional observations. </param>
+        /// <param name="weights"> N-vector of weights (or an empty vector for unit weights). </param>
+        /// <param name="restarts"> Number of times to restart the algorithm (with a new random initialization, see setInitialization). </param>
+        /// <param name="assignments">  [out] N-vector of point assignments. Assignment[i] = C --> means that observation[i] is clustered with centroid C. </param>
+        /// <returns> Number of assignment changes at the last iteration (or 0 if the algorithm converged). </returns>
+        int Process(const std::vector<Vec>& observations, const std::vector<double>& weights, int restarts, std::vector<int>& assignments);
+
         /// <summary> Compute closest centroid for a given observation. </summary>
         /// <param name="observation"> The observation. </param>
         /// <param name="assignment">  [out] The closest centroid to this observation. </param>
@@ -59,13 +102,26 @@ namespace AC
         /// <param name="observation"> The set of observations. </param>
         /// <param name="assignments"> [out] The computed assignments. </param>
         /// <param name="numAssignmentChanges"> [out] Number of assignment changes from the previous iteration of KMeans. </param>
+        /// <param name="weights"> [optional] N-vector of weights of the observations (nullptr for unit weights). </param>
         /// <returns> The average distance from an observation to its centroid. </returns>
-        double ClosestCentroids(const std::vector<Vec>& observation, std::vector<int>& assignments, int& numAssignmentChanges);
+        double ClosestCentroids(const std::vector<Vec>& observation, std::vector<int>& assignments, int& numAssignmentChanges, const std::vector<double>* weights = nullptr);
+
+        /// <summary> Same as ClosestCentroids(), but skipping the search for observations whose assignment cannot change (see KMeansAlgorithm::Hamerly).
+        ///           The bounds are kept from one call to the next, so the centroids must only change through UpdateCentroids() in between. </summary>
+        /// <param name="observation"> The set of observations. </param>
+        /// <param name="assignments"> [in,out] The computed assignments (the assignments of the previous call, unless resetBounds is true). </param>
+        /// <param name="numAssignmentChanges"> [out] Number of assignment changes from the previous iteration of KMeans. </param>
+        /// <param name="resetBounds"> Search all observations and reinitialize the bounds (e.g., in the first iteration). </param>
+        /// <param name="weights"> [optional] N-vector of weights of the observations (nullptr for unit weights). </param>
+        /// <returns> The same value as ClosestCentroids(). </returns>
+        double ClosestCentroidsHamerly(const std::vector<Vec>& observations, std::vector<int>& assignments, int& numAssignmentChanges, bool resetBounds,
+            const std::vector<double>* weights = nullptr);
 
         /// <summary> Updates the centroids given a set of observations and assignments. </summary>
         /// <param name="observations"> The observations. </param>
         /// <param name="assignments">  The assignments. </param>
-        void UpdateCentroids(const std::vector<Vec>& observations, const std::vector<int>& assignments);
+        /// <param name="weights"> [optional] N-vector of weights of the observations (nullptr for unit weights). </param>
+        void UpdateCentroids(const std::vector<Vec>& observations, const std::vector<int>& assignments, const std::vector<double>* weights = nullptr);
 
         // Get centroids
         std::vector<Vec>& Centroids() { return m_centroids; }
@@ -81,23 +137,88 @@ namespace AC
         // Maximum number of iterations
         void setMaxIterations(int maxIterations) { m_maxIterations = maxIterations; }
 
+        // Initialization of the centroids in each restart (see KMeansInitialization)
+        void setInitialization(KMeansInitialization initialization) { m_initialization = initialization; }
+        KMeansInitialization Initialization() const { return m_initialization; }
+
+        // Algorithm used for the iterations (see KMeansAlgorithm)
+        void setAlgorithm(KMeansAlgorithm algorithm) { m_algorithm = algorithm; }
+        KMeansAlgorithm Algorithm() const { return m_algorithm; }
+
+        // Number of observations per iteration and number of iterations of mini-batch k-means (see KMeansAlgorithm::MiniBatch)
+        void setMiniBatchSize(int miniBatchSize) { m_miniBatchSize = miniBatchSize; }
+        void setMiniBatchIterations(int miniBatchIterations) { m_miniBatchIterations = miniBatchIterations; }
+
+        // Seed of the random numbers in Process() (restart r uses the stream RandomGenerator::StreamSeed(seed, r))
+        void setSeed(uint64_t seed) { m_seed = seed; }
+        uint64_t Seed() const { return m_seed; }
+
+        // Number of restarts run concurrently in Process() (0 = all hardware threads)
+        void setNumThreads(int numThreads) { m_numThreads = numThreads; }
+
+        // Sum of the squared distances of the observations to their centroids (the k-means cost) at the last call to ClosestCentroids()
+        double SumSquaredDistances() const { return m_sumSquaredDistances; }
+
         // Average distance of points to this centroid
         double AvgDistance(int k) { return m_avgDistancesPerCentroid[k].Mean(); }
         double AvgVariance(int k) { return m_avgDistancesPerCentroid[k].Variance(); }
 
-        // Ratio of points that belong to centroid k
-        double CentroidAssignmentRatio(int k) { return (double)m_avgDistancesPerCentroid[k].NumSamples() / (double)m_numTrainingPoints; }
+        // Ratio of points (or of their total weight, for weighted observations) that belong to centroid k
+        double CentroidAssignmentRatio(int k) { return m_avgDistancesPerCentroid[k].SumWeights() / m_sumTrainingWeights; }
 
         // Returns number of samples in centroid k
         size_t NumSamplesAssignedToCentroid(int k) { return m_avgDistancesPerCentroid[k].NumSamples(); }
 
     private:
+        /// <summary> Run one restart of k-means: initialize the centroids and iterate until convergence (or abandonment). </summary>
+        /// <param name="weights"> N-vector of weights of the observations (nullptr for unit weights). </param>
+        /// <param name="generator"> The random generator of this restart. </param>
+        /// <param name="assignments"> [out] Vector of point assignments (workspace of this restart, resized as needed). </param>
+        /// <param name="bestCost"> Lowest cost of the previous restarts, to abandon this one early if it cannot catch up. </param>
+        /// <returns> The final cost (see SumSquaredDistances()), or std::numeric_limits<double>::max() if the restart was abandoned. </returns>
+        double RunRestart(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator, std::vector<int>& assignments, double bestCost);
+
+        /// <summary> Run one restart of mini-batch k-means, seeded and evaluated on m_tmpSample (see KMeansAlgorithm::MiniBatch). Weighted
+        ///           observations are drawn with probability proportional to their weight, so the batches and the sample are unweighted. </summary>
+        /// <param name="cumulativeWeights"> N-vector of cumulative weights of the observations (nullptr for unit weights). </param>
+        /// <returns> The final cost on m_tmpSample. </returns>
+        double RunMiniBatchRestart(const std::vector<Vec>& observations, const std::vector<double>* cumulativeWeights, RandomGenerator& generator, std::vector<int>& assignments);
+
+        /// <summary> Choose k distinct observations at random (with probability proportional to their weight) as the initial centroids. </summary>
+        void InitializeRandom(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator);
+
+        /// <summary> Choose the initial centroids with k-means++ (see KMeansInitialization::KMeansPlusPlus). </summary>
+        void InitializeKMeansPlusPlus(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator);
+
+        /// <summary> Choose the initial centroids with k-means|| (see KMeansInitialization::KMeansParallel). </summary>
+        void InitializeKMeansParallel(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator);
+
+        /// <summary> Choose numCentroids() of the given candidates with weighted k-means++, i.e., candidate c is chosen with probability
+        ///           proportional to weights[c] times its squared distance to the closest centroid chosen so far. </summary>
+        void SelectWeightedKMeansPlusPlus(const std::vector<Vec>& candidates, const std::vector<double>& weights, RandomGenerator& generator);
+
+        /// <summary> Sum of the variances of the distances to each centroid (the value returned by ClosestCentroids). </summary>
+        double SumCentroidVariances();
+
         int m_maxIterations; // Maximum number of iterations in KMeans (should not be necessary, in theory, but just in case...)
         int m_numMeans; // Parameter K in k-means
         std::vector<Vec> m_centroids; // K-vector of centroids
         std::vector<OnlineMeanVariance<double>> m_avgDistancesPerCentroid; // K-vector containing the average distance to each centroid
-        std::vector<OnlineMean<Vec>> m_tmpCentroidMeans; // K-Vector with helper classes to compute centroids
+        AlignedVector<OnlineMean<Vec>> m_tmpCentroidMeans; // K-Vector with helper classes to compute centroids
         int m_numTrainingPoints; // Number of observations used in training
+        double m_sumTrainingWeights; // Sum of the weights of the observations used in training (their number, for unit weights)
+        KMeansInitialization m_initialization; // Initialization of the centroids in each restart
+        std::vector<double> m_tmpDistances; // N-vector (temporary) with the squared distance of each observation to its closest centroid during the initialization
+        KMeansAlgorithm m_algorithm; // Algorithm used for the iterations
+        std::vector<double> m_tmpLowerBounds; // N-vector with a lower bound of the distance of each observation to its second closest centroid (Hamerly)
+        std::vector<double> m_tmpCentroidSeparations; // K-vector with half the distance of each centroid to its closest centroid (Hamerly)
+        std::vector<Vec> m_tmpPreviousCentroids; // K-vector with the centroids at the previous call to ClosestCentroidsHamerly()
+        int m_miniBatchSize; // Number of observations per iteration of mini-batch k-means
+        int m_miniBatchIterations; // Number of iterations of mini-batch k-means
+        std::vector<Vec> m_tmpSample; // Random sample of the observations used to seed and rank the mini-batch restarts
+        uint64_t m_seed; // Seed of the random streams of the restarts
+        int m_numThreads; // Number of restarts run concurrently
+        double m_sumSquaredDistances; // k-means cost at the last call to ClosestCentroids()
     };
 
     typedef KMeans<Vec2> KMeans2D;
@@ -29,7 +29,8 @@ SOFTWARE.
 
 //----------------------------------------------------------------------------
 template <typename Vec>
-AC::KMeans<Vec>::KMeans(int numMeans) : m_numMeans(numMeans), m_centroids(numMeans), m_avgDistancesPerCentroid(numMeans), m_tmpCentroidMeans(numMeans), m_maxIterations(100)
+AC::KMeans<Vec>::KMeans(int numMeans) : m_numMeans(numMeans), m_centroids(numMeans), m_avgDistancesPerCentroid(numMeans), m_tmpCentroidMeans(numMeans), m_maxIterations(100), m_initialization(KMeansInitialization::Random), m_algorithm(KMeansAlgorithm::Lloyd),
+    m_miniBatchSize(c_KMeansMiniBatchSize), m_miniBatchIterations(c_KMeansMiniBatchIterations), m_seed(c_DefaultRandomSeed), m_numThreads(1), m_sumSquaredDistances(0), m_numTrainingPoints(0), m_sumTrainingWeights(0)
 {
     m_centroids.resize(numMeans);
 }
@@ -37,60 +38,309 @@ AC::KMeans<Vec>::KMeans(int numMeans) : m_numMeans(numMeans), m_centroids(numMea
 //----------------------------------------------------------------------------
 template <typename Vec>
 int AC::KMeans<Vec>::Process(const std::vector<Vec>& observations, int numRestarts, std::vector<int>& assignments)
+{
+    return Process(observations, std::vector<double>(), numRestarts, assignments);
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+int AC::KMeans<Vec>::Process(const std::vector<Vec>& observations, const std::vector<double>& observationWeights, int numRestarts, std::vector<int>& assignments)
 {
     if (observations.size() < numCentroids())
         return false;
+    _ASSERT((observationWeights.empty() || observationWeights.size() == observations.size()) && L"Invalid number of weights");
+    const std::vector<double>* weights = observationWeights.empty() ? nullptr : &observationWeights;
 
     this->m_centroids.resize(m_numMeans);
     for (int i = 0; i < int(this->m_centroids.size()); i++)
         this->m_centroids[i] = observations[0];
 
     m_numTrainingPoints = (int)observations.size();
-    RandomGenerator subsetGenerator;
+    m_sumTrainingWeights = (double)observations.size();
+    if (weights != nullptr) {
+        m_sumTrainingWeights = 0;
+        for (double weight : *weights)
+            m_sumTrainingWeights += weight;
+    }
     std::vector<Vec> bestCentroids(numCentroids(), observations[0]);
-    double bestDistance = std::numeric_limits<double>::max();
-    subsetGenerator.setLimits(0, (int)observations.size() - 1);
-    std::vector<int> initialCentroids(numCentroids());
+    double bestCost = std::numeric_limits<double>::max();
 
     // Ensure the assingments and observations have the same size
     assignments.resize(observations.size());
 
-    for (int i = 0; i < numRestarts; ++i)
-    {
-        // Choose initial centroids
-        subsetGenerator.NonRepeatingSubset(initialCentroids);
-        for (int j = 0; j < numCentroids(); ++j)
-            Centroids(j) = observations[initialCentroids[j]];
-
-        int assignmentChanges = 1;
-        double avgDistance = 0;
-        int numIterations = 0;
-        // Process
-        while (assignmentChanges && numIterations < m_maxIterations)
-        {
-            // E-Step
-            avgDistance = ClosestCentroids(observations, assignments, assignmentChanges);
+    // Mini-batch restarts are seeded and compared on the same random sample (drawn with replacement, from a stream separate from those
+    // of the restarts). Small unweighted sets are used whole. Weighted observations are drawn with probability proportional to their weight.
+    m_tmpSample.clear();
+    std::vector<double> cumulativeWeights;
+    if (m_algorithm == KMeansAlgorithm::MiniBatch) {
+        if (weights != nullptr) {
+            cumulativeWeights.resize(weights->size());
+            double cumulativeWeight = 0;
+            for (size_t i = 0; i < weights->size(); ++i)
+                cumulativeWeights[i] = cumulativeWeight += (*weights)[i];
+        }
+        size_t sampleSize = (size_t)c_KMeansMiniBatchSampleBatches * std::max(m_miniBatchSize, numCentroids());
+        if (sampleSize >= observations.size() && weights == nullptr) {
+            m_tmpSample = observations;
+        }
+        else {
+            RandomGenerator sampleGenerator(0, (int)observations.size() - 1, RandomGenerator::StreamSeed(m_seed, ~0ull));
+            m_tmpSample.reserve(sampleSize);
+            for (size_t i = 0; i < sampleSize; ++i)
+                m_tmpSample.push_back(observations[weights != nullptr ? sampleGenerator.drawCumulative(cumulativeWeights) : sampleGenerator.draw()]);
+        }
+    }
 
-            // M-Step
-            UpdateCentroids(observations, assignments);
+    // Each concurrent restart works on its own copy of this object (centroids and temporary statistics) and its own assignments
+    int numThreads = std::max(1, std::min(ResolveNumThreads(m_numThreads), numRestarts));
+    std::vector<KMeans<Vec>> workers(numThreads, *this);
+    std::vector<std::vector<int>> workerAssignments(numThreads);
+    std::vector<double> workerCosts(numThreads);
 
-            numIterations++;
-        }
-        // Check if this restart is better than the previous ones
-        if (avgDistance < bestDistance)
-        {
-            bestCentroids = Centroids();
-            bestDistance = avgDistance;
+    for (int waveBegin = 0; waveBegin < numRestarts; waveBegin += numThreads)
+    {
+        // All restarts in a wave are compared against the best restart of the previous waves, so that the result does not depend on timing
+        int waveSize = std::min(numThreads, numRestarts - waveBegin);
+        double previousBestCost = bestCost;
+        ParallelFor(waveSize, waveSize, [&](int, size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r) {
+                RandomGenerator generator(0, (int)observations.size() - 1, RandomGenerator::StreamSeed(m_seed, waveBegin + r));
+                workerCosts[r] = m_algorithm == KMeansAlgorithm::MiniBatch ?
+                    workers[r].RunMiniBatchRestart(observations, weights != nullptr ? &cumulativeWeights : nullptr, generator, workerAssignments[r]) :
+                    workers[r].RunRestart(observations, weights, generator, workerAssignments[r], previousBestCost);
+            }
+        });
+
+        // Check if these restarts are better than the previous ones (in restart order)
+        for (int r = 0; r < waveSize; ++r) {
+            if (workerCosts[r] < bestCost) {
+                bestCentroids = workers[r].Centroids();
+                bestCost = workerCosts[r];
+            }
         }
     }
     // Update KMeans centroids with the best centroids we found
     Centroids() = bestCentroids;
     // Recompute best assignments corresponding to best centroids
     int numAssignmentChanges = 0;
-    ClosestCentroids(observations, assignments, numAssignmentChanges);
+    ClosestCentroids(observations, assignments, numAssignmentChanges, weights);
     return numAssignmentChanges;
 }
 
+//----------------------------------------------------------------------------
+template <typename Vec>
+double AC::KMeans<Vec>::RunRestart(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator, std::vector<int>& assignments, double bestCost)
+{
+    assignments.resize(observations.size());
+
+    // Choose initial centroids
+    switch (m_initialization) {
+    case KMeansInitialization::KMeansPlusPlus:
+        InitializeKMeansPlusPlus(observations, weights, generator);
+        break;
+    case KMeansInitialization::KMeansParallel:
+        InitializeKMeansParallel(observations, weights, generator);
+        break;
+    default:
+        InitializeRandom(observations, weights, generator);
+        break;
+    }
+
+    int assignmentChanges = 1;
+    int numIterations = 0;
+    double previousCost = std::numeric_limits<double>::max();
+    // Process
+    while (assignmentChanges && numIterations < m_maxIterations)
+    {
+        // E-Step
+        if (m_algorithm == KMeansAlgorithm::Hamerly)
+            ClosestCentroidsHamerly(observations, assignments, assignmentChanges, numIterations == 0, weights);
+        else
+            ClosestCentroids(observations, assignments, assignmentChanges, weights);
+
+        // Lloyd iterations never increase the cost, but their improvements quickly shrink. If we are above the best cost and the last
+        // improvement was smaller than the gap, this restart is very unlikely to catch up.
+        double cost = SumSquaredDistances();
+        if (cost > bestCost && previousCost - cost < cost - bestCost)
+            return std::numeric_limits<double>::max();
+        previousCost = cost;
+
+        // M-Step
+        UpdateCentroids(observations, assignments, weights);
+
+        numIterations++;
+    }
+    return SumSquaredDistances();
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+double AC::KMeans<Vec>::RunMiniBatchRestart(const std::vector<Vec>& observations, const std::vector<double>* cumulativeWeights, RandomGenerator& generator, std::vector<int>& assignments)
+{
+    // Choose initial centroids from the sample (with the same initialization as the full-batch algorithms)
+    generator.setLimits(0, (int)m_tmpSample.size() - 1);
+    switch (m_initialization) {
+    case KMeansInitialization::KMeansPlusPlus:
+        InitializeKMeansPlusPlus(m_tmpSample, nullptr, generator);
+        break;
+    case KMeansInitialization::KMeansParallel:
+        InitializeKMeansParallel(m_tmpSample, nullptr, generator);
+        break;
+    default:
+        InitializeRandom(m_tmpSample, nullptr, generator);
+        break;
+    }
+    generator.setLimits(0, (int)observations.size() - 1);
+
+    // Each iteration assigns a batch of random observations (with the centroids at the start of the iteration), and then moves each
+    // centroid towards its observations, one at a time: c = (1 - eta) * c + eta * x, with eta = 1 / (number of observations seen by c)
+    int batchSize = std::max(1, m_miniBatchSize);
+    std::vector<double> centroidCounts(numCentroids(), 0.0);
+    std::vector<int> batch(batchSize);
+    assignments.resize(batchSize);
+    for (int iteration = 0; iteration < m_miniBatchIterations; ++iteration)
+    {
+        for (int b = 0; b < batchSize; ++b) {
+            batch[b] = cumulativeWeights != nullptr ? generator.drawCumulative(*cumulativeWeights) : generator.draw();
+            ClosestCentroid(observations[batch[b]], assignments[b]);
+        }
+        for (int b = 0; b < batchSize; ++b) {
+            int k = assignments[b];
+            centroidCounts[k] += 1;
+            typename Vec::Scalar learningRate = (typename Vec::Scalar)(1.0 / centroidCounts[k]);
+            Centroids(k) = Centroids(k) + (observations[batch[b]] - Centroids(k)) * learningRate;
+        }
+    }
+
+    // Rank the restarts by their cost on the sample
+    int numAssignmentChanges = 0;
+    assignments.assign(m_tmpSample.size(), 0);
+    ClosestCentroids(m_tmpSample, assignments, numAssignmentChanges);
+    return SumSquaredDistances();
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::KMeans<Vec>::InitializeRandom(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator)
+{
+    if (weights != nullptr) {
+        // Draw without replacement, in proportion to the weights (i.e., as if we drew distinct observations from the repeated ones)
+        m_tmpDistances = *weights;
+        double sumWeights = 0;
+        for (double weight : m_tmpDistances)
+            sumWeights += weight;
+        for (int j = 0; j < numCentroids(); ++j) {
+            int idx = generator.drawWeighted(m_tmpDistances, sumWeights);
+            Centroids(j) = observations[idx];
+            sumWeights -= m_tmpDistances[idx];
+            m_tmpDistances[idx] = 0;
+        }
+        return;
+    }
+
+    std::vector<int> initialCentroids(numCentroids());
+    generator.NonRepeatingSubset(initialCentroids);
+    for (int j = 0; j < numCentroids(); ++j)
+        Centroids(j) = observations[initialCentroids[j]];
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::KMeans<Vec>::InitializeKMeansPlusPlus(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator)
+{
+    // Weighted observations are handled as weighted k-means++ over the distinct observations
+    if (weights != nullptr) {
+        SelectWeightedKMeansPlusPlus(observations, *weights, generator);
+        return;
+    }
+
+    // The first centroid is chosen uniformly at random
+    Centroids(0) = observations[generator.draw()];
+    m_tmpDistances.resize(observations.size());
+    double sumDistances = 0;
+    for (size_t i = 0; i < observations.size(); ++i) {
+        m_tmpDistances[i] = (observations[i] - Centroids(0)).squaredNorm();
+        sumDistances += m_tmpDistances[i];
+    }
+
+    // Each of the following ones with probability D(x)^2 / sum(D(x)^2), where D(x) is the distance to the closest centroid so far
+    for (int k = 1; k < numCentroids(); ++k) {
+        Centroids(k) = observations[generator.drawWeighted(m_tmpDistances, sumDistances)];
+        sumDistances = 0;
+        for (size_t i = 0; i < observations.size(); ++i) {
+            m_tmpDistances[i] = std::min(m_tmpDistances[i], (double)(observations[i] - Centroids(k)).squaredNorm());
+            sumDistances += m_tmpDistances[i];
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::KMeans<Vec>::InitializeKMeansParallel(const std::vector<Vec>& observations, const std::vector<double>* weights, RandomGenerator& generator)
+{
+    // First candidate chosen uniformly at random (or in proportion to the weights), as in k-means++. With weighted observations, all
+    // squared distances below are multiplied by the weight of the observation.
+    std::vector<Vec> candidates(1, observations[weights != nullptr ? generator.drawWeighted(*weights, m_sumTrainingWeights) : generator.draw()]);
+    std::vector<int> closestCandidates(observations.size(), 0);
+    m_tmpDistances.resize(observations.size());
+    double sumDistances = 0;
+    for (size_t i = 0; i < observations.size(); ++i) {
+        m_tmpDistances[i] = (observations[i] - candidates[0]).squaredNorm();
+        sumDistances += weights != nullptr ? (*weights)[i] * m_tmpDistances[i] : m_tmpDistances[i];
+    }
+
+    // In each round, every observation becomes a candidate independently with probability l * D(x)^2 / sum(D(x)^2), so that we
+    // expect l = c_KMeansParallelOversampling * k new candidates per round (instead of one per pass over the data in k-means++)
+    double oversampling = (double)c_KMeansParallelOversampling * numCentroids();
+    for (int round = 0; round < c_KMeansParallelRounds && sumDistances > 0; ++round) {
+        size_t firstNewCandidate = candidates.size();
+        for (size_t i = 0; i < observations.size(); ++i) {
+            double weightedDistance = weights != nullptr ? (*weights)[i] * m_tmpDistances[i] : m_tmpDistances[i];
+            if (generator.drawReal() < oversampling * weightedDistance / sumDistances)
+                candidates.push_back(observations[i]);
+        }
+
+        sumDistances = 0;
+        for (size_t i = 0; i < observations.size(); ++i) {
+            for (size_t c = firstNewCandidate; c < candidates.size(); ++c) {
+                double distance = (observations[i] - candidates[c]).squaredNorm();
+                if (distance < m_tmpDistances[i]) {
+                    m_tmpDistances[i] = distance;
+                    closestCandidates[i] = (int)c;
+                }
+            }
+            sumDistances += weights != nullptr ? (*weights)[i] * m_tmpDistances[i] : m_tmpDistances[i];
+        }
+    }
+
+    // Weight each candidate by the number (or total weight) of observations closest to it, and recluster the candidates into k centroids
+    std::vector<double> candidateWeights(candidates.size(), 0.0);
+    for (size_t i = 0; i < observations.size(); ++i)
+        candidateWeights[closestCandidates[i]] += weights != nullptr ? (*weights)[i] : 1.0;
+    SelectWeightedKMeansPlusPlus(candidates, candidateWeights, generator);
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::KMeans<Vec>::SelectWeightedKMeansPlusPlus(const std::vector<Vec>& candidates, const std::vector<double>& weights, RandomGenerator& generator)
+{
+    // Same as k-means++, with every squared distance multiplied by the weight of the candidate. The first centroid is chosen in proportion
+    // to the weights. If there are fewer candidates than centroids (e.g., if many observations are duplicated), the rest repeat candidates.
+    std::vector<double> weightedDistances(weights);
+    double sumWeightedDistances = 0;
+    for (double weight : weights)
+        sumWeightedDistances += weight;
+    for (int k = 0; k < numCentroids(); ++k) {
+        Centroids(k) = candidates[generator.drawWeighted(weightedDistances, sumWeightedDistances)];
+        sumWeightedDistances = 0;
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            double distance = (candidates[c] - Centroids(k)).squaredNorm();
+            weightedDistances[c] = k == 0 ? weights[c] * distance : std::min(weightedDistances[c], weights[c] * distance);
+            sumWeightedDistances += weightedDistances[c];
+        }
+    }
+}
+
 //----------------------------------------------------------------------------
 template <typename Vec>
 double AC::KMeans<Vec>::ClosestCentroid(const Vec& observation, int& assignment)
@@ -110,7 +360,7 @@ double AC::KMeans<Vec>::ClosestCentroid(const Vec& observation, int& assignment)
 
 //----------------------------------------------------------------------------
 template <typename Vec>
-double AC::KMeans<Vec>::ClosestCentroids(const std::vector<Vec>& observations, std::vector<int>& assignments, int& numAssignmentChanges)
+double AC::KMeans<Vec>::ClosestCentroids(const std::vector<Vec>& observations, std::vector<int>& assignments, int& numAssignmentChanges, const std::vector<double>* weights)
 {
     _ASSERT(observations.size() == assignments.size() && L"Vectors must be the same size");
     _ASSERT(m_avgDistancesPerCentroid.size() == numCentroids() && L"Invalid vector size");
@@ -120,6 +370,7 @@ double AC::KMeans<Vec>::ClosestCentroids(const std::vector<Vec>& observations, s
         avgDistance.Reset();
 
     numAssignmentChanges = 0;
+    m_sumSquaredDistances = 0;
     int oldAssignment;
 
     for (int i = 0; i < observations.size(); ++i)
@@ -133,28 +384,130 @@ double AC::KMeans<Vec>::ClosestCentroids(const std::vector<Vec>& observations, s
             numAssignmentChanges++;
 
         // Update centroid statistics (online mean)
-        m_avgDistancesPerCentroid[assignments[i]].Push(distance);
+        double weight = weights != nullptr ? (*weights)[i] : 1.0;
+        m_avgDistancesPerCentroid[assignments[i]].Push(distance, weight);
+        m_sumSquaredDistances += weight * distance * distance;
     }
 
     // Compute average variance for each centroid (i.e., our metric to choose one assignment over another)
+    return SumCentroidVariances();
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+double AC::KMeans<Vec>::ClosestCentroidsHamerly(const std::vector<Vec>& observations, std::vector<int>& assignments, int& numAssignmentChanges, bool resetBounds,
+    const std::vector<double>* weights)
+{
+    _ASSERT(observations.size() == assignments.size() && L"Vectors must be the same size");
+    _ASSERT(m_avgDistancesPerCentroid.size() == numCentroids() && L"Invalid vector size");
+    const double c_BoundSafetyFactor = 1 + 1e-12; // Margin for the rounding errors accumulated in the bounds
+
+    // Clean up centroid statistics
+    for (auto& avgDistance : m_avgDistancesPerCentroid)
+        avgDistance.Reset();
+
+    numAssignmentChanges = 0;
+    m_sumSquaredDistances = 0;
+    resetBounds = resetBounds || m_tmpLowerBounds.size() != observations.size() || m_tmpPreviousCentroids.size() != m_centroids.size();
+    if (resetBounds) {
+        m_tmpLowerBounds.assign(observations.size(), 0.0);
+    }
+    else {
+        // The centroids moved since the last call, so every distance to a centroid other than the assigned one may have shrunk by up to
+        // the largest movement of any other centroid
+        int mostMovedCentroid = 0;
+        double maxMovement = 0, secondMaxMovement = 0;
+        for (int k = 0; k < numCentroids(); ++k) {
+            double movement = (Centroids(k) - m_tmpPreviousCentroids[k]).norm();
+            if (movement > maxMovement) {
+                secondMaxMovement = maxMovement;
+                maxMovement = movement;
+                mostMovedCentroid = k;
+            }
+            else if (movement > secondMaxMovement) {
+                secondMaxMovement = movement;
+            }
+        }
+        for (size_t i = 0; i < observations.size(); ++i)
+            m_tmpLowerBounds[i] -= assignments[i] == mostMovedCentroid ? secondMaxMovement : maxMovement;
+    }
+    m_tmpPreviousCentroids = m_centroids;
+
+    // An observation closer to its centroid than half the distance from that centroid to any other one cannot be closer to another centroid
+    m_tmpCentroidSeparations.assign(numCentroids(), std::numeric_limits<double>::max());
+    for (int k = 0; k < numCentroids(); ++k) {
+        for (int j = k + 1; j < numCentroids(); ++j) {
+            double separation = 0.5 * (Centroids(k) - Centroids(j)).norm();
+            m_tmpCentroidSeparations[k] = std::min(m_tmpCentroidSeparations[k], separation);
+            m_tmpCentroidSeparations[j] = std::min(m_tmpCentroidSeparations[j], separation);
+        }
+    }
+
+    for (size_t i = 0; i < observations.size(); ++i)
+    {
+        // Exact distance to the current centroid (we need it for the statistics anyway). If it is below both bounds, no other centroid is
+        // as close, so the assignment is the same as in a full search.
+        int oldAssignment = assignments[i];
+        double distance = (observations[i] - Centroids(oldAssignment)).norm();
+        if (resetBounds || !(distance * c_BoundSafetyFactor < std::max(m_tmpCentroidSeparations[oldAssignment], m_tmpLowerBounds[i])))
+        {
+            // Full search, in the same order as ClosestCentroid(), keeping the distance to the second closest centroid as the new lower bound
+            double bestDistance = std::numeric_limits<double>::max();
+            double secondBestDistance = std::numeric_limits<double>::max();
+            for (int k = 0; k < numCentroids(); ++k)
+            {
+                double centroidDistance = (observations[i] - Centroids(k)).norm();
+                if (centroidDistance < bestDistance) {
+                    secondBestDistance = bestDistance;
+                    assignments[i] = k;
+                    bestDistance = centroidDistance;
+                }
+                else if (centroidDistance < secondBestDistance) {
+                    secondBestDistance = centroidDistance;
+                }
+            }
+            distance = bestDistance;
+            m_tmpLowerBounds[i] = secondBestDistance;
+        }
+
+        // Keep track of assignment changes 
+        if (assignments[i] != oldAssignment)
+            numAssignmentChanges++;
+
+        // Update centroid statistics (online mean)
+        double weight = weights != nullptr ? (*weights)[i] : 1.0;
+        m_avgDistancesPerCentroid[assignments[i]].Push(distance, weight);
+        m_sumSquaredDistances += weight * distance * distance;
+    }
+
+    return SumCentroidVariances();
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+double AC::KMeans<Vec>::SumCentroidVariances()
+{
     double avgVariance = 0;
-    for (int i = 0; i < numCentroids(); ++i)
+    for (int i = 0; i < m_numMeans; ++i)
         avgVariance += m_avgDistancesPerCentroid[i].Variance();
-
     return avgVariance;
 }
 
 //----------------------------------------------------------------------------
 template <typename Vec>
-void AC::KMeans<Vec>::UpdateCentroids(const std::vector<Vec>& observations, const std::vector<int>& assignments)
+void AC::KMeans<Vec>::UpdateCentroids(const std::vector<Vec>& observations, const std::vector<int>& assignments, const std::vector<double>* weights)
 {
     // Clean centroids first
     for (auto& centroid : m_tmpCentroidMeans)
         centroid.Reset();
 
     // Online computation of mean: http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
-    for (int i = 0; i < (int)observations.size(); ++i)
-        m_tmpCentroidMeans[assignments[i]].Push(observations[i]);
+    for (int i = 0; i < (int)observations.size(); ++i) {
+        if (weights != nullptr)
+            m_tmpCentroidMeans[assignments[i]].Push(observations[i], (*weights)[i]);
+        else
+            m_tmpCentroidMeans[assignments[i]].Push(observations[i]);
+    }
 
     // Copy centroids to its permanent storage
     for (int k = 0; k < numCentroids(); ++k)
@@ -33,6 +33,8 @@ SOFTWARE.
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include <Eigen/StdVector> // Necessary to use aligned Eigen::Vector2f inside an std::vector 
+#include <functional>
+#include <unordered_map>
 
 namespace AC
 {
@@ -41,6 +43,16 @@ namespace AC
     typedef Eigen::Matrix2d Mat2;
     typedef Eigen::Matrix3d Mat3;
 
+    // Single-precision versions (half the memory per observation, and twice the values per SIMD register)
+    typedef Eigen::Vector2f Vec2f;
+    typedef Eigen::Vector3f Vec3f;
+    typedef Eigen::Matrix2f Mat2f;
+    typedef Eigen::Matrix3f Mat3f;
+
+    // std::vector of Eigen types. Needed (before C++17) for fixed-size vectorizable types, such as Eigen::Vector2d or Eigen::Vector4f.
+    template <typename T>
+    using AlignedVector = std::vector<T, Eigen::aligned_allocator<T>>;
+
     // General version
     template <typename T>
     inline void SetZero(T& val)
@@ -48,17 +60,18 @@ namespace AC
         val = 0;
     }
 
-    // Specialized version for Eigen
-    inline void SetZero(Vec3 vec)
+    // Specialized version for Eigen (any scalar type and size)
+    template <typename Scalar, int Rows, int Cols, int Options, int MaxRows, int MaxCols>
+    inline void SetZero(Eigen::Matrix<Scalar, Rows, Cols, Options, MaxRows, MaxCols>& mat)
     {
-        vec.setZero();
+        mat.setZero();
     }
 
     // Utility to compute the mean of a list of values incrementally (more accurate), as in: http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
     template <typename T>
     class OnlineMean {
     public:
-        OnlineMean() : m_numSamples(0)
+        OnlineMean() : m_numSamples(0), m_sumWeights(0)
         {
             SetZero(m_currentMean);
         }
@@ -70,11 +83,34 @@ namespace AC
         const T& Push(const T& value)
         {
             ++m_numSamples;
+            m_sumWeights += 1;
+            if (m_numSamples == 1) {
+                // The first value is the mean (this also sizes the mean if T is a dynamic-size vector)
+                m_currentMean = value;
+                return m_currentMean;
+            }
             T delta = value - m_currentMean;
             m_currentMean = m_currentMean + delta / float(m_numSamples);
             return m_currentMean;
         }
 
+        /// <summary> Push a new value with a (positive) weight, e.g., the number of times it is repeated. With unit weights, this is the same as Push(value). </summary>
+        /// <param name="value"> The value to push. </param>
+        /// <param name="weight"> The weight of the value. </param>
+        /// <returns> The updated mean. </returns>
+        const T& Push(const T& value, double weight)
+        {
+            ++m_numSamples;
+            m_sumWeights += weight;
+            if (m_numSamples == 1) {
+                m_currentMean = value;
+                return m_currentMean;
+            }
+            T delta = value - m_currentMean;
+            m_currentMean = m_currentMean + delta * float(weight) / float(m_sumWeights);
+            return m_currentMean;
+        }
+
         /// <summary> Return the current mean value. </summary>
         /// <returns> The current mean value. </returns>
         const T& Mean() const
@@ -87,6 +123,7 @@ namespace AC
         void Reset()
         {
             m_numSamples = 0;
+            m_sumWeights = 0;
             SetZero(m_currentMean);
         }
 
@@ -97,8 +134,12 @@ namespace AC
             return static_cast<int>(m_numSamples);
         }
 
+        /// <summary> Return the sum of the weights of all elements (the number of elements if they were pushed without weight). </summary>
+        double SumWeights() const { return m_sumWeights; }
+
     private:
         size_t m_numSamples;
+        double m_sumWeights;
         T m_currentMean;
     };
 
@@ -112,6 +153,7 @@ namespace AC
     public:
         OnlineMeanVariance()
             : m_numSamples(0)
+            , m_sumWeights(0)
             , m_currentMean(0)
             , m_currentMeanSq(0)
             , m_currentVariance(0)
@@ -121,6 +163,7 @@ namespace AC
         void Push(T value)
         {
             ++m_numSamples;
+            m_sumWeights += 1;
             T diff = value - m_currentMean;
             m_currentMean += diff / static_cast<float>(m_numSamples);
             m_currentMeanSq += diff * (value - m_currentMean);
@@ -128,10 +171,23 @@ namespace AC
                 m_currentVariance = m_currentMeanSq / (static_cast<float>(m_numSamples - 1));
         }
 
+        // Add a new value with a (positive) frequency weight, as if it had been pushed 'weight' times (West, 1979). With unit weights, this is the same as Push(value).
+        void Push(T value, double weight)
+        {
+            ++m_numSamples;
+            m_sumWeights += weight;
+            T diff = value - m_currentMean;
+            m_currentMean += diff * static_cast<float>(weight) / static_cast<float>(m_sumWeights);
+            m_currentMeanSq += static_cast<float>(weight) * diff * (value - m_currentMean);
+            if (m_sumWeights > 1)
+                m_currentVariance = m_currentMeanSq / (static_cast<float>(m_sumWeights - 1));
+        }
+
         // Reset calculations
         void Reset()
         {
             m_numSamples = 0;
+            m_sumWeights = 0;
             SetZero(m_currentMean);
             SetZero(m_currentMeanSq);
             SetZero(m_currentVariance);
@@ -140,6 +196,9 @@ namespace AC
         // Get current number of samples
         size_t NumSamples() { return m_numSamples; }
 
+        // Get the sum of the weights of all samples (the number of samples if they were pushed without weight)
+        double SumWeights() const { return m_sumWeights; }
+
         // Get current mean
         T Mean() { return m_currentMean; }
 
@@ -148,6 +207,7 @@ namespace AC
 
     private:
         size_t m_numSamples;
+        double m_sumWeights;
         T m_currentMeanSq;
         T m_currentMean;
         T m_currentVariance;
@@ -223,5 +283,47 @@ namespace AC
             arg != std::numeric_limits<T>::infinity() &&
             arg != -std::numeric_limits<T>::infinity();
     }
+
+    //----------------------------------------------------------------------------
+    /// <summary> Collapse repeated observations (e.g., the identical colours of the pixels in flat or saturated image regions) into the
+    ///           distinct values and the number of times each one appears, with a hash table in a single pass. The distinct values are
+    ///           returned in order of first appearance, so the output is deterministic. Use the counts as the weights of the weighted
+    ///           versions of KMeans::Process, EM::Process and GMM::Process, whose cost then scales with the number of distinct values. </summary>
+    /// <typeparam name="typename Vec"> Type of the observations (any Eigen vector). </typeparam>
+    /// <param name="observations"> N-vector of observations. </param>
+    /// <param name="uniqueObservations"> [out] The distinct observations (exact comparison, with 0 == -0). </param>
+    /// <param name="counts"> [out] Number of times each distinct observation appears in 'observations'. </param>
+    /// <param name="indices"> [out, optional] N-vector with the index in uniqueObservations of each observation. Can be nullptr. </param>
+    template <typename Vec>
+    void CountUniqueObservations(const std::vector<Vec>& observations, std::vector<Vec>& uniqueObservations, std::vector<double>& counts,
+        std::vector<int>* indices = nullptr)
+    {
+        // The table stores indices into 'observations', so that no (possibly aligned) Eigen type is stored in the nodes
+        auto hash = [&](size_t i) {
+            size_t seed = 0;
+            for (int d = 0; d < observations[i].size(); ++d) {
+                typename Vec::Scalar value = observations[i][d] + (typename Vec::Scalar)0; // -0 + 0 = +0, so that both hash the same
+                seed ^= std::hash<typename Vec::Scalar>()(value) + 0x9E3779B9 + (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        };
+        auto equal = [&](size_t i, size_t j) { return observations[i] == observations[j]; };
+        std::unordered_map<size_t, int, decltype(hash), decltype(equal)> uniqueIndices(observations.size() / 4 + 1, hash, equal);
+
+        uniqueObservations.clear();
+        counts.clear();
+        if (indices != nullptr)
+            indices->resize(observations.size());
+        for (size_t i = 0; i < observations.size(); ++i) {
+            auto inserted = uniqueIndices.emplace(i, (int)uniqueObservations.size());
+            if (inserted.second) {
+                uniqueObservations.push_back(observations[i]);
+                counts.push_back(0);
+            }
+            counts[inserted.first->second] += 1;
+            if (indices != nullptr)
+                (*indices)[i] = inserted.first->second;
+        }
+    }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,128 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __OBSERVATION_SUMMARY_H__
+#define __OBSERVATION_SUMMARY_H__
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "math_utils.h"
+#include "random_generator.h"
+#include "parallel.h"
+
+namespace AC
+{
+    const double c_SummaryDefaultCellSize = 1.0; // Initial size of the histogram cells (e.g., one intensity level for 8-bit colours)
+    const size_t c_SummaryDefaultMaxBins = 1 << 16; // Max number of non-empty cells before the histogram is coarsened
+    const int c_SummaryDefaultResolution = 256; // Number of cells across the widest dimension of the data, for cell sizes derived from the data (see CellSizeFor)
+
+    /// <summary> Weighted summary of a (huge) set of observations, to train KMeans/EM on a few thousand weighted representatives instead of
+    ///           millions of observations. The observations are binned into a sparse histogram of cubic cells of size CellSize(), and each
+    ///           non-empty cell is represented by the mean of its observations, weighted by their number (or total weight). Every observation
+    ///           is therefore within MaxError() = CellSize() * sqrt(D) of its representative. Whenever the histogram has more than maxBins
+    ///           non-empty cells, the cell size doubles and each group of 2^D cells merges into one; since the cells of every size are
+    ///           aligned to the same grid, this is exact, and two summaries with the same initial cell size can always be merged. The
+    ///           summary is built in a single streaming pass (see Push), and the per-thread or per-chunk summaries are merged with Merge. </summary>
+    template <typename Vec>
+    class ObservationSummary {
+    public:
+        typedef Eigen::Matrix<double, Vec::RowsAtCompileTime, 1> VecD;
+        typedef Eigen::Matrix<int64_t, Vec::RowsAtCompileTime, 1> CellType;
+
+        /// <summary> Constructor. </summary>
+        /// <param name="cellSize"> [optional] Initial size of the cells (the finest resolution of the summary). </param>
+        /// <param name="maxBins"> [optional] Max number of non-empty cells. The cell size doubles as needed to stay below it. </param>
+        ObservationSummary(double cellSize = c_SummaryDefaultCellSize, size_t maxBins = c_SummaryDefaultMaxBins);
+
+        /// <summary> Cell size that splits the widest dimension of the observations in 'resolution' cells (e.g., about one intensity level for
+        ///           8-bit colours), so that the summary has the same resolution whatever the units or scaling of the observations. </summary>
+        /// <returns> The cell size, or c_SummaryDefaultCellSize if the observations are empty or all equal. </returns>
+        static double CellSizeFor(const std::vector<Vec>& observations, int resolution = c_SummaryDefaultResolution);
+
+        /// <summary> Add one observation with the given weight. </summary>
+        void Push(const Vec& observation, double weight = 1.0);
+
+        /// <summary> Add a set of observations, split in numThreads contiguous shards that are summarized concurrently and merged in a fixed
+        ///           order (so the summary is identical for a given number of threads). </summary>
+        /// <param name="observations"> The observations. </param>
+        /// <param name="numThreads"> [optional] Number of threads (0 = all hardware threads). </param>
+        void Push(const std::vector<Vec>& observations, int numThreads = 1);
+
+        /// <summary> Add the observations summarized in 'rhs', which must have the same initial cell size. The result has the coarser cell
+        ///           size of both (or coarser, to stay below maxBins). </summary>
+        void Merge(const ObservationSummary& rhs);
+
+        /// <summary> Get the weighted representatives of the summary, i.e., the mean and the weight of the observations in each cell, in order
+        ///           of first appearance. Use them with the weighted versions of KMeans::Process, EM::Process and GMM::Process. </summary>
+        /// <param name="representatives"> [out] The mean of the observations in each non-empty cell. </param>
+        /// <param name="weights"> [out] The total weight of the observations in each non-empty cell. </param>
+        void Representatives(std::vector<Vec>& representatives, std::vector<double>& weights) const;
+
+        /// <summary> Remove all observations (and go back to the initial cell size). </summary>
+        void Clear();
+
+        size_t NumBins() const { return m_bins.size(); }
+        double CellSize() const { return std::ldexp(m_initialCellSize, m_level); }
+        double SumWeights() const { return m_sumWeights; }
+
+        /// <summary> Max distance of an observation to its representative (the diagonal of a cell). </summary>
+        double MaxError() const { return CellSize() * sqrt((double)m_dimensions); }
+
+    private:
+        struct Bin {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            CellType cell;  // Integer coordinates of the cell, i.e., floor(x / CellSize())
+            VecD sum;       // Weighted sum of the observations in the cell
+            double weight;  // Sum of the weights of the observations in the cell
+            int next;       // Next bin whose cell has the same hash (-1 if none)
+        };
+
+        /// <summary> Add the weighted sum of some observations to the bin of 'cell'. </summary>
+        void Accumulate(const CellType& cell, const VecD& sum, double weight);
+
+        /// <summary> Double the cell size, merging the bins that fall in the same cell. </summary>
+        void Coarsen();
+
+        static uint64_t Hash(const CellType& cell);
+
+        AlignedVector<Bin> m_bins; // Non-empty cells, in order of first appearance
+        std::unordered_map<uint64_t, int> m_firstBins; // First bin of each cell hash (the rest are chained through Bin::next)
+        double m_initialCellSize; // Cell size of an empty summary (all cell sizes are initialCellSize * 2^n)
+        int m_level; // Current cell size is initialCellSize * 2^level
+        size_t m_maxBins; // Max number of non-empty cells
+        double m_sumWeights; // Total weight of the observations
+        int m_dimensions; // Number of dimensions of the observations (0 until the first one)
+    };
+
+    typedef ObservationSummary<Vec3> ObservationSummary3D;
+}
+
+#include "observation_summary.inl"
+
+#endif
@@ -0,0 +1,202 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+//----------------------------------------------------------------------------
+template <typename Vec>
+AC::ObservationSummary<Vec>::ObservationSummary(double cellSize, size_t maxBins)
+    : m_initialCellSize(cellSize)
+    , m_level(0)
+    , m_maxBins(std::max<size_t>(maxBins, 1))
+    , m_sumWeights(0)
+    , m_dimensions(0)
+{
+    _ASSERT(cellSize > 0 && L"The cell size must be positive");
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+double AC::ObservationSummary<Vec>::CellSizeFor(const std::vector<Vec>& observations, int resolution)
+{
+    _ASSERT(resolution > 0 && L"The resolution must be positive");
+    if (observations.empty())
+        return c_SummaryDefaultCellSize;
+    VecD minValues = observations[0].template cast<double>();
+    VecD maxValues = minValues;
+    for (const auto& observation : observations) {
+        minValues = minValues.cwiseMin(observation.template cast<double>());
+        maxValues = maxValues.cwiseMax(observation.template cast<double>());
+    }
+    double range = (maxValues - minValues).maxCoeff();
+    return range > 0 && IsFinite(range) ? range / resolution : c_SummaryDefaultCellSize;
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Clear()
+{
+    m_bins.clear();
+    m_firstBins.clear();
+    m_level = 0;
+    m_sumWeights = 0;
+    m_dimensions = 0;
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+uint64_t AC::ObservationSummary<Vec>::Hash(const CellType& cell)
+{
+    uint64_t hash = 0;
+    for (int d = 0; d < cell.size(); ++d)
+        hash = SplitMix64::Mix(hash ^ (uint64_t)cell[d]);
+    return hash;
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Push(const Vec& observation, double weight)
+{
+    VecD x = observation.template cast<double>();
+    double cellSize = CellSize();
+    CellType cell(x.size());
+    for (int d = 0; d < x.size(); ++d)
+        cell[d] = (int64_t)std::floor(x[d] / cellSize);
+    m_dimensions = (int)x.size();
+    m_sumWeights += weight;
+    Accumulate(cell, weight * x, weight);
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Push(const std::vector<Vec>& observations, int numThreads)
+{
+    numThreads = ResolveNumThreads(numThreads);
+    if (numThreads == 1) {
+        for (const auto& observation : observations)
+            Push(observation);
+        return;
+    }
+
+    std::vector<ObservationSummary<Vec>> summaries(numThreads, ObservationSummary<Vec>(m_initialCellSize, m_maxBins));
+    ParallelFor(observations.size(), numThreads, [&](int idxThread, size_t begin, size_t end) {
+        for (size_t o = begin; o < end; ++o)
+            summaries[idxThread].Push(observations[o]);
+    });
+
+    // Merge in a fixed order, so that the result only depends on the number of threads
+    for (const auto& summary : summaries)
+        Merge(summary);
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Merge(const ObservationSummary& rhs)
+{
+    _ASSERT(m_initialCellSize == rhs.m_initialCellSize && L"Summaries must have the same initial cell size to be merged");
+    if (rhs.m_bins.empty())
+        return;
+    while (m_level < rhs.m_level)
+        Coarsen();
+
+    // Bring the cells of rhs to our (coarser or equal) grid. We may coarsen while merging, so the shift is computed for each bin.
+    for (const auto& bin : rhs.m_bins) {
+        CellType cell = bin.cell;
+        for (int d = 0; d < cell.size(); ++d)
+            cell[d] >>= (m_level - rhs.m_level); // Arithmetic shift, i.e., floor(cell / 2^shift) also for negative cells
+        Accumulate(cell, bin.sum, bin.weight);
+    }
+    m_sumWeights += rhs.m_sumWeights;
+    m_dimensions = rhs.m_dimensions;
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Accumulate(const CellType& cell, const VecD& sum, double weight)
+{
+    uint64_t hash = Hash(cell);
+    auto inserted = m_firstBins.emplace(hash, (int)m_bins.size());
+    if (!inserted.second) {
+        // Walk the (usually single) bins with this hash
+        int idx = inserted.first->second;
+        while (true) {
+            Bin& bin = m_bins[idx];
+            if (bin.cell == cell) {
+                bin.sum += sum;
+                bin.weight += weight;
+                return;
+            }
+            if (bin.next < 0) {
+                bin.next = (int)m_bins.size();
+                break;
+            }
+            idx = bin.next;
+        }
+    }
+
+    Bin bin;
+    bin.cell = cell;
+    bin.sum = sum;
+    bin.weight = weight;
+    bin.next = -1;
+    m_bins.push_back(bin);
+    if (m_bins.size() > m_maxBins)
+        Coarsen();
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Coarsen()
+{
+    // Cells of size 2s are aligned with those of size s, so each new cell is the exact union of 2^D old ones. If the bins still do not
+    // fit, Accumulate() coarsens again.
+    AlignedVector<Bin> bins;
+    bins.swap(m_bins);
+    m_firstBins.clear();
+    ++m_level;
+    size_t maxBins = m_maxBins;
+    m_maxBins = std::numeric_limits<size_t>::max(); // Rebuild the whole histogram before checking the size again
+    for (const auto& bin : bins) {
+        CellType cell = bin.cell;
+        for (int d = 0; d < cell.size(); ++d)
+            cell[d] >>= 1;
+        Accumulate(cell, bin.sum, bin.weight);
+    }
+    m_maxBins = maxBins;
+    if (m_bins.size() > m_maxBins)
+        Coarsen();
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+void AC::ObservationSummary<Vec>::Representatives(std::vector<Vec>& representatives, std::vector<double>& weights) const
+{
+    representatives.resize(m_bins.size());
+    weights.resize(m_bins.size());
+    for (size_t b = 0; b < m_bins.size(); ++b) {
+        representatives[b] = (m_bins[b].sum / m_bins[b].weight).template cast<typename Vec::Scalar>();
+        weights[b] = m_bins[b].weight;
+    }
+}
@@ -0,0 +1,204 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "online_em.h"
+#include "parallel.h"
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+AC::GMM::OnlineEM<Dims, Scalar>::OnlineEM(double forgettingFactor, int numThreads)
+    : m_forgettingFactor(1.0)
+{
+    setForgettingFactor(forgettingFactor);
+    setNumThreads(numThreads);
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::OnlineEM<Dims, Scalar>::setForgettingFactor(double forgettingFactor)
+{
+    _ASSERT(forgettingFactor > 0 && forgettingFactor <= 1 && L"The forgetting factor must be in (0, 1]");
+    m_forgettingFactor = forgettingFactor;
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::OnlineEM<Dims, Scalar>::Initialize(const GMMType& gmm, double numObservations)
+{
+    int numModes = (int)gmm.Modes().size();
+    m_statistics.resize(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        m_statistics[k].Reset(gmm.Modes(k)->Mean().template cast<double>(), gmm.covarianceType());
+        m_statistics[k].SetMoments(numObservations * gmm.Modes(k)->Weight(), gmm.Modes(k)->Covariance().template cast<double>());
+    }
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::OnlineEM<Dims, Scalar>::EffectiveNumObservations() const
+{
+    double sumResponsibilities = 0;
+    for (const auto& statistics : m_statistics)
+        sumResponsibilities += statistics.SumResponsibilities();
+    return sumResponsibilities;
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::OnlineEM<Dims, Scalar>::Update(const std::vector<VecType>& observations, GMMType& gmm)
+{
+    double logLikelihood = FoldBatch(observations, gmm, m_forgettingFactor, 1.0);
+    double totalWeight = EffectiveNumObservations();
+    if (totalWeight > 0)
+        gmm.SetGlobalWeight(log(totalWeight));
+    return logLikelihood;
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::OnlineEM<Dims, Scalar>::Update(const std::vector<VecType>& observations, GMMType& gmm, double stepSize)
+{
+    _ASSERT(stepSize > 0 && stepSize <= 1 && L"The step size must be in (0, 1]");
+    if (observations.empty())
+        return 0;
+    return FoldBatch(observations, gmm, 1.0 - stepSize, stepSize / observations.size());
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::OnlineEM<Dims, Scalar>::FoldBatch(const std::vector<VecType>& observations, GMMType& gmm, double pastWeight, double batchWeight)
+{
+    int numModes = (int)gmm.Modes().size();
+    if (m_statistics.size() != (size_t)numModes)
+        Initialize(gmm, 0);
+
+    // E-step over the new batch only. The statistics are accumulated around the current means, as in EM.
+    m_tmpStatistics.resize(m_numThreads);
+    m_tmpLogProbabilities.resize(m_numThreads);
+    m_tmpLogLikelihoods.assign(m_numThreads, 0.0);
+    ParallelFor(observations.size(), m_numThreads, [&](int idxThread, size_t begin, size_t end) {
+        AlignedVector<StatisticsType>& statistics = m_tmpStatistics[idxThread];
+        statistics.resize(numModes);
+        for (int k = 0; k < numModes; ++k)
+            statistics[k].Reset(gmm.Modes(k)->Mean().template cast<double>(), gmm.covarianceType());
+        m_tmpLogLikelihoods[idxThread] = AccumulateStatistics(observations, gmm, begin, end, statistics, m_tmpLogProbabilities[idxThread]);
+    });
+
+    // Forget the past statistics, and fold in those of the batch (in a fixed order, so that the result only depends on the number of threads)
+    double logLikelihood = 0;
+    for (int k = 0; k < numModes; ++k) {
+        m_statistics[k].Recenter(m_tmpStatistics[0][k].Shift());
+        m_statistics[k].Scale(pastWeight);
+    }
+    for (int t = 0; t < m_numThreads; ++t) {
+        for (int k = 0; k < numModes; ++k) {
+            if (batchWeight != 1.0)
+                m_tmpStatistics[t][k].Scale(batchWeight);
+            m_statistics[k].Merge(m_tmpStatistics[t][k]);
+        }
+        logLikelihood += m_tmpLogLikelihoods[t];
+    }
+
+    UpdateModes(gmm);
+    return IsFinite(logLikelihood) ? logLikelihood : -std::numeric_limits<double>::max();
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::OnlineEM<Dims, Scalar>::AccumulateStatistics(const std::vector<VecType>& observations, const GMMType& gmm, size_t begin, size_t end,
+    AlignedVector<StatisticsType>& statistics, std::vector<double>& logProbabilities)
+{
+    int numModes = (int)gmm.Modes().size();
+    logProbabilities.resize(numModes);
+    double logLikelihood = 0;
+    for (size_t o = begin; o < end; ++o) {
+        // Responsibilities with the log-sum-exp trick (see EM::UpdateResponsibilities), pushed directly into the statistics
+        double maxLogProbability = -std::numeric_limits<double>::max();
+        for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+            double logProbability = gmm.Modes(idxMode)->EvaluateLog(observations[o]) + gmm.Modes(idxMode)->LogWeight();
+            logProbabilities[idxMode] = logProbability;
+            if (logProbability > maxLogProbability)
+                maxLogProbability = logProbability;
+        }
+
+        double expsum = 0;
+        for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+            logProbabilities[idxMode] = exp(logProbabilities[idxMode] - maxLogProbability);
+            expsum += logProbabilities[idxMode];
+        }
+        logLikelihood += maxLogProbability + log(expsum);
+
+        for (int idxMode = 0; idxMode < numModes; ++idxMode) {
+            double responsibility = logProbabilities[idxMode] / expsum;
+            if (IsFinite(responsibility) && responsibility > 0)
+                statistics[idxMode].Push(observations[o], responsibility);
+        }
+    }
+    return logLikelihood;
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::OnlineEM<Dims, Scalar>::UpdateModes(GMMType& gmm)
+{
+    int numModes = (int)gmm.Modes().size();
+    double totalWeight = EffectiveNumObservations();
+    if (!(totalWeight > 0))
+        return;
+
+    bool tied = gmm.covarianceType() == CovarianceType::Tied;
+    typename StatisticsType::MatD pooledCovariance = StatisticsType::MatD::Zero(gmm.Dimensions(), gmm.Dimensions());
+    for (int k = 0; k < numModes; ++k) {
+        const StatisticsType& statistics = m_statistics[k];
+        gmm.Modes(k)->setWeight(std::max(statistics.SumResponsibilities() / totalWeight, c_SafeMinWeight));
+
+        // A mode that has (almost) not been seen for a while keeps its mean and covariance, only its weight decays
+        if (statistics.SumResponsibilities() <= c_SafeMinWeight * totalWeight)
+            continue;
+        typename StatisticsType::VecD mean = statistics.Mean(statistics.SumResponsibilities());
+        gmm.Modes(k)->setMean(mean.template cast<Scalar>());
+        if (!tied)
+            gmm.Modes(k)->setCovariance(statistics.Covariance(mean, statistics.SumResponsibilities()).template cast<Scalar>());
+        else
+            pooledCovariance += statistics.Covariance(mean, totalWeight);
+    }
+
+    // Tied modes share one covariance, the sum of the scatter matrices of all modes over the total weight (see EM::UpdateModes)
+    if (tied) {
+        typename GMMType::MatType covariance = pooledCovariance.template cast<Scalar>();
+        for (int k = 0; k < numModes; ++k)
+            gmm.Modes(k)->setCovariance(covariance);
+    }
+}
+
+// Supported dimensions and scalar types (same as GMM)
+#define AC_ONLINE_EM_INSTANTIATE(Dims) \
+    template class AC::GMM::OnlineEM<Dims, double>; \
+    template class AC::GMM::OnlineEM<Dims, float>;
+AC_ONLINE_EM_INSTANTIATE(2) AC_ONLINE_EM_INSTANTIATE(3) AC_ONLINE_EM_INSTANTIATE(4) AC_ONLINE_EM_INSTANTIATE(5)
+AC_ONLINE_EM_INSTANTIATE(6) AC_ONLINE_EM_INSTANTIATE(7) AC_ONLINE_EM_INSTANTIATE(8) AC_ONLINE_EM_INSTANTIATE(Eigen::Dynamic)
+#undef AC_ONLINE_EM_INSTANTIATE
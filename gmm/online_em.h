@@ -0,0 +1,121 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __ONLINE_EM_H__
+#define __ONLINE_EM_H__
+
+#include "math_utils.h"
+#include "gmm.h"
+#include "em.h"
+#include "parallel.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        const double c_OnlineEMDefaultForgettingFactor = 0.9; // Weight of the past statistics when a new batch is folded in (memory of ~10 batches)
+
+        /// <summary> Online (recursive) EM for a GMM whose data drifts over time, e.g., the colours of a video, frame after frame. The sufficient
+        ///           statistics of every mode (see GaussianStatistics) are kept between batches: each new batch is accumulated in a single E-step,
+        ///           the past statistics are down-weighted by a forgetting factor, and the modes are re-estimated from the sum (one M-step).
+        ///           No past observations are stored, and k-means is never re-run, so the cost of an update only depends on the batch size.
+        ///           With forgetting factor lambda, the batch t-i contributes with weight lambda^i, i.e., the model remembers ~1/(1-lambda) batches. </summary>
+        template <int Dims, typename Scalar = double>
+        class OnlineEM {
+        public:
+            typedef GMM<Dims, Scalar> GMMType;
+            typedef typename GMMType::VecType VecType;
+            typedef GaussianStatistics<Dims> StatisticsType;
+
+            /// <summary> Constructor. </summary>
+            /// <param name="forgettingFactor"> [optional] Weight in (0, 1] of the past statistics when a new batch is folded in (1 = never forget). </param>
+            /// <param name="numThreads"> [optional] Number of threads of the E-step. The per-thread statistics are merged in a fixed order, so the output
+            ///                           is identical for a given number of threads. 0 = all hardware threads. </param>
+            OnlineEM(double forgettingFactor = c_OnlineEMDefaultForgettingFactor, int numThreads = 1);
+
+            /// <summary> Initialize the statistics from a trained GMM (e.g., with GMM::Process on the first frame), as if it had been estimated
+            ///           from numObservations observations. This only sets how much weight the current modes have against the next batch. </summary>
+            /// <param name="gmm"> The trained GMM. </param>
+            /// <param name="numObservations"> Number of observations the GMM represents (e.g., the number of observations it was trained with). </param>
+            void Initialize(const GMMType& gmm, double numObservations);
+
+            /// <summary> Fold a batch of observations into the GMM: E-step over the batch with the current modes, statistics = lambda * statistics +
+            ///           statistics of the batch, and M-step. If the statistics were not initialized for this GMM, they are initialized with weight 0
+            ///           (i.e., the first batch replaces the modes, which must already be roughly initialized). </summary>
+            /// <param name="observations"> The new batch of observations. </param>
+            /// <param name="gmm"> [in,out] The GMM to update. Its modes are replaced by the re-estimated ones, and its global weight is set to log(total weight). </param>
+            /// <returns> The log likelihood of the batch under the GMM before the update, i.e., sum_n log(p(x_n)). </returns>
+            double Update(const std::vector<VecType>& observations, GMMType& gmm);
+
+            /// <summary> Stepwise update (stochastic EM): as Update(), but statistics = (1 - stepSize) * statistics + stepSize * (statistics of the
+            ///           batch) / batchSize, so that the statistics are an average per observation and the forgetting factor is not used. With step
+            ///           sizes that decay as t^-alpha, alpha in (0.5, 1], this converges to a local maximum of the likelihood (see StochasticEM). </summary>
+            /// <param name="observations"> The new batch of observations. </param>
+            /// <param name="gmm"> [in,out] The GMM to update. </param>
+            /// <param name="stepSize"> Weight in (0, 1] of the batch (1 = replace the statistics). </param>
+            /// <remarks> The global weight of the GMM is not changed, since the statistics are averages per observation (see StochasticEM::Process). </remarks>
+            /// <returns> The log likelihood of the batch under the GMM before the update, i.e., sum_n log(p(x_n)). </returns>
+            double Update(const std::vector<VecType>& observations, GMMType& gmm, double stepSize);
+
+            /// <summary> Sets the weight in (0, 1] of the past statistics when a new batch is folded in. </summary>
+            void setForgettingFactor(double forgettingFactor);
+            double ForgettingFactor() const { return m_forgettingFactor; }
+
+            /// <summary> Sets the number of threads used in the E-step (0 = all hardware threads). </summary>
+            void setNumThreads(int numThreads) { m_numThreads = ResolveNumThreads(numThreads); }
+
+            /// <summary> Total (forgotten) weight of all the observations folded in so far, i.e., the sum of all responsibilities in the statistics. </summary>
+            double EffectiveNumObservations() const;
+
+        private:
+            /// <summary> E-step over the batch, statistics = pastWeight * statistics + batchWeight * statistics of the batch, and M-step. </summary>
+            /// <returns> The log likelihood of the batch under the GMM before the update. </returns>
+            double FoldBatch(const std::vector<VecType>& observations, GMMType& gmm, double pastWeight, double batchWeight);
+
+            /// <summary> E-step on the shard of observations [begin, end), accumulating the statistics of every mode. </summary>
+            /// <param name="statistics"> [in,out] k-Vector of statistics owned by the calling thread (already reset). </param>
+            /// <param name="logProbabilities"> [in,out] k-Vector of scratch memory owned by the calling thread. </param>
+            /// <returns> The log likelihood of the observations in [begin, end). </returns>
+            double AccumulateStatistics(const std::vector<VecType>& observations, const GMMType& gmm, size_t begin, size_t end,
+                AlignedVector<StatisticsType>& statistics, std::vector<double>& logProbabilities);
+
+            /// <summary> Updates the GMM weights, means and covariance matrices from m_statistics (the M-step, see EM::UpdateModes). </summary>
+            void UpdateModes(GMMType& gmm);
+
+            AlignedVector<StatisticsType> m_statistics; // k-Vector with the (forgotten) sufficient statistics of each mode
+            std::vector<AlignedVector<StatisticsType>> m_tmpStatistics; // Per-thread k-Vector with the statistics of the current batch
+            std::vector<std::vector<double>> m_tmpLogProbabilities; // Per-thread k-Vector (temporary) to store log(p(x_n|k)) + log(P(k))
+            std::vector<double> m_tmpLogLikelihoods; // Per-thread log likelihood of its shard of the batch
+            double m_forgettingFactor; // Weight of the past statistics when a new batch is folded in
+            int m_numThreads; // Number of threads (shards of observations) used in the E-step
+        };
+        typedef OnlineEM<3, double> OnlineEM3D;
+        typedef OnlineEM<3, float> OnlineEM3Df;
+    }
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace AC
+{
+    //----------------------------------------------------------------------------
+    /// <summary> Number of threads to use for a requested thread count. A requested count of 0 (or less) means "use all hardware threads". </summary>
+    /// <param name="numThreads"> The requested number of threads. </param>
+    /// <returns> The number of threads to use (always >= 1). </returns>
+    inline int ResolveNumThreads(int numThreads)
+    {
+        if (numThreads > 0)
+            return numThreads;
+        int numHardwareThreads = (int)std::thread::hardware_concurrency();
+        return numHardwareThreads > 0 ? numHardwareThreads : 1;
+    }
+
+    //----------------------------------------------------------------------------
+    /// <summary> Split the range [0, numItems) into numThreads contiguous shards and process them concurrently, calling func(idxThread, begin, end) once per shard.
+    ///           The shards depend only on numItems and numThreads, so reducing per-thread results in idxThread order is deterministic.
+    ///           The calling thread processes shard 0. The other threads are created and joined in every call (there is no thread pool), which
+    ///           costs some tens of microseconds per call, so each shard should take much longer than that (e.g., an E-step over a large set). </summary>
+    /// <param name="numItems"> Number of items to process. </param>
+    /// <param name="numThreads"> Number of shards/threads (use ResolveNumThreads() to translate 0 into the hardware concurrency). </param>
+    /// <param name="func"> Callable with signature void(int idxThread, size_t begin, size_t end). </param>
+    template <typename Func>
+    void ParallelFor(size_t numItems, int numThreads, Func func)
+    {
+        numThreads = std::max(1, numThreads);
+        if (numThreads == 1) {
+            func(0, size_t(0), numItems);
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        threads.reserve(numThreads - 1);
+        for (int t = 1; t < numThreads; ++t)
+            threads.emplace_back(func, t, (numItems * t) / numThreads, (numItems * (t + 1)) / numThreads);
+        func(0, size_t(0), numItems / numThreads);
+        for (auto& thread : threads)
+            thread.join();
+    }
+}
+
+#endif
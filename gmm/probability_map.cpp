@@ -0,0 +1,216 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <cmath>
+#include "probability_map.h"
+#include "gmm.h"
+#include "parallel.h"
+
+// Local helper functions
+namespace
+{
+    using AC::GMM::c_CompiledBlockSize;
+    using AC::GMM::ImageView;
+    using AC::GMM::PixelType;
+    using AC::GMM::ProbabilityMapView;
+
+    //----------------------------------------------------------------------------
+    template <typename Channel>
+    ImageView MakeImageView(const Channel* data, int width, int height, size_t rowStride, size_t pixelStride, size_t channelStride)
+    {
+        ImageView image;
+        image.data = data;
+        image.width = width;
+        image.height = height;
+        image.type = sizeof(Channel) == 1 ? PixelType::UInt8 : PixelType::Float32;
+        image.rowStride = rowStride;
+        image.pixelStride = pixelStride;
+        image.channelStride = channelStride;
+        return image;
+    }
+
+    //----------------------------------------------------------------------------
+    template <typename Value>
+    ProbabilityMapView MakeProbabilityMapView(Value* data, int width, int height, size_t rowStride)
+    {
+        ProbabilityMapView map;
+        map.data = data;
+        map.width = width;
+        map.height = height;
+        map.type = sizeof(Value) == 1 ? PixelType::UInt8 : PixelType::Float32;
+        map.rowStride = rowStride == 0 ? width * sizeof(Value) : rowStride;
+        return map;
+    }
+
+    //----------------------------------------------------------------------------
+    // Read a block of (at most c_CompiledBlockSize) pixels of a row into structure-of-arrays form. The rest of the block is zeroed.
+    template <typename Channel>
+    void LoadBlock(const ImageView& image, int row, int col, int numPixels, double* xs, double* ys, double* zs)
+    {
+        const char* pixel = static_cast<const char*>(image.data) + row * image.rowStride + col * image.pixelStride;
+        for (int i = 0; i < numPixels; ++i, pixel += image.pixelStride) {
+            xs[i] = *reinterpret_cast<const Channel*>(pixel);
+            ys[i] = *reinterpret_cast<const Channel*>(pixel + image.channelStride);
+            zs[i] = *reinterpret_cast<const Channel*>(pixel + 2 * image.channelStride);
+        }
+        for (int i = numPixels; i < c_CompiledBlockSize; ++i)
+            xs[i] = ys[i] = zs[i] = 0;
+    }
+
+    //----------------------------------------------------------------------------
+    void StoreBlock(const ProbabilityMapView& map, int row, int col, int numPixels, const double* probabilities)
+    {
+        char* rowData = static_cast<char*>(map.data) + row * map.rowStride;
+        if (map.type == PixelType::UInt8) {
+            unsigned char* values = reinterpret_cast<unsigned char*>(rowData) + col;
+            for (int i = 0; i < numPixels; ++i)
+                values[i] = (unsigned char)(probabilities[i] * 255.0 + 0.5);
+        }
+        else {
+            float* values = reinterpret_cast<float*>(rowData) + col;
+            for (int i = 0; i < numPixels; ++i)
+                values[i] = (float)probabilities[i];
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::ImageView AC::GMM::ImageView::Interleaved(const unsigned char* data, int width, int height, size_t rowStride, int numChannels)
+{
+    return MakeImageView(data, width, height, rowStride == 0 ? width * numChannels : rowStride, numChannels, 1);
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::ImageView AC::GMM::ImageView::Interleaved(const float* data, int width, int height, size_t rowStride, int numChannels)
+{
+    return MakeImageView(data, width, height, rowStride == 0 ? width * numChannels * sizeof(float) : rowStride, numChannels * sizeof(float), sizeof(float));
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::ImageView AC::GMM::ImageView::Planar(const unsigned char* data, int width, int height, size_t rowStride, size_t planeStride)
+{
+    rowStride = rowStride == 0 ? width : rowStride;
+    return MakeImageView(data, width, height, rowStride, 1, planeStride == 0 ? height * rowStride : planeStride);
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::ImageView AC::GMM::ImageView::Planar(const float* data, int width, int height, size_t rowStride, size_t planeStride)
+{
+    rowStride = rowStride == 0 ? width * sizeof(float) : rowStride;
+    return MakeImageView(data, width, height, rowStride, sizeof(float), planeStride == 0 ? height * rowStride : planeStride);
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::ProbabilityMapView AC::GMM::ProbabilityMapView::Create(unsigned char* data, int width, int height, size_t rowStride)
+{
+    return MakeProbabilityMapView(data, width, height, rowStride);
+}
+
+//----------------------------------------------------------------------------
+AC::GMM::ProbabilityMapView AC::GMM::ProbabilityMapView::Create(float* data, int width, int height, size_t rowStride)
+{
+    return MakeProbabilityMapView(data, width, height, rowStride);
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::PosteriorsBlock(const CompiledGMM3D* const* models, int numModels, const double* xs, const double* ys, const double* zs, int numObservations,
+    double* logTerms, double* posteriors)
+{
+    // log p(x|m), including the global weight of each model
+    for (int m = 0; m < numModels; ++m) {
+        double* logLikelihoods = posteriors + m * c_CompiledBlockSize;
+        models[m]->LogLikelihoodsBlock(xs, ys, zs, numObservations, logTerms, logLikelihoods);
+        double logGlobalWeight = log(models[m]->GlobalWeight());
+        for (int i = 0; i < numObservations; ++i)
+            logLikelihoods[i] += logGlobalWeight;
+    }
+
+    // Posteriors with the log-sum-exp trick: P(m|x) = exp(l_m - l_max) / sum_j(exp(l_j - l_max)), computed in place
+    for (int i = 0; i < numObservations; ++i) {
+        double maxLogLikelihood = -std::numeric_limits<double>::infinity();
+        for (int m = 0; m < numModels; ++m)
+            maxLogLikelihood = std::max(maxLogLikelihood, posteriors[m * c_CompiledBlockSize + i]);
+        double expsum = 0;
+        for (int m = 0; m < numModels; ++m) {
+            posteriors[m * c_CompiledBlockSize + i] = exp(posteriors[m * c_CompiledBlockSize + i] - maxLogLikelihood);
+            expsum += posteriors[m * c_CompiledBlockSize + i];
+        }
+        for (int m = 0; m < numModels; ++m) {
+            double probability = posteriors[m * c_CompiledBlockSize + i] / expsum;
+            posteriors[m * c_CompiledBlockSize + i] = IsFinite(probability) ? probability : 0;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ProbabilityMap(const CompiledGMM3D* const* models, int numModels, const ImageView& image, const ProbabilityMapView* maps, int numThreads)
+{
+    if (numModels <= 0 || image.width <= 0 || image.height <= 0)
+        return;
+
+    size_t scratchSize = 0;
+    for (int m = 0; m < numModels; ++m) {
+        _ASSERT((maps[m].data == nullptr || (maps[m].width == image.width && maps[m].height == image.height)) && L"Maps must have the size of the image");
+        scratchSize = std::max(scratchSize, models[m]->BlockScratchSize());
+    }
+
+    // Choose the pixel reader once per image, not per pixel
+    auto loadBlock = image.type == PixelType::UInt8 ? &LoadBlock<unsigned char> : &LoadBlock<float>;
+
+    ParallelFor(image.height, ResolveNumThreads(numThreads), [&](int, size_t beginRow, size_t endRow) {
+        // Scratch memory of this band of rows: the block of pixels, the posteriors of each model, and the kernels' scratch
+        std::vector<double> scratch((3 + numModels) * c_CompiledBlockSize + scratchSize);
+        double* xs = scratch.data();
+        double* ys = xs + c_CompiledBlockSize;
+        double* zs = ys + c_CompiledBlockSize;
+        double* posteriors = zs + c_CompiledBlockSize;
+        double* logTerms = posteriors + numModels * c_CompiledBlockSize;
+
+        for (int row = (int)beginRow; row < (int)endRow; ++row) {
+            for (int col = 0; col < image.width; col += c_CompiledBlockSize) {
+                int numPixels = std::min(c_CompiledBlockSize, image.width - col);
+                loadBlock(image, row, col, numPixels, xs, ys, zs);
+                PosteriorsBlock(models, numModels, xs, ys, zs, numPixels, logTerms, posteriors);
+                for (int m = 0; m < numModels; ++m) {
+                    if (maps[m].data != nullptr)
+                        StoreBlock(maps[m], row, col, numPixels, posteriors + m * c_CompiledBlockSize);
+                }
+            }
+        }
+    });
+}
+
+//----------------------------------------------------------------------------
+void AC::GMM::ProbabilityMap(const GMM3D& gmm1, const GMM3D& gmm2, const ImageView& image, const ProbabilityMapView& map, int numThreads)
+{
+    CompiledGMM3D compiled1(gmm1), compiled2(gmm2);
+    const CompiledGMM3D* models[] = { &compiled1, &compiled2 };
+    ProbabilityMapView maps[] = { map, map };
+    maps[1].data = nullptr;
+    ProbabilityMap(models, 2, image, maps, numThreads);
+}
@@ -0,0 +1,114 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __PROBABILITY_MAP_H__
+#define __PROBABILITY_MAP_H__
+
+#include <cstddef>
+#include "compiled_gmm.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        /// <summary> Type of the channels of an image (or of a probability map). </summary>
+        enum class PixelType {
+            UInt8,  // unsigned char
+            Float32 // float
+        };
+
+        /// <summary> Non-owning view of a 3-channel image in an external buffer. Pixel values are used as-is as GMM observations (e.g., 0..255 for
+        ///           8-bit images). Use the Interleaved() and Planar() helpers to create views of common layouts. </summary>
+        struct ImageView
+        {
+            const void* data;    // First channel of the top-left pixel
+            int width;           // Width in pixels
+            int height;          // Height in pixels
+            PixelType type;      // Type of each channel
+            size_t rowStride;    // Bytes between the starts of consecutive rows
+            size_t pixelStride;  // Bytes between consecutive pixels of a row (e.g., 3 * sizeof(channel) for RGB, 4 * sizeof(channel) for RGBA)
+            size_t channelStride; // Bytes between the channels of a pixel (sizeof(channel) if interleaved, the size of a plane if planar)
+
+            /// <summary> View of an interleaved image (RGBRGB..., or with numChannels >= 3, only the first 3 channels are used). </summary>
+            /// <param name="rowStride"> [optional] Bytes between rows. If 0, rows are contiguous. </param>
+            static ImageView Interleaved(const unsigned char* data, int width, int height, size_t rowStride = 0, int numChannels = 3);
+            static ImageView Interleaved(const float* data, int width, int height, size_t rowStride = 0, int numChannels = 3);
+
+            /// <summary> View of a planar image (RR...GG...BB...). </summary>
+            /// <param name="rowStride"> [optional] Bytes between rows of a plane. If 0, rows are contiguous. </param>
+            /// <param name="planeStride"> [optional] Bytes between planes. If 0, planes are contiguous (height * rowStride). </param>
+            static ImageView Planar(const unsigned char* data, int width, int height, size_t rowStride = 0, size_t planeStride = 0);
+            static ImageView Planar(const float* data, int width, int height, size_t rowStride = 0, size_t planeStride = 0);
+        };
+
+        /// <summary> Non-owning view of a single-channel output map. Float maps store probabilities in [0, 1], and 8-bit maps store
+        ///           round(255 * probability). </summary>
+        struct ProbabilityMapView
+        {
+            void* data;       // Top-left pixel
+            int width;        // Width in pixels (must match the image)
+            int height;       // Height in pixels (must match the image)
+            PixelType type;   // Type of each pixel
+            size_t rowStride; // Bytes between the starts of consecutive rows
+
+            /// <param name="rowStride"> [optional] Bytes between rows. If 0, rows are contiguous. </param>
+            static ProbabilityMapView Create(unsigned char* data, int width, int height, size_t rowStride = 0);
+            static ProbabilityMapView Create(float* data, int width, int height, size_t rowStride = 0);
+        };
+
+        /// <summary> Compute the posterior probability P(m|x) = p(x|m) / sum_j(p(x|j)) of each model for a block of (at most c_CompiledBlockSize)
+        ///           observations in structure-of-arrays form (see CompiledGMM3D::LogLikelihoodsBlock()). This is the building block of
+        ///           ProbabilityMap(). Observations where no model has a finite likelihood get 0. </summary>
+        /// <param name="logTerms">    Scratch memory of max_m(models[m]->BlockScratchSize()) doubles. </param>
+        /// <param name="posteriors"> [out] numModels * c_CompiledBlockSize doubles, model-major: posteriors[m * c_CompiledBlockSize + i]. </param>
+        void PosteriorsBlock(const CompiledGMM3D* const* models, int numModels, const double* xs, const double* ys, const double* zs, int numObservations,
+            double* logTerms, double* posteriors);
+
+        /// <summary> Compute, for each pixel x of an image, the posterior probability P(m|x) = p(x|m) / sum_j(p(x|j)) of each of a set of models
+        ///           (e.g., foreground and background GMMs), where p(x|m) includes the global weight of model m (see GMM3D::Likelihood()).
+        ///           All models are evaluated in a single pass over the image, in the log domain, so that pixels far from all models do not
+        ///           underflow. The image is split in bands of rows across threads, and pixels are read directly from the image in blocks of
+        ///           c_CompiledBlockSize, without per-pixel conversions or allocations. Pixels where no model has a finite likelihood get 0. </summary>
+        /// <param name="models">    [in] The compiled models. Their precision and instruction set settings apply. </param>
+        /// <param name="numModels"> [in] Number of models. </param>
+        /// <param name="image">     [in] The input image. </param>
+        /// <param name="maps">      [out] One probability map per model. Maps with null data are not computed (e.g., the background posterior
+        ///                          when only the foreground posterior is needed). </param>
+        /// <param name="numThreads"> [optional] Number of threads (0 = one per hardware thread). </param>
+        void ProbabilityMap(const CompiledGMM3D* const* models, int numModels, const ImageView& image, const ProbabilityMapView* maps, int numThreads = 1);
+
+        /// <summary> Compute the probability of each pixel of an image to be a sample of gmm1 or gmm2, i.e., GMMLikelihoodRatio() for a whole image. </summary>
+        /// <param name="gmm1">  [in] The first (e.g., foreground) gmm. </param>
+        /// <param name="gmm2">  [in] The second (e.g., background) gmm. </param>
+        /// <param name="image"> [in] The input image. </param>
+        /// <param name="map">   [out] The probability of each pixel to be a sample of gmm1. </param>
+        /// <param name="numThreads"> [optional] Number of threads (0 = one per hardware thread). </param>
+        void ProbabilityMap(const GMM3D& gmm1, const GMM3D& gmm2, const ImageView& image, const ProbabilityMapView& map, int numThreads = 1);
+    }
+}
+
+#endif
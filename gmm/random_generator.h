@@ -28,20 +28,82 @@ SOFTWARE.
 #ifndef __RANDOM_GENERATOR_H__
 #define __RANDOM_GENERATOR_H__
 
-#include <random>
+#include <cstdint>
+#include <algorithm>
 
 namespace AC {
 
+    const uint64_t c_DefaultRandomSeed = 0x5EED5EED5EED5EEDull; // Seed of a RandomGenerator (and of KMeans) unless another one is given
+
+    /// <summary> SplitMix64 generator (Steele, Lea and Flood, "Fast splittable pseudorandom number generators", 2014): a 64-bit counter hashed
+    ///           by a strong mixing function. It is tiny, fast, passes BigCrush, and any number of statistically independent streams can be
+    ///           derived from one seed (see RandomGenerator::StreamSeed). Satisfies the UniformRandomBitGenerator requirements. </summary>
+    class SplitMix64 {
+    public:
+        typedef uint64_t result_type;
+
+        explicit SplitMix64(uint64_t seed = c_DefaultRandomSeed) : m_state(seed) {}
+
+        void seed(uint64_t seed) { m_state = seed; }
+
+        uint64_t operator()()
+        {
+            m_state += 0x9E3779B97F4A7C15ull;
+            return Mix(m_state);
+        }
+
+        /// <summary> The SplitMix64 mixing function (a bijection on 64-bit integers). </summary>
+        static uint64_t Mix(uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        static uint64_t min() { return 0; }
+        static uint64_t max() { return ~0ull; }
+
+    private:
+        uint64_t m_state;
+    };
+
+    /// <summary> Seedable random number generator. The numbers are derived from the SplitMix64 output with our own (portable) arithmetic
+    ///           instead of the std distributions, so a given seed produces the same sequence on every platform and standard library. </summary>
     class RandomGenerator {
     public:
-        RandomGenerator() : m_minValue(0), m_maxValue(1), distribution(m_minValue, m_maxValue) {}
-        RandomGenerator(int minValue, int maxValue) : m_minValue(minValue), m_maxValue(maxValue) { distribution.param(std::uniform_int<int>::param_type(minValue, maxValue)); }
+        explicit RandomGenerator(uint64_t seed = c_DefaultRandomSeed) : generator(seed), m_minValue(0), m_maxValue(1) {}
+        RandomGenerator(int minValue, int maxValue, uint64_t seed = c_DefaultRandomSeed) : generator(seed), m_minValue(minValue), m_maxValue(maxValue) {}
+
+        void setLimits(int minValue, int maxValue) { m_minValue = minValue; m_maxValue = maxValue; }
+
+        /// <summary> Restart the sequence of random numbers from the given seed. </summary>
+        void seed(uint64_t seed) { generator.seed(seed); }
 
-        void setLimits(int minValue, int maxValue) { m_minValue = minValue; m_maxValue = maxValue; distribution.param(std::uniform_int<int>::param_type(minValue, maxValue)); }
+        /// <summary> Seed of the independent stream number 'stream' derived from 'seed' (e.g., one stream per k-means restart), so that
+        ///           parallel work items draw reproducible numbers whatever the order in which they run. </summary>
+        static uint64_t StreamSeed(uint64_t seed, uint64_t stream) { return SplitMix64::Mix(seed ^ SplitMix64::Mix(stream + 0x9E3779B97F4A7C15ull)); }
 
         /// <summary> Draw an integer random number in range [minValue, maxValue]. </summary>
         /// <returns> The random number in range [minValue, maxValue]. </returns>
-        int draw() { return distribution(generator); }
+        int draw() { return std::min(m_minValue + (int)(drawReal() * ((double)m_maxValue - m_minValue + 1)), m_maxValue); }
+
+        /// <summary> Draw a real random number in range [0, 1) (53 random bits). </summary>
+        double drawReal() { return (double)(generator() >> 11) * (1.0 / 9007199254740992.0); }
+
+        /// <summary> Draw an index i in [0, weights.size()) with probability weights[i] / sumWeights (e.g., for D^2 sampling in k-means++). </summary>
+        /// <typeparam name="typename Vec"> Type of the typename vector (e.g., std::vector or std::array). </typeparam>
+        /// <param name="weights"> Vector of non-negative weights. </param>
+        /// <param name="sumWeights"> Sum of all weights. If it is not positive, all indices are equally likely. </param>
+        /// <returns> The random index. </returns>
+        template <typename Vec>
+        int drawWeighted(const Vec& weights, double sumWeights);
+
+        /// <summary> Same as drawWeighted, from the cumulative sums of the weights (cumulativeWeights[i] = sum_{j <= i} weights[j]), with a binary
+        ///           search instead of a linear one (e.g., to draw many indices from the same weights). </summary>
+        /// <param name="cumulativeWeights"> Non-decreasing vector of cumulative weights. </param>
+        /// <returns> The random index. </returns>
+        template <typename Vec>
+        int drawCumulative(const Vec& cumulativeWeights);
 
         /// <summary> Return a subset of elements in range [m_minValue, m_maxValue] which are not repeated. </summary>
         /// <typeparam name="typename Vec"> Type of the typename vector (e.g., std::vector or std::array). </typeparam>
@@ -59,8 +121,7 @@ namespace AC {
         bool IsUniqueSampleID(Vec& sampleIDs, int idx);
 
     private:
-        std::default_random_engine generator;
-        std::uniform_int_distribution<int> distribution;
+        SplitMix64 generator;
         int m_minValue;
         int m_maxValue;
         static const int c_MaxIterations = 25; // Maximum number of tries to get a non-repeating subset
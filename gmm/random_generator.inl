@@ -49,7 +49,7 @@ bool AC::RandomGenerator::NonRepeatingSubset(Vec& sampleIDs, int maxTries)
         sampleIDs[i] = draw();
         while (!IsUniqueSampleID<Vec>(sampleIDs, i) && numIterations < c_MaxIterations)
         {
-            sampleIDs[i] = (sampleIDs[i] + 1) % numElements; // Keep changing the random samples until the sequence is unique
+            sampleIDs[i] = m_minValue + (sampleIDs[i] - m_minValue + 1) % (m_maxValue - m_minValue + 1); // Keep changing the random samples until the sequence is unique
             numIterations++;
         }
         if (numIterations == maxTries) // Give up if we try too many times
@@ -73,4 +73,43 @@ bool AC::RandomGenerator::IsUniqueSampleID(Vec& sampleIDs, int idx)
         }
     }
     return unique;
-}
\ No newline at end of file
+}
+//-----------------------------------------------------------------------------
+template <typename Vec>
+int AC::RandomGenerator::drawWeighted(const Vec& weights, double sumWeights)
+{
+    _ASSERT(!weights.empty() && L"Invalid input");
+    int numElements = (int)weights.size();
+    if (!(sumWeights > 0))
+        return std::min((int)(drawReal() * numElements), numElements - 1);
+
+    // Linear search in the cumulative weights. If rounding leaves us past the end, return the last element with some weight.
+    double threshold = drawReal() * sumWeights;
+    double cumulativeWeight = 0;
+    int lastValid = 0;
+    for (int i = 0; i < numElements; ++i) {
+        if (weights[i] <= 0)
+            continue;
+        cumulativeWeight += weights[i];
+        lastValid = i;
+        if (threshold < cumulativeWeight)
+            return i;
+    }
+    return lastValid;
+}
+
+//----------------------------------------------------------------------------
+template <typename Vec>
+int AC::RandomGenerator::drawCumulative(const Vec& cumulativeWeights)
+{
+    _ASSERT(!cumulativeWeights.empty() && L"Invalid input");
+    int numElements = (int)cumulativeWeights.size();
+    double sumWeights = cumulativeWeights[numElements - 1];
+    if (!(sumWeights > 0))
+        return std::min((int)(drawReal() * numElements), numElements - 1);
+
+    // First element whose cumulative weight is above the threshold (so elements with zero weight are never chosen)
+    double threshold = drawReal() * sumWeights;
+    int idx = (int)(std::upper_bound(cumulativeWeights.begin(), cumulativeWeights.end(), threshold) - cumulativeWeights.begin());
+    return std::min(idx, numElements - 1);
+}
@@ -0,0 +1,122 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "stochastic_em.h"
+#include "parallel.h"
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+AC::GMM::StochasticEM<Dims, Scalar>::StochasticEM(int batchSize, double tolerance, int maxIterations, int numThreads)
+    : m_onlineEM(1.0, numThreads)
+    , m_batchSize(batchSize)
+    , m_tolerance(tolerance)
+    , m_maxIterations(maxIterations)
+    , m_numThreads(ResolveNumThreads(numThreads))
+    , m_stepSizeExponent(c_StochasticEMStepSizeExponent)
+    , m_evaluationInterval(c_StochasticEMEvaluationInterval)
+    , m_heldOutLogLikelihood(-std::numeric_limits<double>::max())
+    , m_numIterations(0)
+    , m_numObservations(0)
+{
+    _ASSERT(batchSize > 0 && L"Invalid batch size");
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+void AC::GMM::StochasticEM<Dims, Scalar>::setStepSizeExponent(double exponent)
+{
+    _ASSERT(exponent > 0.5 && exponent <= 1 && L"The step size exponent must be in (0.5, 1]");
+    m_stepSizeExponent = exponent;
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+double AC::GMM::StochasticEM<Dims, Scalar>::EvaluateHeldOut(const std::vector<VecType>& heldOut, const GMMType& gmm)
+{
+    m_tmpLogLikelihoods.resize(heldOut.size());
+    gmm.LogLikelihoods(heldOut.data(), heldOut.size(), m_tmpLogLikelihoods.data(), m_numThreads);
+    double logLikelihood = 0;
+    for (double ll : m_tmpLogLikelihoods)
+        logLikelihood += ll;
+    logLikelihood /= heldOut.size();
+    return IsFinite(logLikelihood) ? logLikelihood : -std::numeric_limits<double>::max();
+}
+
+//----------------------------------------------------------------------------
+template <int Dims, typename Scalar>
+bool AC::GMM::StochasticEM<Dims, Scalar>::Process(ObservationSource<VecType>& source, const std::vector<VecType>& heldOut, GMMType& gmm)
+{
+    // The first step size is 1, so the initial statistics are replaced by those of the first mini-batch (only the modes are used to start)
+    m_onlineEM.Initialize(gmm, 0);
+    m_heldOutLogLikelihood = heldOut.empty() ? 0 : EvaluateHeldOut(heldOut, gmm);
+
+    bool converged = false;
+    bool rewound = false;
+    bool firstPass = true;
+    size_t numObservationsRead = 0;
+    m_numIterations = 0;
+    while (!converged && m_numIterations < m_maxIterations) {
+        if (source.NextBatch(m_batchSize, m_tmpBatch) == 0) {
+            // End of a pass: start the next one, unless the source is empty
+            if (rewound)
+                break;
+            source.Rewind();
+            rewound = true;
+            firstPass = false;
+            continue;
+        }
+        rewound = false;
+        if (firstPass)
+            numObservationsRead += m_tmpBatch.size();
+
+        double stepSize = pow(m_numIterations + 1.0, -m_stepSizeExponent);
+        m_onlineEM.Update(m_tmpBatch, gmm, stepSize);
+        ++m_numIterations;
+
+        // Stopping condition, as in EM, but on the held-out sample
+        if (!heldOut.empty() && m_numIterations % m_evaluationInterval == 0) {
+            double oldLikelihood = m_heldOutLogLikelihood;
+            m_heldOutLogLikelihood = EvaluateHeldOut(heldOut, gmm);
+            converged = abs((m_heldOutLogLikelihood - oldLikelihood) / oldLikelihood) <= m_tolerance;
+        }
+    }
+
+    // Set global weight based on the number of observations (to compare against other GMMs). The stepwise updates leave it untouched, since
+    // their statistics are averages per observation.
+    m_numObservations = source.NumObservations() > 0 ? source.NumObservations() : numObservationsRead;
+    if (m_numObservations > 0)
+        gmm.SetGlobalWeight(log((double)m_numObservations));
+    return converged;
+}
+
+// Supported dimensions and scalar types (same as GMM)
+#define AC_STOCHASTIC_EM_INSTANTIATE(Dims) \
+    template class AC::GMM::StochasticEM<Dims, double>; \
+    template class AC::GMM::StochasticEM<Dims, float>;
+AC_STOCHASTIC_EM_INSTANTIATE(2) AC_STOCHASTIC_EM_INSTANTIATE(3) AC_STOCHASTIC_EM_INSTANTIATE(4) AC_STOCHASTIC_EM_INSTANTIATE(5)
+AC_STOCHASTIC_EM_INSTANTIATE(6) AC_STOCHASTIC_EM_INSTANTIATE(7) AC_STOCHASTIC_EM_INSTANTIATE(8) AC_STOCHASTIC_EM_INSTANTIATE(Eigen::Dynamic)
+#undef AC_STOCHASTIC_EM_INSTANTIATE
@@ -0,0 +1,177 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2016 Alvaro Collet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+Neither name of this software nor the names of its contributors may be used to 
+endorse or promote products derived from this software without specific
+prior written permission. 
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __STOCHASTIC_EM_H__
+#define __STOCHASTIC_EM_H__
+
+#include <algorithm>
+#include <vector>
+#include "math_utils.h"
+#include "gmm.h"
+#include "online_em.h"
+#include "random_generator.h"
+
+namespace AC
+{
+    namespace GMM
+    {
+        const int c_StochasticEMBatchSize = 4096; // Number of observations per mini-batch
+        const int c_StochasticEMMaxIterations = 1000; // Max number of mini-batches
+        const double c_StochasticEMStepSizeExponent = 0.7; // Step size of mini-batch t is (t + 1)^-alpha, alpha in (0.5, 1]
+        const int c_StochasticEMEvaluationInterval = 20; // Number of mini-batches between evaluations of the held-out log likelihood
+
+        /// <summary> Source of training observations for StochasticEM, for data sets that do not fit in memory (e.g., a file of billions of
+        ///           observations, read in shuffled chunks). Each call to NextBatch returns (ideally random) observations the training has not seen
+        ///           in the current pass; once the source is exhausted, StochasticEM calls Rewind() to start the next pass. </summary>
+        template <typename Vec>
+        class ObservationSource {
+        public:
+            virtual ~ObservationSource() {}
+
+            /// <summary> Read the next mini-batch of observations. </summary>
+            /// <param name="maxObservations"> Max number of observations to read. </param>
+            /// <param name="batch"> [out] The observations (resized to the number of observations read). </param>
+            /// <returns> The number of observations read, 0 if the source is exhausted. </returns>
+            virtual size_t NextBatch(size_t maxObservations, std::vector<Vec>& batch) = 0;
+
+            /// <summary> Start a new pass over the observations. </summary>
+            virtual void Rewind() = 0;
+
+            /// <summary> Total number of observations in the source (only used to set the global weight of the GMM), 0 if unknown (StochasticEM
+            ///           then counts the observations of the first pass, or all the observations read if no pass was completed). </summary>
+            virtual size_t NumObservations() const { return 0; }
+        };
+
+        /// <summary> ObservationSource over observations in memory. Each pass visits all the observations once, in a random order (a new
+        ///           permutation per pass, drawn from a seeded generator), so the mini-batches are sampled without replacement. The observations
+        ///           are not copied, they must outlive the source. </summary>
+        template <typename Vec>
+        class VectorObservationSource : public ObservationSource<Vec> {
+        public:
+            VectorObservationSource(const std::vector<Vec>& observations, uint64_t seed = c_DefaultRandomSeed)
+                : m_observations(observations), m_generator(seed), m_position(0)
+            {
+                m_order.resize(observations.size());
+                for (size_t i = 0; i < m_order.size(); ++i)
+                    m_order[i] = i;
+                Shuffle();
+            }
+
+            size_t NextBatch(size_t maxObservations, std::vector<Vec>& batch) override
+            {
+                batch.resize(std::min(maxObservations, m_order.size() - m_position));
+                for (auto& observation : batch)
+                    observation = m_observations[m_order[m_position++]];
+                return batch.size();
+            }
+
+            void Rewind() override { Shuffle(); }
+            size_t NumObservations() const override { return m_observations.size(); }
+
+        private:
+            /// <summary> Draw the order of the next pass (Fisher-Yates shuffle), and go back to its beginning. </summary>
+            void Shuffle()
+            {
+                for (size_t i = m_order.size(); i > 1; --i)
+                    std::swap(m_order[i - 1], m_order[std::min((size_t)(m_generator.drawReal() * i), i - 1)]);
+                m_position = 0;
+            }
+
+            const std::vector<Vec>& m_observations;
+            std::vector<size_t> m_order; // Order of the observations in the current pass
+            RandomGenerator m_generator;
+            size_t m_position; // Number of observations of the current pass already read
+        };
+
+        /// <summary> Stochastic (stepwise) EM for training sets larger than memory. Instead of E-steps over all N observations, the GMM is updated
+        ///           after every mini-batch with OnlineEM::Update(batch, gmm, stepSize), with a decaying step size (t + 1)^-alpha. Only the
+        ///           current mini-batch is resident, and the memory is O(K * batchSize) instead of EM's O(K * N) responsibilities. Since the
+        ///           likelihood of the full training set is never computed, convergence is checked on a (small) held-out sample instead. The
+        ///           GMM must already be initialized, e.g., with GMM::Process on a sample of the observations. </summary>
+        template <int Dims, typename Scalar = double>
+        class StochasticEM {
+        public:
+            typedef GMM<Dims, Scalar> GMMType;
+            typedef typename GMMType::VecType VecType;
+
+            /// <summary> Constructor. </summary>
+            /// <param name="batchSize"> [optional] Number of observations per mini-batch. </param>
+            /// <param name="tolerance"> [optional] Stopping condition. If ratio of new vs old held-out log likelihoods is lower than tolerance, finish process. </param>
+            /// <param name="maxIterations"> [optional] Max number of mini-batches. </param>
+            /// <param name="numThreads"> [optional] Number of threads of the E-steps (0 = all hardware threads). Results are identical for a given number of threads. </param>
+            StochasticEM(int batchSize = c_StochasticEMBatchSize, double tolerance = c_EMDefaultTolerance, int maxIterations = c_StochasticEMMaxIterations, int numThreads = 1);
+
+            /// <summary> Train the GMM from the mini-batches of a source. </summary>
+            /// <param name="source"> The source of observations. </param>
+            /// <param name="heldOut"> Held-out observations used to check convergence every EvaluationInterval() mini-batches. If empty, the process
+            ///                        runs for maxIterations mini-batches (or until the source is empty). </param>
+            /// <param name="gmm"> [in,out] The (initialized) GMM to train. </param>
+            /// <returns> true if it converged, false if it reached maxIterations. </returns>
+            bool Process(ObservationSource<VecType>& source, const std::vector<VecType>& heldOut, GMMType& gmm);
+
+            /// <summary> Sets the step size schedule: the step size of mini-batch t (starting at 0) is (t + 1)^-exponent. Exponents in (0.5, 1]
+            ///           guarantee convergence; lower exponents forget the early (poorly estimated) statistics faster. </summary>
+            void setStepSizeExponent(double exponent);
+            double StepSizeExponent() const { return m_stepSizeExponent; }
+
+            /// <summary> Sets the number of mini-batches between evaluations of the held-out log likelihood. </summary>
+            void setEvaluationInterval(int interval) { _ASSERT(interval > 0 && L"Invalid interval"); m_evaluationInterval = interval; }
+            int EvaluationInterval() const { return m_evaluationInterval; }
+
+            /// <summary> Average held-out log likelihood per observation after the last evaluation. </summary>
+            double HeldOutLogLikelihood() const { return m_heldOutLogLikelihood; }
+
+            /// <summary> Number of mini-batches processed in the last call to Process. </summary>
+            int NumIterations() const { return m_numIterations; }
+
+            /// <summary> Number of observations the GMM was trained with in the last call to Process, which sets its global weight: the number of
+            ///           observations in the source if known, or else the number of observations read in the first pass over it. </summary>
+            size_t NumObservations() const { return m_numObservations; }
+
+        private:
+            /// <summary> Average log likelihood per observation of the held-out sample. </summary>
+            double EvaluateHeldOut(const std::vector<VecType>& heldOut, const GMMType& gmm);
+
+            OnlineEM<Dims, Scalar> m_onlineEM; // Sufficient statistics and stepwise updates
+            std::vector<VecType> m_tmpBatch; // Current mini-batch
+            std::vector<double> m_tmpLogLikelihoods; // Log likelihood of each held-out observation
+            int m_batchSize; // Number of observations per mini-batch
+            double m_tolerance; // Stopping condition
+            int m_maxIterations; // Max number of mini-batches
+            int m_numThreads; // Number of threads
+            double m_stepSizeExponent; // Step size of mini-batch t is (t + 1)^-exponent
+            int m_evaluationInterval; // Number of mini-batches between held-out evaluations
+            double m_heldOutLogLikelihood; // Average held-out log likelihood at the last evaluation
+            int m_numIterations; // Number of mini-batches processed in the last Process
+            size_t m_numObservations; // Number of observations in the source (or read in its first pass) in the last Process
+        };
+        typedef StochasticEM<3, double> StochasticEM3D;
+        typedef StochasticEM<3, float> StochasticEM3Df;
+    }
+}
+
+#endif
@@ -31,10 +31,22 @@ SOFTWARE.
 
 #include "stdafx.h"
 #include "gmm/gmm.h" // Remember, you need to put the $(SolutionDir) in "Additional Include Directories"
+#include "gmm/color_lookup_table.h"
+#include "gmm/compiled_gmm.h"
+#include "gmm/em.h"
+#include "gmm/gmm_bank.h"
 #include "gmm/kmeans.h"
 #include "gmm/math_utils.h"
+#include "gmm/online_em.h"
+#include "gmm/probability_map.h"
+#include "gmm/stochastic_em.h"
 #include <Eigen/Core> // Remember, you need to put the path to Eigen in "Additional Include Directories"
 #include <Eigen/Geometry>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <random>
 
 ///////////////////////////////////////////////////////////////////////////////
 // Basic test to show how to use KMeans 
@@ -67,36 +79,101 @@ bool TestKMeans3D()
         }
     }
 
-    // Run kmeans
-    KMeans<Vec3> kmeans(numCentroids);
-    std::vector<int> assignmentsKMeans(numObservations);
-    kmeans.setMaxIterations(100);
-    kmeans.Process(observations, 30 /* restart 30 times with different initializations */, assignmentsKMeans);
+    // Run kmeans with each initialization
+    const KMeansInitialization initializations[] = { KMeansInitialization::Random, KMeansInitialization::KMeansPlusPlus, KMeansInitialization::KMeansParallel };
+    for (KMeansInitialization initialization : initializations) {
+        KMeans<Vec3> kmeans(numCentroids);
+        std::vector<int> assignmentsKMeans(numObservations);
+        kmeans.setMaxIterations(100);
+        kmeans.setInitialization(initialization);
+        // Restart 30 times with different random initializations, the D^2 seedings need fewer
+        kmeans.Process(observations, initialization == KMeansInitialization::Random ? 30 : 3, assignmentsKMeans);
 
-    // Compute average best distance between centroids and KMeans
-    double avgBestDistance = 0;
-    int assignment;
-    for (auto& centroidGT : centroids)
-        avgBestDistance += kmeans.ClosestCentroid(centroidGT, assignment);
-    avgBestDistance /= (int)centroids.size();
+        // Compute average best distance between centroids and KMeans
+        double avgBestDistance = 0;
+        int assignment;
+        for (auto& centroidGT : centroids)
+            avgBestDistance += kmeans.ClosestCentroid(centroidGT, assignment);
+        avgBestDistance /= (int)centroids.size();
 
-    // Compute assignment differences between the ground truth and KMeans
-    int badAssignments = 0;
-    for (int i = 0; i < (int)assignmentsGT.size(); ++i) {
-        for (int j = i; j < (int)assignmentsGT.size(); ++j) {
-            if ((assignmentsGT[i] == assignmentsGT[j] && assignmentsKMeans[i] != assignmentsKMeans[j]) ||
-                (assignmentsGT[i] != assignmentsGT[j] && assignmentsKMeans[i] == assignmentsKMeans[j])) {
-                badAssignments++;
+        // Compute assignment differences between the ground truth and KMeans
+        int badAssignments = 0;
+        for (int i = 0; i < (int)assignmentsGT.size(); ++i) {
+            for (int j = i; j < (int)assignmentsGT.size(); ++j) {
+                if ((assignmentsGT[i] == assignmentsGT[j] && assignmentsKMeans[i] != assignmentsKMeans[j]) ||
+                    (assignmentsGT[i] != assignmentsGT[j] && assignmentsKMeans[i] == assignmentsKMeans[j])) {
+                    badAssignments++;
+                }
             }
         }
+        // Assignments are pairwise, so there is a total of N*(N-1)/2 possible bad assignments;
+        int maxAssignments = (int)assignmentsGT.size() * ((int)assignmentsGT.size() - 1) / 2;
+        // If centroids are within 10% distance of GT, and there are less than 10% assignment errors, declare success.
+        if (avgBestDistance >= scale || badAssignments >= (int)maxAssignments / 10)
+            return false;
     }
-    // Assignments are pairwise, so there is a total of N*(N-1)/2 possible bad assignments;
-    int maxAssignments = (int)assignmentsGT.size() * ((int)assignmentsGT.size() - 1) / 2;
-    // If centroids are within 10% distance of GT, and there are less than 10% assignment errors, declare success.
-    if (avgBestDistance < scale && badAssignments < (int)maxAssignments / 10)
-        return true;
-    else
+
+    // With fewer distinct observations than centroids, the D^2 seedings must repeat candidates and still place a centroid on each observation
+    std::vector<Vec3> fewObservations(numObservations);
+    for (int i = 0; i < numObservations; ++i)
+        fewObservations[i] = centroids[i % 3];
+    for (KMeansInitialization initialization : initializations) {
+        KMeans<Vec3> kmeans(numCentroids);
+        std::vector<int> assignmentsKMeans(numObservations);
+        kmeans.setInitialization(initialization);
+        kmeans.Process(fewObservations, 3, assignmentsKMeans);
+        for (const auto& centroid : kmeans.Centroids()) {
+            if (!centroid.allFinite())
+                return false;
+        }
+        int assignment;
+        for (int i = 0; i < numObservations; ++i) {
+            if (assignmentsKMeans[i] < 0 || assignmentsKMeans[i] >= numCentroids || kmeans.ClosestCentroid(fewObservations[i], assignment) > 1e-6)
+                return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for the determinism of KMeans. Two runs with the same seed and number of threads must give exactly the same centroids. On
+// well-separated clusters all the restarts that find them have the same cost, so the first restart must win whatever the number of threads.
+bool TestKMeansDeterminism3D()
+{
+    using namespace AC;
+
+    int numCentroids = 6;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 2);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> observations(6000);
+    for (int i = 0; i < (int)observations.size(); ++i)
+        observations[i] = Vec3(100.0 * (i % numCentroids), 50.0 * (i % 2), 0) + Vec3(noise(), noise(), noise());
+
+    auto runKMeans = [&](int numRestarts, int numThreads, uint64_t seed) {
+        KMeans<Vec3> kmeans(numCentroids);
+        kmeans.setInitialization(KMeansInitialization::KMeansPlusPlus);
+        kmeans.setSeed(seed);
+        kmeans.setNumThreads(numThreads);
+        std::vector<int> assignments;
+        kmeans.Process(observations, numRestarts, assignments);
+        return kmeans.Centroids();
+    };
+    auto isSame = [](const std::vector<Vec3>& centroids1, const std::vector<Vec3>& centroids2) {
+        return memcmp(centroids1.data(), centroids2.data(), centroids1.size() * sizeof(Vec3)) == 0;
+    };
+
+    std::vector<Vec3> centroids = runKMeans(8, 4, 1234);
+    if (!isSame(centroids, runKMeans(8, 4, 1234)))
+        return false;
+
+    // Ties are broken by restart order: the first restart wins, with any number of threads
+    std::vector<Vec3> centroidsFirstRestart = runKMeans(1, 1, 1234);
+    if (!isSame(centroids, centroidsFirstRestart) || !isSame(runKMeans(8, 1, 1234), centroidsFirstRestart))
         return false;
+
+    // A different seed gives (almost surely) another order of the centroids
+    return !isSame(runKMeans(1, 1, 4321), centroidsFirstRestart);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -172,10 +249,1075 @@ bool TestGMM3D()
 }
 
 ///////////////////////////////////////////////////////////////////////////////
+// Test for the vectorized kernels. Every instruction set supported by this CPU must give the same log likelihoods, responsibilities and
+// closest modes as the scalar kernels (up to the rounding differences of fused multiply-adds), which in turn must match GMM3D.
+bool TestCompiledGMM3DKernels()
+{
+    using namespace AC;
+
+    // A GMM with random modes, and a batch of observations that is not a multiple of the block size
+    int numModes = 13;
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> distribution(0, 255);
+    auto uniform = std::bind(distribution, generator);
+    GMM::GMM3D gmm(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        gmm.Modes(k)->Reinitialize(Vec3(uniform(), uniform(), uniform()), 50 + uniform());
+        gmm.Modes(k)->setWeight(1.0 / numModes);
+    }
+    int numObservations = 1000;
+    std::vector<Vec3> observations(numObservations);
+    for (auto& observation : observations)
+        observation = Vec3(uniform(), uniform(), uniform());
+
+    // Reference: scalar kernels
+    GMM::CompiledGMM3D compiled(gmm);
+    compiled.setInstructionSet(GMM::Kernels::Scalar);
+    std::vector<double> logLikelihoodsGT(numObservations), responsibilitiesGT(numObservations * numModes);
+    std::vector<int> modesGT(numObservations);
+    compiled.LogLikelihoods(observations.data(), numObservations, logLikelihoodsGT.data());
+    compiled.Responsibilities(observations.data(), numObservations, responsibilitiesGT.data());
+    compiled.ClosestModes(observations.data(), numObservations, modesGT.data());
+    for (int i = 0; i < numObservations; ++i) {
+        if (std::abs(logLikelihoodsGT[i] - gmm.LogLikelihood(observations[i])) > 1e-12 * std::abs(logLikelihoodsGT[i]))
+            return false;
+    }
+
+    // Every other instruction set supported by this CPU (GetKernels falls back to the fastest supported one)
+    GMM::Kernels::InstructionSet instructionSets[] = { GMM::Kernels::SSE42, GMM::Kernels::AVX2, GMM::Kernels::AVX512 };
+    for (auto instructionSet : instructionSets) {
+        compiled.setInstructionSet(instructionSet);
+        std::vector<double> logLikelihoods(numObservations), responsibilities(numObservations * numModes);
+        std::vector<int> modes(numObservations);
+        compiled.LogLikelihoods(observations.data(), numObservations, logLikelihoods.data());
+        compiled.Responsibilities(observations.data(), numObservations, responsibilities.data());
+        compiled.ClosestModes(observations.data(), numObservations, modes.data());
+        for (int i = 0; i < numObservations; ++i) {
+            if (std::abs(logLikelihoods[i] - logLikelihoodsGT[i]) > 1e-12 * std::abs(logLikelihoodsGT[i]) || modes[i] != modesGT[i])
+                return false;
+        }
+        for (int i = 0; i < numObservations * numModes; ++i) {
+            if (std::abs(responsibilities[i] - responsibilitiesGT[i]) > 1e-12)
+                return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for the fast precision mode. FastExp and FastLog must stay within their documented relative errors (5e-16 and 1e-15), and the
+// fast kernels of every instruction set supported by this CPU must match the exact log likelihoods and responsibilities.
+bool TestFastExpLog()
+{
+    using namespace AC;
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> distribution(0, 1);
+    auto uniform = std::bind(distribution, generator);
+    double maxExpError = 0, maxLogError = 0;
+    for (int i = 0; i < 100000; ++i) {
+        double x = -708 + 1416 * uniform();
+        maxExpError = std::max(maxExpError, std::abs(GMM::Kernels::FastExp(x) - exp(x)) / exp(x));
+        // Positive normal numbers of any magnitude, and numbers close to 1 (where log(x) is close to 0)
+        double y = std::ldexp(1 + uniform(), (int)(-1020 + 2040 * uniform()));
+        double z = 0.5 + 1.5 * uniform();
+        maxLogError = std::max(maxLogError, std::abs(GMM::Kernels::FastLog(y) - log(y)) / std::abs(log(y)));
+        maxLogError = std::max(maxLogError, std::abs(GMM::Kernels::FastLog(z) - log(z)) / std::abs(log(z)));
+    }
+    if (maxExpError > 5e-16 || maxLogError > 1e-15)
+        return false;
+
+    // Fast vs exact kernels
+    int numModes = 8;
+    GMM::GMM3D gmm(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        gmm.Modes(k)->Reinitialize(Vec3(255 * uniform(), 255 * uniform(), 255 * uniform()), 50 + 255 * uniform());
+        gmm.Modes(k)->setWeight(1.0 / numModes);
+    }
+    int numObservations = 1000;
+    std::vector<Vec3> observations(numObservations);
+    for (auto& observation : observations)
+        observation = Vec3(255 * uniform(), 255 * uniform(), 255 * uniform());
+
+    GMM::Kernels::InstructionSet instructionSets[] = { GMM::Kernels::Scalar, GMM::Kernels::SSE42, GMM::Kernels::AVX2, GMM::Kernels::AVX512 };
+    for (auto instructionSet : instructionSets) {
+        GMM::CompiledGMM3D compiled(gmm);
+        compiled.setInstructionSet(instructionSet);
+        std::vector<double> logLikelihoodsGT(numObservations), responsibilitiesGT(numObservations * numModes);
+        compiled.LogLikelihoods(observations.data(), numObservations, logLikelihoodsGT.data());
+        compiled.Responsibilities(observations.data(), numObservations, responsibilitiesGT.data());
+
+        compiled.setPrecision(GMM::EvaluationPrecision::Fast);
+        std::vector<double> logLikelihoods(numObservations), responsibilities(numObservations * numModes);
+        compiled.LogLikelihoods(observations.data(), numObservations, logLikelihoods.data());
+        compiled.Responsibilities(observations.data(), numObservations, responsibilities.data());
+        for (int i = 0; i < numObservations; ++i) {
+            if (std::abs(logLikelihoods[i] - logLikelihoodsGT[i]) > 1e-14 * std::abs(logLikelihoodsGT[i]))
+                return false;
+        }
+        for (int i = 0; i < numObservations * numModes; ++i) {
+            if (std::abs(responsibilities[i] - responsibilitiesGT[i]) > 1e-14)
+                return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for Hamerly's k-means. With the same seed it must give exactly the same assignments and centroids as Lloyd's algorithm.
+bool TestKMeansHamerly3D()
+{
+    using namespace AC;
+
+    int numCentroids = 24;
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> distribution(0, 255);
+    std::normal_distribution<double> normal(0, 8);
+    auto uniform = std::bind(distribution, generator);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids(numCentroids);
+    for (auto& centroid : centroids)
+        centroid = Vec3(uniform(), uniform(), uniform());
+    std::vector<Vec3> observations(20000);
+    for (int i = 0; i < (int)observations.size(); ++i)
+        observations[i] = centroids[i % numCentroids] + Vec3(noise(), noise(), noise());
+
+    std::vector<int> assignments[2];
+    std::vector<Vec3> centroidsKMeans[2];
+    KMeansAlgorithm algorithms[2] = { KMeansAlgorithm::Lloyd, KMeansAlgorithm::Hamerly };
+    for (int i = 0; i < 2; ++i) {
+        KMeans<Vec3> kmeans(numCentroids);
+        kmeans.setAlgorithm(algorithms[i]);
+        kmeans.setMaxIterations(100);
+        kmeans.Process(observations, 3, assignments[i]);
+        centroidsKMeans[i] = kmeans.Centroids();
+    }
+    if (assignments[0] != assignments[1])
+        return false;
+    for (int k = 0; k < numCentroids; ++k) {
+        if ((centroidsKMeans[0][k] - centroidsKMeans[1][k]).norm() > 1e-9)
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for weighted training. EM on the distinct observations weighted by their counts (see CountUniqueObservations) must give the same
+// GMM as EM on all the (repeated) observations, starting from the same modes.
+bool TestWeightedDeduplication3D()
+{
+    using namespace AC;
+
+    // Quantized colours, so that most observations are repeated
+    int numModes = 4;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 6);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids = { Vec3(40, 60, 200), Vec3(200, 40, 40), Vec3(90, 180, 90), Vec3(220, 220, 60) };
+    std::vector<Vec3> observations(40000);
+    for (int i = 0; i < (int)observations.size(); ++i) {
+        Vec3 observation = centroids[i % numModes] + Vec3(noise(), noise(), noise());
+        observations[i] = Vec3(std::round(observation[0]), std::round(observation[1]), std::round(observation[2]));
+    }
+    std::vector<Vec3> uniqueObservations;
+    std::vector<double> counts;
+    CountUniqueObservations(observations, uniqueObservations, counts);
+    if (uniqueObservations.size() >= observations.size() || std::accumulate(counts.begin(), counts.end(), 0.0) != (double)observations.size())
+        return false;
+
+    // Same initial modes for both
+    GMM::GMM3D gmmInit(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        gmmInit.Modes(k)->Reinitialize(centroids[k] + Vec3(10, -10, 10), 100.0);
+        gmmInit.Modes(k)->setWeight(1.0 / numModes);
+    }
+    GMM::TrainingOptions options;
+    options.warmStart = true;
+    GMM::GMM3D gmm(gmmInit), gmmWeighted(gmmInit);
+    gmm.Process(observations, options);
+    gmmWeighted.Process(uniqueObservations, counts, options);
+
+    double logLikelihood = gmm.LogLikelihood(observations);
+    if (gmmWeighted.Modes().size() != gmm.Modes().size() ||
+        std::abs(gmmWeighted.LogLikelihood(observations) - logLikelihood) > 1e-9 * std::abs(logLikelihood) ||
+        std::abs(gmmWeighted.GlobalWeight() - gmm.GlobalWeight()) > 1e-9)
+        return false;
+    for (int k = 0; k < (int)gmm.Modes().size(); ++k) {
+        if ((gmmWeighted.Modes(k)->Mean() - gmm.Modes(k)->Mean()).norm() > 1e-6 || std::abs(gmmWeighted.Modes(k)->Weight() - gmm.Modes(k)->Weight()) > 1e-9)
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+// Test for GMMBank. Save a few trained GMMs as a bank, map it back, and check that the models evaluate like the source GMMs and that
+// their bytes are unchanged (also after removing modes, whose freed slots must not leave stale bytes).
+bool TestGMMBank3D()
+{
+    using namespace AC;
+
+    const int maxModes = 6;
+    int numModels = 3;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 5);
+    auto noise = std::bind(normal, generator);
+    std::vector<GMM::GMM3D> gmms;
+    std::vector<GMM::FixedGMM3D<maxModes>> models(numModels);
+    std::vector<Vec3> testObservations;
+    for (int m = 0; m < numModels; ++m) {
+        int numModes = 2 + 2 * m;
+        std::vector<Vec3> observations(6000);
+        for (int i = 0; i < (int)observations.size(); ++i)
+            observations[i] = Vec3(40.0 * (i % numModes), 30.0 * m, 20.0 * (i % 3)) + Vec3(noise(), noise(), noise());
+        gmms.push_back(GMM::GMM3D(numModes));
+        gmms[m].Process(observations);
+        if (!models[m].FromGMM(gmms[m]))
+            return false;
+        testObservations.insert(testObservations.end(), observations.begin(), observations.begin() + 100);
+    }
+
+    // A GMM with more modes than the capacity must be rejected, not truncated
+    GMM::FixedGMM3D<2> tooSmall;
+    if (tooSmall.FromGMM(gmms[numModels - 1]) || tooSmall.NumModes() != 0)
+        return false;
+
+    // Removing the lightest mode of a model must give the same bytes as the model built without it
+    GMM::FixedGMM3D<maxModes> pruned = models[numModels - 1], reference;
+    pruned.SortModes();
+    pruned.RemoveBadModes(pruned.Weight(pruned.NumModes() - 1));
+    GMM::GMM3D prunedGMM(gmms[numModels - 1]);
+    std::sort(prunedGMM.Modes().begin(), prunedGMM.Modes().end(), [](const GMM::GMM3D::mode_type& m1, const GMM::GMM3D::mode_type& m2) { return m1->Weight() > m2->Weight(); });
+    prunedGMM.Modes().pop_back();
+    if (!reference.FromGMM(prunedGMM) || memcmp(&pruned, &reference, sizeof(pruned)) != 0)
+        return false;
+    models.push_back(pruned);
+    gmms.push_back(prunedGMM);
+
+    const char* path = "gmm_bank_test.bin";
+    if (!GMM::SaveGMMBank(path, models))
+        return false;
+    bool isOK;
+    {
+        GMM::GMMBank3D<maxModes> bank;
+        isOK = bank.Open(path) && bank.NumModels() == models.size();
+        for (size_t m = 0; isOK && m < models.size(); ++m) {
+            isOK = memcmp(&bank.Model(m), &models[m], sizeof(models[m])) == 0 && bank.Model(m).GlobalWeight() == gmms[m].GlobalWeight();
+            for (const auto& observation : testObservations) {
+                double logLikelihood = gmms[m].LogLikelihood(observation);
+                if (std::abs(bank.LogLikelihood(m, observation) - logLikelihood) > 1e-9 * std::max(1.0, std::abs(logLikelihood)))
+                    isOK = false;
+            }
+        }
+        GMM::GMMBank3D<maxModes + 1> otherLayout;
+        if (otherLayout.Open(path))
+            isOK = false;
+    }
+    std::remove(path);
+    return isOK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for the storage of the responsibilities in EM. The same data and initial modes must give the same GMM with every ResponsibilityStorage:
+// up to rounding without storage, and up to float precision with the float storages (TopK keeping all the modes).
+bool TestResponsibilityStorage3D()
+{
+    using namespace AC;
+
+    int numModes = 4;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 8);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids = { Vec3(40, 60, 200), Vec3(200, 40, 40), Vec3(90, 180, 90), Vec3(120, 120, 120) };
+    std::vector<Vec3> observations(20000);
+    for (int i = 0; i < (int)observations.size(); ++i)
+        observations[i] = centroids[i % numModes] + Vec3(noise(), noise(), noise()) * (1 + i % 3);
+
+    GMM::GMM3D gmmInit(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        gmmInit.Modes(k)->Reinitialize(centroids[k] + Vec3(15, -15, 15), 400.0);
+        gmmInit.Modes(k)->setWeight(1.0 / numModes);
+    }
+
+    GMM::ResponsibilityStorage storages[4] = { GMM::ResponsibilityStorage::ModeMajor, GMM::ResponsibilityStorage::PointMajor,
+        GMM::ResponsibilityStorage::TopK, GMM::ResponsibilityStorage::None };
+    double tolerances[4] = { 0, 1e-4, 1e-4, 1e-9 };
+    std::vector<GMM::GMM3D> gmms;
+    for (int s = 0; s < 4; ++s) {
+        // No early stop, so that every storage runs the same number of iterations (and Process reports that EM did not converge)
+        GMM::EM3D em((int)observations.size(), numModes, 0, 10);
+        em.setResponsibilityStorage(storages[s]);
+        em.setTopK(numModes);
+        gmms.push_back(gmmInit);
+        em.Process(observations, gmms[s]);
+    }
+    for (int s = 1; s < 4; ++s) {
+        for (int k = 0; k < numModes; ++k) {
+            const auto& mode = *gmms[s].Modes(k);
+            const auto& reference = *gmms[0].Modes(k);
+            double tolerance = tolerances[s] * std::max(1.0, reference.Covariance().norm());
+            if ((mode.Mean() - reference.Mean()).norm() > tolerance || (mode.Covariance() - reference.Covariance()).norm() > tolerance ||
+                std::abs(mode.Weight() - reference.Weight()) > tolerances[s])
+                return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for the covariance of a Gaussian. EvaluateLog must match the textbook density, a covariance that is only semidefinite (observations
+// on a plane) must be regularized (slightly changed, not reset), and one that is not positive semidefinite must fall back to a small diagonal one.
+bool TestCovarianceRegularization3D()
+{
+    using namespace AC;
+
+    Vec3 mean(10, 20, 30);
+    Vec3 observation(12, 17, 31);
+    Mat3 scatter;
+    scatter << 4, 1, 0.5,
+        2, 3, 1,
+        -1, 0.5, 2;
+    Mat3 covariance = scatter * scatter.transpose();
+    GaussianDistribution3D gaussian(mean, 1.0);
+    gaussian.setCovariance(covariance);
+    Vec3 centeredObservation = observation - mean;
+    double logDensity = -0.5 * (3 * log(2 * acos(-1.0)) + log(covariance.determinant()) + centeredObservation.dot(covariance.inverse() * centeredObservation));
+    if (std::abs(gaussian.EvaluateLog(observation) - logDensity) > 1e-12 * std::abs(logDensity) ||
+        (gaussian.InvCovariance() * covariance - Mat3::Identity()).norm() > 1e-12)
+        return false;
+
+    // Rank 2: every variance is large, but the determinant is zero
+    Vec3 u(3, 1, 2), v(-1, 4, 1);
+    Mat3 planar = u * u.transpose() + v * v.transpose();
+    gaussian.setCovariance(planar);
+    if ((gaussian.Covariance() - planar).norm() > 1e-8 || !IsFinite(gaussian.EvaluateLog(mean + u + v)) ||
+        !IsFinite(gaussian.LogNormFactor()))
+        return false;
+
+    // Indefinite (eigenvalues 3, 1 and -1): reset to the safe diagonal covariance
+    Mat3 indefinite;
+    indefinite << 1, 2, 0,
+        2, 1, 0,
+        0, 0, 1;
+    gaussian.setCovariance(indefinite);
+    if (gaussian.Covariance() != Mat3::Identity() * GaussianDistribution3D::Limits::SafeCovarianceFactor() || !IsFinite(gaussian.EvaluateLog(observation)))
+        return false;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for the covariance types. Diagonal and spherical Gaussians must evaluate like full ones with the same (diagonal) covariance, EM must keep
+// diagonal covariances diagonal and give all tied modes the same covariance, and the compiled GMM must match them all.
+bool TestCovarianceTypes3D()
+{
+    using namespace AC;
+
+    Vec3 mean(10, 20, 30);
+    std::vector<Vec3> testObservations = { Vec3(12, 17, 31), Vec3(0, 0, 0), Vec3(10, 20, 30), Vec3(-40, 90, 35) };
+    Mat3 covariances[2] = { Vec3(4, 9, 0.25).asDiagonal(), Mat3::Identity() * 6 };
+    CovarianceType types[2] = { CovarianceType::Diagonal, CovarianceType::Spherical };
+    for (int t = 0; t < 2; ++t) {
+        GaussianDistribution3D full(mean, 1.0), structured(mean, 1.0);
+        full.setCovariance(covariances[t]);
+        structured.setCovarianceType(types[t]);
+        structured.setCovariance(covariances[t]);
+        for (const auto& observation : testObservations) {
+            double logDensity = full.EvaluateLog(observation);
+            if (std::abs(structured.EvaluateLog(observation) - logDensity) > 1e-12 * std::max(1.0, std::abs(logDensity)))
+                return false;
+        }
+    }
+
+    // Elongated clusters, with a different orientation each
+    int numModes = 3;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 1);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids = { Vec3(40, 60, 200), Vec3(200, 40, 40), Vec3(90, 180, 90) };
+    std::vector<Vec3> observations(9000);
+    for (int i = 0; i < (int)observations.size(); ++i) {
+        Vec3 offset(noise() * 10, noise() * 3, noise() * 5);
+        observations[i] = centroids[i % numModes] + Eigen::AngleAxisd(0.5 * (i % numModes), Vec3::UnitZ()) * offset;
+    }
+    std::vector<double> logLikelihoods(observations.size());
+    CovarianceType trainedTypes[3] = { CovarianceType::Diagonal, CovarianceType::Spherical, CovarianceType::Tied };
+    for (int t = 0; t < 3; ++t) {
+        GMM::GMM3D gmm(numModes);
+        gmm.setCovarianceType(trainedTypes[t]);
+        gmm.Process(observations);
+        for (int k = 0; k < numModes; ++k) {
+            const Mat3& covariance = gmm.Modes(k)->Covariance();
+            if (trainedTypes[t] == CovarianceType::Tied ? covariance != gmm.Modes(0)->Covariance() : !covariance.isDiagonal(0))
+                return false;
+            if (trainedTypes[t] == CovarianceType::Spherical && (covariance(0, 0) != covariance(1, 1) || covariance(0, 0) != covariance(2, 2)))
+                return false;
+        }
+        GMM::CompiledGMM3D compiledGMM(gmm);
+        if (compiledGMM.Data().sharedPrecision != (trainedTypes[t] == CovarianceType::Tied))
+            return false;
+        compiledGMM.LogLikelihoods(observations.data(), observations.size(), logLikelihoods.data());
+        for (size_t i = 0; i < observations.size(); ++i) {
+            double logLikelihood = gmm.LogLikelihood(observations[i]);
+            if (std::abs(logLikelihoods[i] - logLikelihood) > 1e-12 * std::max(1.0, std::abs(logLikelihood)))
+                return false;
+        }
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for multithreaded training. Two trainings with the same number of threads (more than one) must give bit-identical GMMs.
+bool TestMultithreadedTraining3D()
+{
+    using namespace AC;
+
+    int numModes = 5;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 10);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids = { Vec3(40, 60, 200), Vec3(200, 40, 40), Vec3(90, 180, 90), Vec3(120, 120, 120), Vec3(220, 220, 60) };
+    std::vector<Vec3> observations(30000);
+    for (int i = 0; i < (int)observations.size(); ++i)
+        observations[i] = centroids[i % numModes] + Vec3(noise(), noise(), noise());
+
+    GMM::TrainingOptions options;
+    options.numThreads = 4;
+    GMM::GMM3D gmm1(numModes), gmm2(numModes);
+    gmm1.Process(observations, options);
+    gmm2.Process(observations, options);
+    if (gmm1.Modes().size() != gmm2.Modes().size() || gmm1.GlobalWeight() != gmm2.GlobalWeight())
+        return false;
+    for (int k = 0; k < (int)gmm1.Modes().size(); ++k) {
+        const auto& mode1 = *gmm1.Modes(k);
+        const auto& mode2 = *gmm2.Modes(k);
+        if (mode1.Weight() != mode2.Weight() || memcmp(mode1.Mean().data(), mode2.Mean().data(), sizeof(Vec3)) != 0 ||
+            memcmp(mode1.Covariance().data(), mode2.Covariance().data(), sizeof(Mat3)) != 0)
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for the batch evaluation functions. Single-threaded and multithreaded, they must match the functions that evaluate one observation.
+template <typename GMMType>
+bool CheckBatchEvaluation(const GMMType& gmm, const std::vector<typename GMMType::VecType>& observations, int numThreads)
+{
+    size_t numObservations = observations.size();
+    int numModes = (int)gmm.Modes().size();
+    std::vector<double> logLikelihoods(numObservations), likelihoods(numObservations), logProbabilities(numObservations);
+    std::vector<double> responsibilities(numObservations * numModes);
+    std::vector<int> modes(numObservations);
+    gmm.LogLikelihoods(observations.data(), numObservations, logLikelihoods.data(), numThreads);
+    gmm.Likelihoods(observations.data(), numObservations, likelihoods.data(), numThreads);
+    gmm.Responsibilities(observations.data(), numObservations, responsibilities.data(), numThreads);
+    gmm.ClosestModes(observations.data(), numObservations, modes.data(), logProbabilities.data(), numThreads);
+
+    double tolerance = 1e-12;
+    for (size_t n = 0; n < numObservations; ++n) {
+        double logLikelihood = gmm.LogLikelihood(observations[n]);
+        double likelihood = gmm.Likelihood(observations[n]);
+        int mode;
+        double logProbability = gmm.ClosestMode(observations[n], mode);
+        if (std::abs(logLikelihoods[n] - logLikelihood) > tolerance * std::max(1.0, std::abs(logLikelihood)) ||
+            std::abs(likelihoods[n] - likelihood) > tolerance * likelihood ||
+            modes[n] != mode || std::abs(logProbabilities[n] - logProbability) > tolerance * std::max(1.0, std::abs(logProbability)))
+            return false;
+        for (int k = 0; k < numModes; ++k) {
+            double responsibility = exp(gmm.Modes(k)->EvaluateLog(observations[n]) + gmm.Modes(k)->LogWeight() - logLikelihood);
+            if (std::abs(responsibilities[n * numModes + k] - responsibility) > tolerance)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool TestBatchEvaluation()
+{
+    using namespace AC;
+
+    int numModes = 4;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 10);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids = { Vec3(40, 60, 200), Vec3(200, 40, 40), Vec3(90, 180, 90), Vec3(120, 120, 120) };
+    std::vector<Vec3> observations(5000);
+    std::vector<Vec2> observations2D(observations.size());
+    for (int i = 0; i < (int)observations.size(); ++i) {
+        observations[i] = centroids[i % numModes] + Vec3(noise(), noise(), noise());
+        observations2D[i] = observations[i].head<2>();
+    }
+    // An odd number of observations, so that the last block of the vectorized kernels is incomplete, and a far away one
+    observations.resize(observations.size() - 3);
+    observations.push_back(Vec3(1000, -1000, 500));
+
+    GMM::GMM3D gmm(numModes);
+    gmm.Process(observations);
+    GMM::GMM<2, double> gmm2D(numModes);
+    gmm2D.Process(observations2D);
+    for (int numThreads : { 1, 4 }) {
+        if (!CheckBatchEvaluation(gmm, observations, numThreads) || !CheckBatchEvaluation(gmm2D, observations2D, numThreads))
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for single precision GMMs. Trained from the same initial modes, a GMM3Df (and EM3Df) must give the same GMM as the double one, up to
+// float precision, and its compiled form must evaluate like it.
+bool TestFloatGMM3D()
+{
+    using namespace AC;
+
+    int numModes = 4;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 8);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> centroids = { Vec3(40, 60, 200), Vec3(200, 40, 40), Vec3(90, 180, 90), Vec3(120, 120, 120) };
+    std::vector<Vec3> observations(20000);
+    std::vector<Vec3f> observationsf(observations.size());
+    for (int i = 0; i < (int)observations.size(); ++i) {
+        observationsf[i] = (centroids[i % numModes] + Vec3(noise(), noise(), noise()) * (1 + i % 3)).cast<float>();
+        observations[i] = observationsf[i].cast<double>();
+    }
+
+    // With GMM::Process (which sorts the modes by weight) and with EM alone
+    GMM::GMM3D gmm(numModes);
+    GMM::GMM3Df gmmf(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        Vec3 mean = centroids[k] + Vec3(15, -15, 15);
+        gmm.Modes(k)->Reinitialize(mean, 400.0, 1.0 / numModes);
+        gmmf.Modes(k)->Reinitialize(mean.cast<float>(), 400.0, 1.0 / numModes);
+    }
+    GMM::GMM3D gmmEM(gmm);
+    GMM::GMM3Df gmmEMf(gmmf);
+    GMM::TrainingOptions options;
+    options.warmStart = true;
+    gmm.Process(observations, options);
+    gmmf.Process(observationsf, options);
+    GMM::EM3D em((int)observations.size(), numModes);
+    em.Process(observations, gmmEM);
+    GMM::EM3Df emf((int)observationsf.size(), numModes);
+    emf.Process(observationsf, gmmEMf);
+
+    GMM::GMM3D* doubleGMMs[2] = { &gmm, &gmmEM };
+    GMM::GMM3Df* floatGMMs[2] = { &gmmf, &gmmEMf };
+    for (int g = 0; g < 2; ++g) {
+        if (floatGMMs[g]->Modes().size() != doubleGMMs[g]->Modes().size())
+            return false;
+        for (int k = 0; k < numModes; ++k) {
+            const auto& mode = *doubleGMMs[g]->Modes(k);
+            const auto& modef = *floatGMMs[g]->Modes(k);
+            if ((modef.Mean().cast<double>() - mode.Mean()).norm() > 1e-3 || std::abs(modef.Weight() - mode.Weight()) > 1e-4 ||
+                (modef.Covariance().cast<double>() - mode.Covariance()).norm() > 1e-4 * mode.Covariance().norm())
+                return false;
+        }
+    }
+
+    GMM::CompiledGMM3D compiledGMM(gmmf);
+    std::vector<double> logLikelihoods(observationsf.size());
+    compiledGMM.LogLikelihoods(observationsf.data(), observationsf.size(), logLikelihoods.data());
+    for (size_t i = 0; i < observationsf.size(); ++i) {
+        // The compiled GMM evaluates the float parameters in double precision
+        double logLikelihood = gmm.LogLikelihood(observations[i]);
+        double logLikelihoodf = gmmf.LogLikelihood(observationsf[i]);
+        if (std::abs(logLikelihoodf - logLikelihood) > 1e-4 * std::abs(logLikelihood) ||
+            std::abs(logLikelihoods[i] - logLikelihoodf) > 1e-5 * std::abs(logLikelihood))
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for other dimensions. 2D, 5D and dynamic-dimension (GMMXD) GMMs must find well-separated clusters, and the 5D and dynamic ones must
+// give the same model for the same data.
+template <typename GMMType>
+bool TrainAndFindCentroids(GMMType& gmm, const std::vector<typename GMMType::VecType>& observations, const std::vector<typename GMMType::VecType>& centroids)
+{
+    gmm.Process(observations);
+    if (gmm.Modes().size() != centroids.size())
+        return false;
+    for (const auto& centroid : centroids) {
+        double closestDistance = std::numeric_limits<double>::max();
+        for (const auto& mode : gmm.Modes())
+            closestDistance = std::min(closestDistance, (double)(mode->Mean() - centroid).norm());
+        if (closestDistance > 1.0)
+            return false;
+    }
+    return true;
+}
+
+bool TestOtherDimensions()
+{
+    using namespace AC;
+
+    int numModes = 4;
+    int dimensions = 5;
+    std::default_random_engine generator;
+    std::normal_distribution<double> normal(0, 3);
+    auto noise = std::bind(normal, generator);
+    typedef Eigen::Matrix<double, 5, 1> Vec5;
+    std::vector<Vec5> centroids5D(numModes);
+    std::vector<Vec2> centroids2D(numModes);
+    std::vector<Eigen::VectorXd> centroidsXD(numModes);
+    for (int k = 0; k < numModes; ++k) {
+        centroids5D[k] << 50.0 * k, 100.0 - 30.0 * k, 20.0 * (k % 2), -40.0 * k, 10.0;
+        centroids2D[k] = centroids5D[k].head<2>();
+        centroidsXD[k] = centroids5D[k];
+    }
+    std::vector<Vec5> observations5D(8000);
+    std::vector<Vec2> observations2D(observations5D.size());
+    std::vector<Eigen::VectorXd> observationsXD(observations5D.size());
+    for (int i = 0; i < (int)observations5D.size(); ++i) {
+        for (int d = 0; d < dimensions; ++d)
+            observations5D[i][d] = centroids5D[i % numModes][d] + noise();
+        observations2D[i] = observations5D[i].head<2>();
+        observationsXD[i] = observations5D[i];
+    }
+
+    GMM::GMM<2, double> gmm2D(numModes);
+    GMM::GMM<5, double> gmm5D(numModes);
+    GMM::GMMXD gmmXD(numModes, dimensions);
+    if (!TrainAndFindCentroids(gmm2D, observations2D, centroids2D) || !TrainAndFindCentroids(gmm5D, observations5D, centroids5D) ||
+        !TrainAndFindCentroids(gmmXD, observationsXD, centroidsXD) || gmmXD.Dimensions() != dimensions)
+        return false;
+    double logLikelihood5D = gmm5D.LogLikelihood(observations5D);
+    return std::abs(gmmXD.LogLikelihood(observationsXD) - logLikelihood5D) < 1e-9 * std::abs(logLikelihood5D);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for mini-batch KMeans. Small batches must recover well-separated centroids, and GMM::Process must use them when
+// TrainingOptions::kmeansAlgorithm is MiniBatch, i.e., give the same GMM as a warm start from the centroids of the same KMeans.
+bool TestMiniBatchKMeans3D()
+{
+    using namespace AC;
+
+    int numCentroids = 5;
+    double scale = 10;
+    std::vector<Vec3> centroids = { Vec3(-scale, 0, 0), Vec3(0, -scale, 0), Vec3(0, 0, -scale), Vec3(scale, 0, 0), Vec3(0, scale, 0) };
+    std::default_random_engine generator;
+    std::normal_distribution<double> distribution(0, 1);
+    auto noise = std::bind(distribution, generator);
+    std::vector<Vec3> observations(20000);
+    for (int i = 0; i < (int)observations.size(); ++i)
+        observations[i] = centroids[i % numCentroids] + Vec3(noise(), noise(), noise());
+
+    GMM::TrainingOptions options;
+    options.kmeansAlgorithm = KMeansAlgorithm::MiniBatch;
+    options.miniBatchSize = 64;
+    KMeans<Vec3> kmeans(numCentroids);
+    kmeans.setInitialization(options.kmeansInitialization);
+    kmeans.setAlgorithm(options.kmeansAlgorithm);
+    kmeans.setMiniBatchSize(options.miniBatchSize);
+    kmeans.setMiniBatchIterations(options.miniBatchIterations);
+    kmeans.setSeed(options.seed);
+    std::vector<int> assignments(observations.size());
+    kmeans.Process(observations, options.numKMeansRestarts, assignments);
+    int assignment;
+    for (const auto& centroid : centroids) {
+        if (kmeans.ClosestCentroid(centroid, assignment) > 0.5)
+            return false;
+    }
+
+    GMM::GMM3D gmm(numCentroids);
+    gmm.Process(observations, options);
+    GMM::GMM3D gmmWarmStart(numCentroids);
+    for (int k = 0; k < numCentroids; ++k) {
+        gmmWarmStart.Modes(k)->Reinitialize(kmeans.Centroids(k), kmeans.AvgVariance(k));
+        gmmWarmStart.Modes(k)->setWeight(kmeans.CentroidAssignmentRatio(k));
+    }
+    options.warmStart = true;
+    options.reseedWeakModes = false;
+    gmmWarmStart.Process(observations, options);
+    if (gmm.Modes().size() != gmmWarmStart.Modes().size())
+        return false;
+    for (int k = 0; k < (int)gmm.Modes().size(); ++k) {
+        if (gmm.Modes(k)->Mean() != gmmWarmStart.Modes(k)->Mean() || gmm.Modes(k)->Weight() != gmmWarmStart.Modes(k)->Weight())
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for OnlineEM. Batches that drift must move the means towards the new data, and the effective number of observations must decay
+// with the forgetting factor (lambda * previous + batch size), which also sets the global weight of the GMM.
+bool TestOnlineEM3D()
+{
+    using namespace AC;
+
+    std::vector<Vec3> centroids = { Vec3(-10, 0, 0), Vec3(10, 0, 0) };
+    std::default_random_engine generator;
+    std::normal_distribution<double> distribution(0, 1);
+    auto noise = std::bind(distribution, generator);
+    auto makeBatch = [&](int numObservations, const Vec3& drift) {
+        std::vector<Vec3> batch(numObservations);
+        for (int i = 0; i < numObservations; ++i)
+            batch[i] = centroids[i % 2] + drift + Vec3(noise(), noise(), noise());
+        return batch;
+    };
+
+    int numObservations = 4000;
+    GMM::GMM3D gmm(2);
+    gmm.Process(makeBatch(numObservations, Vec3(0, 0, 0)));
+    double forgettingFactor = 0.5;
+    GMM::OnlineEM3D onlineEM(forgettingFactor);
+    onlineEM.Initialize(gmm, numObservations);
+
+    Vec3 drift(0, 2, 0);
+    int batchSize = 1000;
+    double effectiveNumObservations = numObservations;
+    double previousDistance = std::numeric_limits<double>::max();
+    for (int t = 0; t < 10; ++t) {
+        onlineEM.Update(makeBatch(batchSize, drift), gmm);
+        effectiveNumObservations = forgettingFactor * effectiveNumObservations + batchSize;
+        if (std::abs(onlineEM.EffectiveNumObservations() - effectiveNumObservations) > 1e-6 * effectiveNumObservations ||
+            std::abs(gmm.GlobalWeight() - log(effectiveNumObservations)) > 1e-9)
+            return false;
+
+        // Every mode must follow the drift, getting closer to its drifted centroid after each batch
+        double distance = 0;
+        for (const auto& centroid : centroids) {
+            double closestDistance = std::numeric_limits<double>::max();
+            for (const auto& mode : gmm.Modes())
+                closestDistance = std::min(closestDistance, (mode->Mean() - (centroid + drift)).norm());
+            distance = std::max(distance, closestDistance);
+        }
+        if (distance >= previousDistance && distance > 0.2)
+            return false;
+        previousDistance = distance;
+    }
+    return previousDistance < 0.2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for StochasticEM. VectorObservationSource must visit every observation once per pass, and a GMM initialized on a small sample must
+// converge to the held-out log likelihood of a GMM trained with EM on all the observations, with the global weight of all of them.
+bool TestStochasticEM3D()
+{
+    using namespace AC;
+
+    std::vector<Vec3> centroids = { Vec3(-10, 0, 0), Vec3(0, 10, 0), Vec3(10, 0, 5) };
+    std::default_random_engine generator;
+    std::normal_distribution<double> distribution(0, 2);
+    auto noise = std::bind(distribution, generator);
+    std::vector<Vec3> observations(40000);
+    std::vector<Vec3> heldOut(2000);
+    for (int i = 0; i < (int)observations.size(); ++i)
+        observations[i] = centroids[i % 3] + Vec3(noise(), noise(), noise());
+    for (int i = 0; i < (int)heldOut.size(); ++i)
+        heldOut[i] = centroids[i % 3] + Vec3(noise(), noise(), noise());
+
+    // Every pass visits every observation once, in a new order
+    GMM::VectorObservationSource<Vec3> source(observations);
+    std::vector<Vec3> batch;
+    std::vector<int> order[2];
+    for (int pass = 0; pass < 2; ++pass) {
+        std::vector<int> numVisits(observations.size(), 0);
+        source.Rewind();
+        while (source.NextBatch(1000, batch) > 0) {
+            for (const auto& observation : batch) {
+                int i = int(std::find(observations.begin(), observations.end(), observation) - observations.begin());
+                if (i == (int)observations.size())
+                    return false;
+                numVisits[i]++;
+                order[pass].push_back(i);
+            }
+        }
+        if (std::count(numVisits.begin(), numVisits.end(), 1) != (int)observations.size())
+            return false;
+    }
+    if (order[0] == order[1])
+        return false;
+
+    // Reference: EM on all the observations
+    GMM::GMM3D gmmEM(3);
+    gmmEM.Process(observations);
+    double heldOutLogLikelihoodEM = gmmEM.LogLikelihood(heldOut) / heldOut.size();
+
+    // Stochastic EM, initialized on a small sample
+    GMM::GMM3D gmm(3);
+    gmm.Process(std::vector<Vec3>(observations.begin(), observations.begin() + 150));
+    GMM::StochasticEM3D stochasticEM(1024, 1e-5, 1000);
+    if (!stochasticEM.Process(source, heldOut, gmm))
+        return false;
+    return std::abs(stochasticEM.HeldOutLogLikelihood() - gmm.LogLikelihood(heldOut) / heldOut.size()) < 1e-9 &&
+        stochasticEM.HeldOutLogLikelihood() > heldOutLogLikelihoodEM - 0.01 && stochasticEM.NumObservations() == observations.size() &&
+        std::abs(gmm.GlobalWeight() - log((double)observations.size())) < 1e-12;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for ObservationSummary. Coarsening must keep the total weight and mean of the observations and every observation within MaxError() of
+// its representative, a multithreaded Push must equal sequential Pushes of the same shards followed by Merge, and training with the summarize
+// option must give about the same GMM as training on all the observations.
+bool TestObservationSummary3D()
+{
+    using namespace AC;
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> distribution(0, 100);
+    auto random = std::bind(distribution, generator);
+    std::vector<Vec3> observations(5003);
+    Vec3 mean(0, 0, 0);
+    for (auto& observation : observations) {
+        observation = Vec3(random(), random(), random());
+        mean += observation / (double)observations.size();
+    }
+
+    // Few bins for the range of the observations, so that the summary coarsens several times
+    size_t maxBins = 500;
+    ObservationSummary3D summary(1.0, maxBins);
+    summary.Push(observations);
+    std::vector<Vec3> representatives;
+    std::vector<double> weights;
+    summary.Representatives(representatives, weights);
+    if (summary.CellSize() <= 1.0 || summary.NumBins() > maxBins || representatives.size() != summary.NumBins() ||
+        summary.SumWeights() != (double)observations.size() || std::accumulate(weights.begin(), weights.end(), 0.0) != summary.SumWeights())
+        return false;
+    Vec3 weightedMean(0, 0, 0);
+    for (size_t i = 0; i < representatives.size(); ++i)
+        weightedMean += representatives[i] * weights[i] / summary.SumWeights();
+    if ((weightedMean - mean).norm() > 1e-9)
+        return false;
+    for (const auto& observation : observations) {
+        double closestDistance = std::numeric_limits<double>::max();
+        for (const auto& representative : representatives)
+            closestDistance = std::min(closestDistance, (observation - representative).norm());
+        if (closestDistance > summary.MaxError())
+            return false;
+    }
+
+    // Multithreaded Push vs sequential Push of the shards of ParallelFor, merged in order
+    int numThreads = 4;
+    ObservationSummary3D summaryThreads(1.0, maxBins);
+    summaryThreads.Push(observations, numThreads);
+    ObservationSummary3D summaryMerged(1.0, maxBins);
+    for (int t = 0; t < numThreads; ++t) {
+        ObservationSummary3D summaryShard(1.0, maxBins);
+        for (size_t o = observations.size() * t / numThreads; o < observations.size() * (t + 1) / numThreads; ++o)
+            summaryShard.Push(observations[o]);
+        summaryMerged.Merge(summaryShard);
+    }
+    std::vector<Vec3> representativesThreads, representativesMerged;
+    std::vector<double> weightsThreads, weightsMerged;
+    summaryThreads.Representatives(representativesThreads, weightsThreads);
+    summaryMerged.Representatives(representativesMerged, weightsMerged);
+    if (summaryThreads.CellSize() != summaryMerged.CellSize() || representativesThreads != representativesMerged || weightsThreads != weightsMerged ||
+        summaryThreads.SumWeights() != summary.SumWeights())
+        return false;
+
+    // Training on the summary of well-separated clusters
+    std::vector<Vec3> centroids = { Vec3(20, 20, 20), Vec3(80, 20, 50), Vec3(50, 80, 80) };
+    std::normal_distribution<double> normal(0, 4);
+    auto noise = std::bind(normal, generator);
+    std::vector<Vec3> clusters(30000);
+    for (int i = 0; i < (int)clusters.size(); ++i)
+        clusters[i] = centroids[i % 3] + Vec3(noise(), noise(), noise());
+    GMM::GMM3D gmm(3);
+    gmm.Process(clusters);
+    GMM::TrainingOptions options;
+    options.summarize = true;
+    GMM::GMM3D gmmSummary(3);
+    gmmSummary.Process(clusters, options);
+    double logLikelihood = gmm.LogLikelihood(clusters);
+    return std::abs(gmmSummary.LogLikelihood(clusters) - logLikelihood) < 1e-3 * std::abs(logLikelihood) &&
+        std::abs(gmmSummary.GlobalWeight() - log((double)clusters.size())) < 1e-12;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for ProbabilityMap. The map must match GMMLikelihoodRatio on interleaved and planar, 8-bit and float images, also for colours far from
+// both GMMs, where the likelihoods underflow, and the posteriors of all the models must add up to 1.
+bool TestProbabilityMap()
+{
+    using namespace AC;
+
+    // Compact foreground (reddish) and background (bluish) colours, so that far colours underflow
+    std::default_random_engine generator;
+    std::normal_distribution<double> distribution(0, 4);
+    auto noise = std::bind(distribution, generator);
+    std::vector<Vec3> fgColours(2000), bgColours(3000);
+    for (int i = 0; i < (int)fgColours.size(); ++i)
+        fgColours[i] = (i % 2 ? Vec3(200, 40, 40) : Vec3(160, 90, 60)) + Vec3(noise(), noise(), noise());
+    for (int i = 0; i < (int)bgColours.size(); ++i)
+        bgColours[i] = (i % 2 ? Vec3(40, 60, 200) : Vec3(90, 90, 150)) + Vec3(noise(), noise(), noise());
+    GMM::GMM3D fgGMM(2), bgGMM(2);
+    fgGMM.Process(fgColours);
+    bgGMM.Process(bgColours);
+    Vec3 farColour(0, 255, 0);
+    if (fgGMM.Likelihood(farColour) != 0 || bgGMM.Likelihood(farColour) != 0)
+        return false;
+
+    // Image (not a multiple of the block size) with foreground, background and random colours
+    int width = 37, height = 23;
+    std::uniform_int_distribution<int> uniform(0, 255);
+    std::vector<Vec3> pixels(width * height);
+    for (int i = 0; i < (int)pixels.size(); ++i) {
+        const Vec3& colour = i % 3 == 0 ? fgColours[i] : i % 3 == 1 ? bgColours[i] : Vec3(uniform(generator), uniform(generator), uniform(generator));
+        for (int c = 0; c < 3; ++c)
+            pixels[i][c] = std::round(std::min(255.0, std::max(0.0, colour[c])));
+    }
+    pixels[0] = farColour;
+    pixels[width + 1] = Vec3(255, 0, 255);
+
+    // Layouts: interleaved RGBA with padded rows and planar with contiguous planes (8-bit), interleaved RGB and planar with padded planes (float)
+    size_t rowStrideRGBA = 4 * width + 8;
+    std::vector<unsigned char> interleaved8(rowStrideRGBA * height), planar8(3 * width * height);
+    size_t planeStride = (width * height + 5) * sizeof(float);
+    std::vector<float> interleaved32(3 * width * height), planar32(3 * planeStride / sizeof(float));
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int i = y * width + x;
+            for (int c = 0; c < 3; ++c) {
+                interleaved8[y * rowStrideRGBA + 4 * x + c] = (unsigned char)pixels[i][c];
+                planar8[c * width * height + i] = (unsigned char)pixels[i][c];
+                interleaved32[3 * i + c] = (float)pixels[i][c];
+                planar32[c * planeStride / sizeof(float) + i] = (float)pixels[i][c];
+            }
+        }
+    }
+    GMM::ImageView images[] = {
+        GMM::ImageView::Interleaved(interleaved8.data(), width, height, rowStrideRGBA, 4),
+        GMM::ImageView::Planar(planar8.data(), width, height),
+        GMM::ImageView::Interleaved(interleaved32.data(), width, height),
+        GMM::ImageView::Planar(planar32.data(), width, height, 0, planeStride) };
+
+    GMM::CompiledGMM3D compiledFg(fgGMM), compiledBg(bgGMM);
+    const GMM::CompiledGMM3D* models[] = { &compiledFg, &compiledBg };
+    for (const auto& image : images) {
+        for (int numThreads : { 1, 4 }) {
+            std::vector<float> map(pixels.size(), -1.0f), fgMap(pixels.size(), -1.0f), bgMap(pixels.size(), -1.0f);
+            std::vector<unsigned char> map8(pixels.size());
+            GMM::ProbabilityMap(fgGMM, bgGMM, image, GMM::ProbabilityMapView::Create(map.data(), width, height), numThreads);
+            GMM::ProbabilityMap(fgGMM, bgGMM, image, GMM::ProbabilityMapView::Create(map8.data(), width, height), numThreads);
+            GMM::ProbabilityMapView maps[] = { GMM::ProbabilityMapView::Create(fgMap.data(), width, height),
+                GMM::ProbabilityMapView::Create(bgMap.data(), width, height) };
+            GMM::ProbabilityMap(models, 2, image, maps, numThreads);
+            for (int i = 0; i < (int)pixels.size(); ++i) {
+                double ratio = GMM::GMMLikelihoodRatio(fgGMM, bgGMM, pixels[i]);
+                if (!(std::abs(map[i] - ratio) < 1e-6) || std::abs(map8[i] - std::round(255 * ratio)) > 1 || fgMap[i] != map[i] ||
+                    std::abs(fgMap[i] + bgMap[i] - 1.0) > 1e-6)
+                    return false;
+            }
+        }
+    }
+
+    // Colours far outside the range of 8-bit images
+    std::vector<float> farImage = { 1e4f, -1e4f, 1e4f, 255.0f, 0.0f, 0.0f };
+    std::vector<float> farMap(2);
+    GMM::ProbabilityMap(fgGMM, bgGMM, GMM::ImageView::Interleaved(farImage.data(), 2, 1), GMM::ProbabilityMapView::Create(farMap.data(), 2, 1));
+    for (int i = 0; i < 2; ++i) {
+        double ratio = GMM::GMMLikelihoodRatio(fgGMM, bgGMM, Vec3(farImage[3 * i], farImage[3 * i + 1], farImage[3 * i + 2]));
+        if (!(std::abs(farMap[i] - ratio) < 1e-6))
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test for ColorLookupTable. The values at the grid nodes must match the GMMs, trilinear lookups between nodes must stay within the values
+// of the 8 surrounding nodes, and the lookups of an image must match the lookups of its pixels.
+bool TestColorLookupTable()
+{
+    using namespace AC;
+
+    std::default_random_engine generator;
+    std::normal_distribution<double> distribution(0, 20);
+    auto noise = std::bind(distribution, generator);
+    std::vector<Vec3> fgColours(2000), bgColours(3000);
+    for (int i = 0; i < (int)fgColours.size(); ++i)
+        fgColours[i] = (i % 2 ? Vec3(200, 40, 40) : Vec3(160, 90, 60)) + Vec3(noise(), noise(), noise());
+    for (int i = 0; i < (int)bgColours.size(); ++i)
+        bgColours[i] = (i % 2 ? Vec3(40, 60, 200) : Vec3(90, 90, 150)) + Vec3(noise(), noise(), noise());
+    GMM::GMM3D fgGMM(2), bgGMM(2);
+    fgGMM.Process(fgColours);
+    bgGMM.Process(bgColours);
+
+    // 16 nodes per channel, every 17 colour levels in [0, 255]
+    int bitsPerChannel = 4;
+    double nodeSpacing = 17;
+    GMM::ColorLookupTable logLikelihoodTable, posteriorTable;
+    logLikelihoodTable.BakeLogLikelihood(fgGMM, bitsPerChannel);
+    posteriorTable.BakePosterior(fgGMM, bgGMM, bitsPerChannel, 0, 255, 4);
+    int resolution = logLikelihoodTable.Resolution();
+    if (resolution != 16 || posteriorTable.Resolution() != resolution)
+        return false;
+    auto node = [&](const GMM::ColorLookupTable& table, int x, int y, int z) { return table.Values()[(x * resolution + y) * resolution + z]; };
+    for (int x = 0; x < resolution; ++x) {
+        for (int y = 0; y < resolution; ++y) {
+            for (int z = 0; z < resolution; ++z) {
+                Vec3 colour(x * nodeSpacing, y * nodeSpacing, z * nodeSpacing);
+                double logLikelihood = fgGMM.LogLikelihood(colour);
+                if (std::abs(node(logLikelihoodTable, x, y, z) - logLikelihood) > 1e-6 * std::abs(logLikelihood) + 1e-6 ||
+                    std::abs(node(posteriorTable, x, y, z) - GMM::GMMLikelihoodRatio(fgGMM, bgGMM, colour)) > 1e-6)
+                    return false;
+                for (const GMM::ColorLookupTable* table : { &logLikelihoodTable, &posteriorTable }) {
+                    float value = node(*table, x, y, z);
+                    if (table->Lookup(colour) != value || table->Lookup(colour, GMM::ColorLookupTable::Trilinear) != value ||
+                        table->Lookup((unsigned char)colour[0], (unsigned char)colour[1], (unsigned char)colour[2]) != value)
+                        return false;
+                }
+            }
+        }
+    }
+
+    // Trilinear lookups between nodes
+    std::uniform_real_distribution<double> uniform(0, 255);
+    for (int i = 0; i < 1000; ++i) {
+        Vec3 colour(uniform(generator), uniform(generator), uniform(generator));
+        int x0 = std::min(int(colour[0] / nodeSpacing), resolution - 2);
+        int y0 = std::min(int(colour[1] / nodeSpacing), resolution - 2);
+        int z0 = std::min(int(colour[2] / nodeSpacing), resolution - 2);
+        for (const GMM::ColorLookupTable* table : { &logLikelihoodTable, &posteriorTable }) {
+            float minValue = std::numeric_limits<float>::max(), maxValue = -std::numeric_limits<float>::max();
+            for (int corner = 0; corner < 8; ++corner) {
+                float value = node(*table, x0 + (corner & 1), y0 + ((corner >> 1) & 1), z0 + (corner >> 2));
+                minValue = std::min(minValue, value);
+                maxValue = std::max(maxValue, value);
+            }
+            float value = table->Lookup(colour, GMM::ColorLookupTable::Trilinear);
+            float tolerance = 1e-5f * std::max(1.0f, std::abs(value));
+            if (!(value >= minValue - tolerance && value <= maxValue + tolerance))
+                return false;
+        }
+    }
+
+    // Lookups of an image
+    int width = 37, height = 23;
+    std::uniform_int_distribution<int> uniform8(0, 255);
+    std::vector<unsigned char> image(3 * width * height);
+    for (auto& channel : image)
+        channel = (unsigned char)uniform8(generator);
+    for (auto interpolation : { GMM::ColorLookupTable::Nearest, GMM::ColorLookupTable::Trilinear }) {
+        std::vector<float> map(width * height);
+        posteriorTable.Lookup(GMM::ImageView::Interleaved(image.data(), width, height), GMM::ProbabilityMapView::Create(map.data(), width, height), interpolation, 4);
+        for (int i = 0; i < width * height; ++i) {
+            if (map[i] != posteriorTable.Lookup(Vec3(image[3 * i], image[3 * i + 1], image[3 * i + 2]), interpolation))
+                return false;
+        }
+    }
+    return true;
+}
+
 int main()
 {
     bool isKMeansOK = TestKMeans3D();
+    bool isKMeansDeterminismOK = TestKMeansDeterminism3D();
     bool isGMMOK = TestGMM3D();
-    return isKMeansOK && isGMMOK;
+    bool isCompiledGMMOK = TestCompiledGMM3DKernels();
+    bool isFastExpLogOK = TestFastExpLog();
+    bool isHamerlyOK = TestKMeansHamerly3D();
+    bool isWeightedOK = TestWeightedDeduplication3D();
+    bool isGMMBankOK = TestGMMBank3D();
+    bool isStorageOK = TestResponsibilityStorage3D();
+    bool isCovarianceOK = TestCovarianceRegularization3D();
+    bool isCovarianceTypesOK = TestCovarianceTypes3D();
+    bool isMultithreadedOK = TestMultithreadedTraining3D();
+    bool isBatchEvaluationOK = TestBatchEvaluation();
+    bool isFloatOK = TestFloatGMM3D();
+    bool isOtherDimensionsOK = TestOtherDimensions();
+    bool isMiniBatchOK = TestMiniBatchKMeans3D();
+    bool isOnlineEMOK = TestOnlineEM3D();
+    bool isStochasticEMOK = TestStochasticEM3D();
+    bool isObservationSummaryOK = TestObservationSummary3D();
+    bool isProbabilityMapOK = TestProbabilityMap();
+    bool isColorLookupTableOK = TestColorLookupTable();
+    return isKMeansOK && isKMeansDeterminismOK && isGMMOK && isCompiledGMMOK && isFastExpLogOK && isHamerlyOK && isWeightedOK && isGMMBankOK && isStorageOK && isCovarianceOK && isCovarianceTypesOK && isMultithreadedOK && isBatchEvaluationOK && isFloatOK && isOtherDimensionsOK && isMiniBatchOK && isOnlineEMOK && isStochasticEMOK && isObservationSummaryOK && isProbabilityMapOK && isColorLookupTableOK;
 }
-